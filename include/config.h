@@ -0,0 +1,44 @@
+/* mobi-ramp controller build configuration
+ *
+ * Sensor link: enable one transport for a single-link build, or both for UART with BLE failover
+ * (UART primary, BLE hot standby, see include/transport.h).
+ *
+ * BLE backend: Bluedroid (BLEDevice, part of the core) or, with BLE_NIMBLE, the smaller NimBLE-Arduino stack. The
+ * esp32-bluedroid and esp32-nimble environments in platformio.ini are the same BLE-only build on either stack. "ble"
+ * on the console prints the heap the stack took and the connect times, to compare the two on a deployment.
+ *
+ * Every flag can also be set from build_flags.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifndef BLE_COMM
+#define  BLE_COMM             false
+#endif
+#ifndef UART_COMM
+#define  UART_COMM            true
+#endif
+#ifndef BLE_NIMBLE
+#define  BLE_NIMBLE           false
+#endif
+#ifndef EVENT_REPORT
+#define  EVENT_REPORT         true    // machine-readable @EV lines on Serial for the host gateway
+#endif
+#ifndef RULES_RUNTIME
+#define  RULES_RUNTIME        true    // operation mode rules editable from the console and kept in NVS, see include/rules.h
+#endif
+
+#define  LINK_FAILOVER        (BLE_COMM && UART_COMM)
+
+// Adaptive relay hold (warning light mode, relaytiming "in"): hold for a percentile of the observed entry-to-exit
+// time instead of the full pot setting. The pot setting stays the upper bound. See include/dwell.h.
+#ifndef ADAPTIVE_RELAY
+#define  ADAPTIVE_RELAY       false
+#endif
+#define  ADAPTIVE_PERCENTILE  0.90f
+#define  ADAPTIVE_MARGIN_MS   500     // added on top of the percentile
+#define  ADAPTIVE_MIN_HOLD_MS 1000
+#define  ADAPTIVE_MIN_SAMPLES 20      // use the pot setting until this many passes were seen
+
+#endif // CONFIG_H
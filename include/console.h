@@ -0,0 +1,23 @@
+/* Line console on the USB serial port (Serial)
+ *
+ * Commands are single lines, the first word picks the handler from the table in console.cpp. Replies are plain
+ * lines; the ones meant for programs start with '@' like the event lines (mobi_event.h). A command can take raw
+ * binary data after its line with Console_Take(), e.g. "fw stage" (fw_update.h).
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONSOLE_LINE_SIZE     96
+#define CONSOLE_RX_RING_SIZE  4096  // Serial RX ring, holds a loop() worth of raw data at 115200 with room to spare
+#define CONSOLE_RAW_CHUNK     256
+
+// Reads whatever the host sent and runs complete lines, call from every loop()
+void    Console_Poll();
+// Hands the next length bytes from the host to sink, in chunks, instead of reading lines. 0 ends it early.
+void    Console_Take(size_t length, void (*sink)(const uint8_t* data, size_t length));
+
+#endif // CONSOLE_H
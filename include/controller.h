@@ -0,0 +1,91 @@
+/* Controller core shared with the sensor transports (src/transport_*.cpp).
+ */
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "mobi_event.h"
+
+#define LINK_UART                 0
+#define LINK_BLE                  1
+
+// Parameters pushed to the sensor after every handshake, in this order
+#define SENSOR_PARAM_OPERATIONMODE  0   // 06
+#define SENSOR_PARAM_DIRECTION      1   // 01
+#define SENSOR_PARAM_RELAYTIMER     2   // 02
+#define SENSOR_PARAM_SENSITIVITY    3   // 04
+#define SENSOR_PARAM_DIRECTION_CAT  4   // 08
+#define SENSOR_PARAM_DIRECTION1     5   // 21, second channel
+#define SENSOR_PARAM_RELAYTIMER1    6   // 22, second channel
+#define SENSOR_PARAM_BATCH          7   // 23, longest a sensor holds an event back to batch it, see Param_Push
+#define SENSOR_PARAM_COUNT          8
+#define SENSOR_PARAM_ALL            ((1u << SENSOR_PARAM_DIRECTION1) - 1)
+#define SENSOR_PARAM_CH2            ((1u << SENSOR_PARAM_DIRECTION1) | (1u << SENSOR_PARAM_RELAYTIMER1))
+#define BATCH_WINDOW_MS             40  // default for 23, 0: one event per notification
+#define PARAM_PUSH_INTERVAL_MS      500 // the sensor needs time to apply each one
+#define PARAM_PUSH_MAX              2   // transports with a push running at the same time
+
+// Paced parameter push state, one per transport
+struct Param_Push {
+  uint8_t         pending;    // bit per SENSOR_PARAM_*
+  unsigned long   last_ms;
+  bool            batch;      // the sensor takes 23: BLE sensors that advertise BLE_CAP_BATCH, set by the transport
+};
+
+extern String     OPERATIONMODE_CMD;
+extern String     DIRECTION_CMD;
+extern String     RELAYTIMER_CMD;
+extern String     SENSITIVITY_CMD;
+extern String     DIRECTION_CAT_CMD;
+extern String     BAUDRATE_CMD;
+extern String     FWACK_CMD;
+extern String     DIRECTION1_CMD;
+extern String     RELAYTIMER1_CMD;
+extern String     BATCHWINDOW_CMD;
+
+extern uint8_t    OPERATIONMODE_PARAM;
+extern uint8_t    DIRECTION_PARAM;
+extern uint8_t    RELAYTIMING_PARAM;
+extern int        RELAYTIMER_PARAM;
+extern uint8_t    TWOCHANNLEMODE_PARAM;
+extern uint8_t    TWOINONEMODE_PARAM;
+extern uint8_t    DIRECTION_PARAM1;
+extern uint8_t    RELAYTIMING_PARAM1;
+extern int        RELAYTIMER_PARAM1;
+extern int        SENSITIVITY_LEVEL_VALUE;
+extern int        DIRECTION_VALUE;
+extern int        BATCHWINDOW_PARAM;
+extern int        Frame_Log;
+
+void    Report_Event(char kind, int value);
+String  converter(uint8_t val);
+
+// SENSOR_PARAM_* bits the sensor behind this push gets in the current channel mode
+uint8_t Sensor_Param_Mask(const Param_Push& push);
+void    Param_Push_Start(Param_Push& push);
+bool    Param_Push_Step(Param_Push& push, size_t (*write)(const char* data, size_t length));
+// Queues changed parameters (SENSOR_PARAM_* bits) on every transport
+void    Param_Push_Changed(uint8_t mask);
+// Releases the relays and drops queued passes when the operation or channel mode changes at runtime
+void    Operation_Mode_Changed();
+// True while a relay output is energized or timing, the BLE transports hold off scanning meanwhile
+bool    Relay_Busy();
+
+// Called by a transport from loop() for every frame received from the sensor once its parameters were pushed.
+void    Sensor_Receive(uint8_t link, const uint8_t* pData, size_t length);
+// Same for a notification carrying several '\n'-terminated frames, returns how many there were. Also from loop():
+// the BLE transports queue notifications in their callback and hand them on from poll().
+size_t  Sensor_Receive_Batch(uint8_t link, const uint8_t* pData, size_t length);
+// main.cpp: acts on one frame from the sensor, ack is set when a detection has to be acknowledged. src/sensor_link.cpp
+// hands the frames on and sends the ack.
+void    Sensor_Frame(uint8_t link, const uint8_t* pData, size_t length, int32_t& ack);
+void    Detect_Ack(uint16_t seq);
+// Hands a conditioned detection to the lane logic, called by detect_filter.cpp
+void    Detect_Apply(uint8_t lane, uint8_t detect, unsigned long ms);
+// Link state changes and sensor reboots as seen by one transport.
+void    Sensor_Link_Changed(uint8_t link, bool up);
+void    Sensor_Restarted(uint8_t link);
+
+#endif // CONTROLLER_H
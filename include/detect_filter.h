@@ -0,0 +1,48 @@
+/* Detection conditioning per lane
+ *
+ * Sits between the parsed (and sequenced) detection frames and the lane logic. A sensor near its sensitivity
+ * threshold chatters 00:01/00:00 many times a second; passed through as is, every toggle re-arms the warning light,
+ * adds a pass in counter mode and is logged. Here a detection is only applied once it holds:
+ *
+ *   min on      a 00:01 must not be taken back for Filter_Min_On_Ms
+ *   min off     a 00:00 must not be taken back for Filter_Min_Off_Ms
+ *   refractory  a 00:01 within Filter_Refractory_Ms of the last applied one is dropped
+ *   duplicate   a frame repeating the current (or pending) state is dropped
+ *
+ * A transition that is taken back before its minimum time drops both frames. Transitions that held are applied
+ * from Detect_Filter_Poll() with the time of the frame that started them, so dwell times stay right. A 0 ms
+ * minimum applies the frame right away. After a reset the lane state is unknown and the first frame is never a
+ * duplicate.
+ *
+ * The filter ships off (all times 0): only duplicates are dropped and a detection reaches the relays as before.
+ * A minimum time delays every relay activation by that time plus up to one loop() pass (100 ms), since held
+ * transitions are applied from Detect_Filter_Poll(); enable it on sites that chatter.
+ *
+ * The times are console settings (filter_on_ms, filter_off_ms, refractory_ms); "filter" prints the counters:
+ *
+ *   @FLT,<lane>,<applied>,<duplicate>,<chatter>,<refractory>
+ */
+
+#ifndef DETECT_FILTER_H
+#define DETECT_FILTER_H
+
+#include <stdint.h>
+
+#define FILTER_LANES            2
+#define FILTER_MIN_ON_MS        0       // e.g. 100 on a chattering site
+#define FILTER_MIN_OFF_MS       0       // e.g. 300
+#define FILTER_REFRACTORY_MS    0       // e.g. 500
+#define FILTER_REPORT_MS        5000UL  // drops are logged as one summary line at most this often
+
+extern int      Filter_Min_On_Ms;
+extern int      Filter_Min_Off_Ms;
+extern int      Filter_Refractory_Ms;
+
+void    Detect_Filter_Input(uint8_t lane, uint8_t detect, unsigned long ms);
+// Applies the transitions that held, call from every loop()
+void    Detect_Filter_Poll();
+// Forgets pending transitions, the lanes start from "no vehicle" (sensor restarted or mode changed)
+void    Detect_Filter_Reset();
+void    Detect_Filter_Print();
+
+#endif // DETECT_FILTER_H
@@ -0,0 +1,37 @@
+/* Detection sequencing: in order, exactly once
+ *
+ * Sequenced detections: "00:0V,<seq>,<sensor ms>". The sensor numbers its detections from 1 after every "start",
+ * keeps up to a small window of them unacknowledged and sends them again from the oldest one until "10:<seq>"
+ * acknowledges it (cumulative). Frames without a sequence number are applied as they come, as before.
+ *
+ * Only the next number in the sequence is applied; the numbers wrap at 16 bits. After a controller boot the first
+ * sequenced frame is taken as the next one, whatever its number. A frame behind the sequence is a retransmission
+ * (duplicate), one ahead of it leaves a hole (gap, counted once until it is filled). Both are dropped and answered
+ * with the last applied number, so the sensor goes back to the first missing one.
+ *
+ * Drops are logged as one summary line at most every DETECT_SEQ_REPORT_MS; "seq" on the console prints:
+ *
+ *   @SEQ,<synced>,<next>,<applied>,<gaps>,<duplicates>
+ */
+
+#ifndef DETECT_SEQ_H
+#define DETECT_SEQ_H
+
+#include <stdint.h>
+
+#define DETECT_SEQ_REPORT_MS    5000UL
+
+// Returns true if the detection with this sequence number is the next one and has to be applied. ack is set to
+// what to acknowledge; acks are cumulative, so the caller sends only the last one of a batch.
+bool      Detect_Sequence(uint16_t seq, int32_t& ack);
+// The sensor restarted and numbers its detections from 1 again
+void      Detect_Seq_Reset();
+// Where the sequence stood, kept over a warm restart
+bool      Detect_Seq_Synced();
+uint16_t  Detect_Seq_Next();
+void      Detect_Seq_Restore(bool synced, uint16_t next);
+// Logs the drops since the last report, call from every loop()
+void      Detect_Seq_Poll();
+void      Detect_Seq_Print();
+
+#endif // DETECT_SEQ_H
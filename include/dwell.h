@@ -0,0 +1,26 @@
+/* Vehicle dwell per lane and the adaptive relay hold
+ *
+ * The time from a lane's 00:01 to its 00:00 (detection times, the sensor's clock) is fed to a streaming percentile
+ * estimate per lane. With ADAPTIVE_RELAY (include/config.h) a warning light holds for ADAPTIVE_PERCENTILE of those
+ * times plus ADAPTIVE_MARGIN_MS instead of the full pot setting, which stays the upper bound. Until a lane has seen
+ * ADAPTIVE_MIN_SAMPLES passes the pot setting is used as is.
+ *
+ * Only with relaytiming "in": with "out" the hold starts as the vehicle leaves, the time it took to pass says nothing
+ * about how long the light has to stay on, and the pot setting wins.
+ */
+
+#ifndef DWELL_H
+#define DWELL_H
+
+#include <stdint.h>
+
+#define DWELL_LANES             2
+#define DWELL_MIN_MS            100     // shorter or longer intervals are chatter or a stuck
+#define DWELL_MAX_MS            60000   // detection and are not fed to the estimate
+
+// An applied detection, ms is its detection time
+void      Dwell_Track(uint8_t lane, uint8_t detect, unsigned long ms);
+// Relay hold in loop() ticks (100 ms) for a pot setting of pot_ticks and the lane's relaytiming
+int       Dwell_Hold_Ticks(uint8_t lane, int pot_ticks, uint8_t timing);
+
+#endif // DWELL_H
@@ -0,0 +1,64 @@
+/* Sensor firmware update over the sensor link
+ *
+ * A sensor image is staged in the controller's flash from the USB console and then streamed to the sensor over
+ * whichever link is active, so sensors can be updated without a visit.
+ *
+ * Staging: "fw stage <size> <crc32 hex>" on the console, then exactly <size> raw bytes, e.g. from a host:
+ *
+ *   printf 'fw stage %d %08x\n' $(stat -c %s img.bin) $(crc32 img.bin) > /dev/ttyUSB0; cat img.bin > /dev/ttyUSB0
+ *
+ * The image goes to the data partition labelled FW_STAGE_LABEL (the default partition tables' otherwise unused
+ * SPIFFS partition), is read back and checked against the CRC, and is remembered over a reboot. A stage that sees
+ * no data for FW_STAGE_TIMEOUT_MS is abandoned.
+ *
+ * Transfer, "fw send":
+ *
+ *   controller -> 12:<size>,<crc32>,<block size>        offer, crc32 in hex
+ *   sensor     -> 14:<next>                             the block it needs first: 0, or where an earlier
+ *                                                       transfer of the same image stopped
+ *   controller -> 13:<block>,<crc32>,<base64 data>      blocks, up to FW_WINDOW unacknowledged
+ *   sensor     -> 14:<next>                             cumulative ack, at least every 8 blocks and right away
+ *                                                       for a block it had to drop (out of order or bad CRC)
+ *   sensor     -> 12:<code>                             after the last block: 00 image verified, else an error
+ *
+ * Missing blocks are sent again from the last ack (go-back-N) after FW_DUP_ACKS repeated acks or FW_RTO_MS without
+ * progress. A link that goes down pauses the transfer; once a link is ready again the image is offered anew and
+ * the sensor's answer resumes it. The same happens for "fw send" after a controller reboot.
+ *
+ * The blocks are paced by the link's free transmit space (SensorTransport::writeRoom()). loop() waits in
+ * Fw_Delay(), which keeps sending in FW_PACE_MS slices while the link takes more, so a link that only has room
+ * for a few writes at a time (BLE, see BLE_TX_CREDITS) is not held to one burst per loop(). "fw status" reports
+ * progress and throughput:
+ *
+ *   @FW,<state>,<acked blocks>,<blocks>,<payload B/s>,<link B/s>,<retransmitted blocks>
+ */
+
+#ifndef FW_UPDATE_H
+#define FW_UPDATE_H
+
+#include <stdint.h>
+
+#define FW_STAGE_LABEL          "spiffs"
+#define FW_STAGE_TIMEOUT_MS     5000UL
+#define FW_BLOCK_SIZE           256     // payload bytes per block, less if the link's writes are smaller
+#define FW_WINDOW               32      // blocks in flight
+#define FW_DUP_ACKS             3
+#define FW_RTO_MS               1000UL  // at least one loop() on each side plus the window on the wire
+#define FW_OFFER_MS             1000UL
+#define FW_OFFER_TRIES          5
+#define FW_VERIFY_MS            10000UL // last block acked to the sensor's verdict
+#define FW_REPORT_MS            2000UL
+#define FW_PACE_MS              10UL    // Fw_Delay() looks for transmit space this often, BLE_TX_CREDIT_MS
+
+// Console command: fw stage|send|abort|status
+void    Fw_Command(char* args);
+// Runs staging timeouts and the transfer, call from every loop()
+void    Fw_Poll();
+// delay() for loop(): while blocks are being sent it keeps sending them as the link makes room
+void    Fw_Delay(unsigned long ms);
+
+// Frames from the sensor, called by Sensor_Receive
+void    Fw_Ack(uint16_t next);
+void    Fw_Result(uint8_t code);
+
+#endif // FW_UPDATE_H
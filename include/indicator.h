@@ -0,0 +1,58 @@
+/* Front panel indicators (PowerLED, ERRLED, RelayLED)
+ *
+ * Each LED runs a pattern from the table in indicator.cpp on its own LEDC channel, stepped by a periodic esp_timer,
+ * so showing a state from the control loop is a table lookup and never waits.
+ *
+ * Every LED has one slot per priority. The control code puts a pattern in a slot (or IND_PAT_NONE to clear it) and
+ * the highest priority slot that holds a pattern is what the LED shows; clearing it falls back to the one below.
+ * Showing the pattern that is already playing does not restart it, so it is fine to call Indicator_Show() on every
+ * pass of loop().
+ *
+ * IND_PAT_CODE is a blink code: the first steps of the pattern repeat `code` times, then the rest of it plays once
+ * (a long pause), and the whole thing loops. New diagnostics only need a code, or a new row in the pattern table.
+ * Codes above IND_CODE_MAX blink as IND_CODE_MAX, so one round stays short enough to count.
+ */
+
+#ifndef INDICATOR_H
+#define INDICATOR_H
+
+#include <stdint.h>
+
+#define INDICATOR_TICK_MS       10
+#define INDICATOR_LEDC_FREQ     5000
+#define INDICATOR_LEDC_BITS     8
+#define INDICATOR_LEDC_CHANNEL  0     // first of IND_COUNT consecutive LEDC channels
+#define IND_CODE_MAX            15
+
+enum Indicator_Led {
+  IND_POWER,
+  IND_ERROR,
+  IND_RELAY,
+  IND_COUNT
+};
+
+// Lowest first
+enum Indicator_Priority {
+  IND_PRIO_STATE,   // steady state, e.g. relay on
+  IND_PRIO_LINK,    // sensor link state
+  IND_PRIO_FAULT,   // sensor or controller faults
+  IND_PRIO_COUNT
+};
+
+enum Indicator_Pattern_Id {
+  IND_PAT_NONE,         // slot empty
+  IND_PAT_ON,
+  IND_PAT_DIM,          // steady at a quarter duty
+  IND_PAT_BLINK_FAST,   // 5 Hz
+  IND_PAT_BLINK_SLOW,   // 1 Hz
+  IND_PAT_CODE,         // `code` short blinks, then a pause
+  IND_PAT_COUNT
+};
+
+void    Indicator_Attach(uint8_t led, int pin);
+void    Indicator_Begin();
+void    Indicator_Show(uint8_t led, uint8_t priority, uint8_t pattern, uint8_t code = 0);
+// Steady on/off in the IND_PRIO_STATE slot
+void    Indicator_Set(uint8_t led, bool on);
+
+#endif // INDICATOR_H
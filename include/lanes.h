@@ -0,0 +1,52 @@
+/* Two-channel lane model: detections to relay outputs
+ *
+ * Lanes are the sensor channels (00/99 frames: lane 0, 20/98 frames: lane 1), outputs are the relays. With
+ * TWOINONEMODE_PARAM both lanes drive output 0, otherwise each lane has its own. Lane 1 is only listened to with
+ * TWOCHANNLEMODE_PARAM.
+ *
+ * What a detection does to its output is the rule table's (rules.h); each lane has its own relaytiming and relay
+ * timer. An output remembers the lane it is running for, its relay time is booked to that lane in the rollups. In
+ * counter mode both lanes queue passes on their output, lane 0's are pulsed out first.
+ */
+
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdint.h>
+
+#define LANE_COUNT              2
+#define OUTPUT_COUNT            2
+#define RELAY_PULSE_TICKS       10    // counter mode pulse, loop() ticks (100 ms)
+
+// One relay output: timed hold (warning light), follows the detection (barrier) or pulse train (counter)
+struct Relay_Channel {
+  int           count;    // hold ticks left
+  bool          on;       // a timed hold or counter pulse is running
+  bool          out;      // relay pin level
+  uint8_t       queued;   // counter mode passes still to be pulsed out
+  uint8_t       queued1;  // how many of them came from lane 1
+  uint8_t       lane;     // lane the output is running for, its relay time is booked there
+};
+
+extern Relay_Channel  Relay_Channels[OUTPUT_COUNT];
+extern const int      Relay_Pins[OUTPUT_COUNT];   // main.cpp, with the other pins
+
+// Switches an output, reports it and mirrors it for a warm restart
+void    Relay_Output(uint8_t output, bool on);
+// False for lane 1 unless the second channel is on
+bool    Lane_Enabled(uint8_t lane);
+uint8_t Lane_Output(uint8_t lane);
+// The lane's relay timer (s) and relaytiming
+int     Lane_Relay_Timer(uint8_t lane);
+uint8_t Lane_Relay_Timing(uint8_t lane);
+// Relay hold in loop() ticks (100 ms)
+int     Relay_Hold_Ticks(uint8_t lane);
+// An applied detection (1: in, 0: out) on a lane
+void    Lane_Detect(uint8_t lane, uint8_t detect);
+// Runs the relay outputs, called every loop() pass (100 ms tick)
+void    Relay_Tick();
+
+// main.cpp: keeps the relay state for a warm restart
+void    Warm_Mirror();
+
+#endif // LANES_H
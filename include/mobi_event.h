@@ -0,0 +1,101 @@
+/* mobi-ramp controller event protocol
+ *
+ * Machine-readable event lines written by the controller on its USB console (Serial), interleaved with the normal
+ * human-readable log output. Every event is one line:
+ *
+ *   @EV,<seq>,<ms>,<kind>,<value>\n
+ *
+ *   seq   - event sequence number, incremented per event (wraps at 2^32). Lets the host detect dropped lines.
+ *   ms    - controller millis() when the event was raised.
+ *   kind  - single character, see MOBI_EV_* below.
+ *   value - decimal integer, meaning depends on kind.
+ *
+ * The host gateway (tools/gateway) ignores every line that does not start with MOBI_EVENT_PREFIX, so log output
+ * can stay as it is.
+ *
+ * This header is shared between the firmware and the host tools and must stay plain C.
+ */
+
+#ifndef MOBI_EVENT_H
+#define MOBI_EVENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define MOBI_EVENT_PREFIX       "@EV,"
+#define MOBI_EVENT_PREFIX_LEN   4
+#define MOBI_EVENT_FMT          MOBI_EVENT_PREFIX "%lu,%lu,%c,%d\n"
+#define MOBI_EVENT_MAX_LINE     48
+
+#define MOBI_EV_DETECT          'D'   // 1: vehicle detected (00:01), 0: vehicle left (00:00), +2 on lane 1 (20:0x)
+#define MOBI_EV_RELAY           'R'   // 1: relay energized, 0: relay released, +2 for output 1
+#define MOBI_EV_ERROR           'E'   // sensor error code from 99:xx, +100 on lane 1 (98:xx), code 0: cleared
+#define MOBI_EV_LINK            'L'   // 1: sensor connected, 0: sensor disconnected
+#define MOBI_EV_FAILOVER        'F'   // active sensor link changed, 0: UART, 1: BLE
+
+/* D and R values carry the lane/output in the upper bits: lane 0 and output 0 keep the single-channel values. */
+#define MOBI_EV_VALUE(channel, on)  ((on) + 2 * (channel))
+#define MOBI_EV_CHANNEL(value)      ((value) >> 1)
+#define MOBI_EV_ON(value)           ((value) & 1)
+#define MOBI_EV_ERROR_LANE          100
+
+/* E values: lane * 100 + code, so a clear on lane 1 is 100 and tells which lane it was. */
+#define MOBI_EV_ERROR_VALUE(lane, code) ((code) + MOBI_EV_ERROR_LANE * (lane))
+#define MOBI_EV_ERROR_OF(value)         ((value) / MOBI_EV_ERROR_LANE)
+#define MOBI_EV_ERROR_CODE(value)       ((value) % MOBI_EV_ERROR_LANE)
+
+typedef struct {
+  uint32_t seq;
+  uint32_t ms;
+  char     kind;
+  int32_t  value;
+} mobi_event_t;
+
+static inline int mobi_event_kind_valid(char kind)
+{
+  return kind == MOBI_EV_DETECT || kind == MOBI_EV_RELAY || kind == MOBI_EV_ERROR || kind == MOBI_EV_LINK
+      || kind == MOBI_EV_FAILOVER;
+}
+
+/**
+ * Parse one event line (without the trailing newline).
+ * Returns 1 and fills ev on success, 0 if the line is not a well-formed event.
+ */
+static inline int mobi_event_parse(const char* line, size_t length, mobi_event_t* ev)
+{
+  char        buf[MOBI_EVENT_MAX_LINE];
+  char*       p;
+  char*       end;
+  size_t      i;
+
+  if (length < MOBI_EVENT_PREFIX_LEN || length >= sizeof(buf))
+    return 0;
+  for (i = 0; i < MOBI_EVENT_PREFIX_LEN; i++) {
+    if (line[i] != MOBI_EVENT_PREFIX[i])
+      return 0;
+  }
+  for (i = 0; i < length; i++)
+    buf[i] = line[i];
+  buf[length] = '\0';
+
+  p = buf + MOBI_EVENT_PREFIX_LEN;
+  ev->seq = (uint32_t)strtoul(p, &end, 10);
+  if (end == p || *end != ',')
+    return 0;
+  p = end + 1;
+  ev->ms = (uint32_t)strtoul(p, &end, 10);
+  if (end == p || *end != ',')
+    return 0;
+  p = end + 1;
+  ev->kind = *p;
+  if (!mobi_event_kind_valid(ev->kind) || p[1] != ',')
+    return 0;
+  p += 2;
+  ev->value = (int32_t)strtol(p, &end, 10);
+  if (end == p || (*end != '\0' && *end != '\r'))
+    return 0;
+  return 1;
+}
+
+#endif // MOBI_EVENT_H
@@ -0,0 +1,34 @@
+/* Streaming quantile estimate (P-square algorithm, Jain & Chlamtac 1985).
+ *
+ * Tracks one quantile of a stream with five markers, so memory and per-sample cost stay constant no matter how
+ * many samples are added. Used for the adaptive relay hold time (vehicle dwell statistics, see dwell.h).
+ */
+
+#ifndef P2_QUANTILE_H
+#define P2_QUANTILE_H
+
+#include <stdint.h>
+
+class P2Quantile {
+ public:
+  explicit P2Quantile(float p);
+
+  void      reset();
+  void      add(float x);
+  float     value() const;
+  uint32_t  count() const { return count_; }
+  float     quantile() const { return p_; }
+
+ private:
+  float     parabolic(int i, float d) const;
+  float     linear(int i, int d) const;
+
+  float     p_;
+  float     q_[5];    // marker heights
+  float     n_[5];    // actual marker positions
+  float     np_[5];   // desired marker positions
+  float     dn_[5];   // desired position increments
+  uint32_t  count_;
+};
+
+#endif // P2_QUANTILE_H
@@ -0,0 +1,50 @@
+/* Traffic rollups per lane
+ *
+ * Entries, exits, peak entry rate, relay on-time and sensor error time, kept in fixed rings of buckets:
+ *
+ *   m   ROLLUP_MINUTES  one-minute buckets
+ *   h   ROLLUP_HOURS    one-hour buckets
+ *   d   ROLLUP_DAYS     one-day buckets
+ *   t   lifetime totals
+ *
+ * The controller has no wall clock, so the time axis is powered-on time: bucket boundaries follow millis() and
+ * continue from the last checkpoint after a reboot. The rollups are checkpointed to NVS every Rollup_Checkpoint_Min
+ * minutes (setting rollup_ckpt_min), a reboot loses at most that much.
+ *
+ * The rings are kept in NVS in chunks of ROLLUP_CHUNK buckets, one key each, and a checkpoint only writes the chunks
+ * that changed since the last one: with traffic that is the one or two minute chunks of the interval, the current
+ * hour and day chunk and the totals, about 0.5 KB per lane; on a quiet site just the 4-byte minute counter.
+ *
+ * "rollup" on the console prints everything in one go, one line per lane and ring, newest bucket first:
+ *
+ *   @RU,<lane>,<ring>,<entries>/<exits>/<peak per min>/<relay s>/<error s>;...
+ *   @RU,<lane>,t,<entries>/<exits>/<peak per min>/<relay s>/<error s>/<errors>
+ *   @RU,END,<minutes>
+ *
+ * where <minutes> is the powered-on minute the first bucket of every ring belongs to.
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+
+#define ROLLUP_LANES            2
+#define ROLLUP_MINUTES          60
+#define ROLLUP_HOURS            24
+#define ROLLUP_DAYS             7
+#define ROLLUP_CHECKPOINT_MIN   10
+#define ROLLUP_CHUNK            8       // buckets per NVS key
+
+extern int      Rollup_Checkpoint_Min;
+
+void    Rollup_Begin();
+// Accounts relay and error time and rotates the rings, call from every loop()
+void    Rollup_Poll();
+void    Rollup_Detect(uint8_t lane, uint8_t detect);
+void    Rollup_Relay(uint8_t lane, bool on);
+void    Rollup_Error(uint8_t lane, bool active);
+void    Rollup_Print();
+void    Rollup_Checkpoint();
+
+#endif // ROLLUP_H
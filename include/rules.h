@@ -0,0 +1,56 @@
+/* Operation mode rules: what a detection does to its relay output
+ *
+ * Each rule maps a detection edge in one operation mode to a relay action:
+ *
+ *   <mode> <edge> <action>
+ *
+ *   edge     in, out        00:01 / 00:00
+ *            trigger        the edge the lane's relaytiming selects (in for 0, out for 1)
+ *            release        the other one
+ *   action   none           nothing
+ *            hold           relay on for the relay timer (warning light)
+ *            on, off        relay follows (barrier)
+ *            pulse          one more pass to pulse out (counter)
+ *
+ * Later rules win over earlier ones. The built-in table is the modes as shipped; with RULES_RUNTIME the table can be
+ * changed from the console ("rule list|add|del|reset|save") and a saved table replaces the built-in one at boot.
+ *
+ * The rules are compiled into a flat table for the current operation mode and each lane's relaytiming whenever one
+ * of them changes, so a detection costs one lookup.
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define RULES_MAX             16
+#define RULE_MODES            4
+#define RULE_LANES            2
+
+#define RULE_EDGE_IN          0
+#define RULE_EDGE_OUT         1
+#define RULE_EDGE_TRIGGER     2
+#define RULE_EDGE_RELEASE     3
+
+#define RULE_NONE             0
+#define RULE_HOLD             1
+#define RULE_ON               2
+#define RULE_OFF              3
+#define RULE_PULSE            4
+
+extern uint8_t  Rule_Flat[RULE_LANES][2];
+
+// Loads a saved table and compiles it, call after the parameters are read
+void    Rules_Begin();
+// Compiles the table for the current operation mode and relaytiming
+void    Rules_Compile();
+void    Rules_Command(char* args);
+
+// RULE_* action for a detection (1: in, 0: out) on a lane
+static inline uint8_t Rule_Action(uint8_t lane, uint8_t detect) {
+  return Rule_Flat[lane][detect ? 1 : 0];
+}
+
+#endif // RULES_H
@@ -0,0 +1,26 @@
+/* Operating parameters at runtime
+ *
+ * The parameters normally come from the DIP switches and the relay timer pot at boot. They can be read and changed
+ * from the console while the controller runs; a change is validated first and then applied as a whole, and only
+ * the values the sensor uses and that actually changed are pushed to it. "save" keeps the current values in NVS,
+ * they then win over the switches at the next boot until "clear".
+ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+
+#define SETTINGS_MAX_SET      6     // name/value pairs in one set command
+
+// Overrides the switch values with the ones saved in NVS, call after reading the switches
+void    Settings_Load();
+bool    Settings_Save();
+bool    Settings_Clear();
+
+// Console commands
+void    Settings_Get(char* args);
+void    Settings_Set(char* args);
+void    Settings_List(char* args);
+
+#endif // SETTINGS_H
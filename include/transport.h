@@ -0,0 +1,222 @@
+/* Sensor transports
+ *
+ * The transport is picked at compile time as a policy type, SensorTransport, so the control code calls it
+ * directly and a single-link build carries nothing for the link it does not use. Every policy provides:
+ *
+ *   begin()                  set the link up, called once from setup()
+ *   resume()                 after begin() on a warm restart: the sensor may still be connected and waits to be
+ *                            found instead of announcing itself
+ *   poll()                   run the link (handshake, parameter push, receive), called from every loop()
+ *   connected()              handshake with the sensor done
+ *   ready()                  connected and parameters pushed, frames are being delivered
+ *   alive()                  ready and the sensor answered recently
+ *   lastRxMs()               millis() of the last byte from the sensor
+ *   write(data, length)      send a frame to the sensor
+ *   writeRoom()              bytes write() takes right now without blocking loop()
+ *   maxWrite()               longest frame one write() carries (BLE: MTU - 3)
+ *   accepts(link)            whether frames delivered by that link are acted on
+ *
+ * FailoverTransport runs two links at once: frames are only acted on from the active one. The sensor sends every
+ * event on each link it has up, so when the primary stops answering the standby, already connected and
+ * configured, takes over without a reconnect. Once the primary has been alive again for FAILOVER_RETURN_MS it
+ * becomes active again.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <string>
+#include "controller.h"
+
+#define FAILOVER_RETURN_MS    3000
+
+struct UartTransport {
+  enum { link = LINK_UART };
+
+  static void           begin();
+  static void           resume();
+  static void           poll();
+  static bool           connected();
+  static bool           ready();
+  static bool           alive();
+  static unsigned long  lastRxMs();
+  static size_t         write(const char* data, size_t length);
+  static size_t         writeRoom();
+  static size_t         maxWrite();
+  static bool           accepts(uint8_t) { return true; }
+  static const char*    name() { return "UART"; }
+};
+
+// BLE backend footprint and connect times, for the "ble" console command
+struct Ble_Stats {
+  uint32_t        heap_init;        // heap taken by the stack init
+  uint32_t        heap_connected;   // heap taken by the first connection on top of that
+  uint32_t        connects;
+  uint32_t        cached_connects;  // reconnects that reused the discovered handles
+  uint32_t        connect_ms_last;  // connect request to notifications on
+  uint32_t        connect_ms_max;
+  uint32_t        notifications;
+  uint32_t        frames;           // frames those carried, more than one per notification once batched
+  uint32_t        rx_dropped;       // notifications lost to a full receive ring
+};
+
+// Connection parameters asked for after connecting: a short interval so a notification is not held for the next
+// connection event long, no peripheral latency. Units of 1.25 ms for the interval, 10 ms for the timeout.
+#define BLE_CONN_INTERVAL_MIN   6     // 7.5 ms
+#define BLE_CONN_INTERVAL_MAX   12    // 15 ms
+#define BLE_CONN_LATENCY        0
+#define BLE_CONN_TIMEOUT        200   // 2 s
+
+// A sensor that batches notifications (23:, BATCHWINDOW) says so in its advertising: manufacturer data with
+// BLE_SENSOR_COMPANY_ID, little endian, then a byte of BLE_CAP_* bits. Sensor firmware from before batching has
+// none and never gets 23.
+#define BLE_SENSOR_COMPANY_ID   0xFFFF
+#define BLE_CAP_BATCH           0x01
+
+static inline uint8_t Ble_Sensor_Caps(const std::string& data) {
+  if (data.size() < 3 || (uint8_t)data[0] != (BLE_SENSOR_COMPANY_ID & 0xFF) ||
+      (uint8_t)data[1] != (BLE_SENSOR_COMPANY_ID >> 8))
+    return 0;
+  return (uint8_t)data[2];
+}
+
+// Notifications arrive in the BLE host task; the callback only copies them into this ring and poll() hands them
+// on from loop(), so the control state is only ever touched by one task.
+#define BLE_RX_RING_SIZE        4096
+
+// Writes without response are queued in the stack's few TX buffers and leave at most a couple per connection
+// event. writeRoom() hands out one credit per write, a credit comes back every BLE_TX_CREDIT_MS, so the
+// firmware transfer cannot flood the stack. That is at most 100 writes a second, and only while someone spends
+// the credits as they come back: Fw_Delay() does during a transfer, a single burst per loop() would get 40.
+#define BLE_TX_CREDITS          4
+#define BLE_TX_CREDIT_MS        10
+
+struct BleTransport {
+  enum { link = LINK_BLE };
+
+  static void           begin();
+  static void           resume() {}   // the sensor drops the connection and advertises again
+  static void           poll();
+  static bool           connected();
+  static bool           ready();
+  static bool           alive();
+  static unsigned long  lastRxMs();
+  static size_t         write(const char* data, size_t length);
+  static size_t         writeRoom();
+  static size_t         maxWrite();
+  static bool           accepts(uint8_t) { return true; }
+  static const char*    name() { return "BLE"; }
+  static const char*    backend();
+  static const Ble_Stats& stats();
+};
+
+template <class Primary, class Standby>
+struct FailoverTransport {
+  static void begin() {
+    Primary::begin();
+    Standby::begin();
+  }
+
+  static void resume() {
+    Primary::resume();
+    Standby::resume();
+  }
+
+  static void poll() {
+    Primary::poll();
+    Standby::poll();
+
+    unsigned long now = millis();
+
+    if (active == Primary::link) {
+      if (Primary::alive()) {
+        primary_seen = true;
+      } else if (Standby::ready()) {
+        // Time from the last byte on the primary to the switch, detection included.
+        unsigned long took = primary_seen ? now - Primary::lastRxMs() : 0;
+        switchTo(Standby::link, Standby::name(), took);
+        primary_seen = false;
+      }
+    } else {
+      if (!Primary::alive()) {
+        primary_up_since = 0;
+      } else if (primary_up_since == 0) {
+        primary_up_since = now;
+      } else if (now - primary_up_since >= FAILOVER_RETURN_MS || !Standby::alive()) {
+        switchTo(Primary::link, Primary::name(), 0);
+        primary_up_since = 0;
+        primary_seen = true;
+      }
+    }
+  }
+
+  static bool connected() {
+    return active == Primary::link ? Primary::connected() : Standby::connected();
+  }
+  static bool ready() {
+    return active == Primary::link ? Primary::ready() : Standby::ready();
+  }
+  static bool alive() {
+    return active == Primary::link ? Primary::alive() : Standby::alive();
+  }
+  static unsigned long lastRxMs() {
+    return active == Primary::link ? Primary::lastRxMs() : Standby::lastRxMs();
+  }
+  static size_t write(const char* data, size_t length) {
+    return active == Primary::link ? Primary::write(data, length) : Standby::write(data, length);
+  }
+  static size_t writeRoom() {
+    return active == Primary::link ? Primary::writeRoom() : Standby::writeRoom();
+  }
+  static size_t maxWrite() {
+    return active == Primary::link ? Primary::maxWrite() : Standby::maxWrite();
+  }
+  static bool accepts(uint8_t link) {
+    return link == active;
+  }
+  static const char* name() {
+    return active == Primary::link ? Primary::name() : Standby::name();
+  }
+
+  static uint8_t        active;
+  static bool           primary_seen;
+  static unsigned long  primary_up_since;
+  static uint32_t       failovers;
+  static unsigned long  failover_ms_last;
+  static unsigned long  failover_ms_max;
+
+ private:
+  static void switchTo(uint8_t link, const char* to, unsigned long took) {
+    active = link;
+    if (link != Primary::link) {
+      failovers++;
+      failover_ms_last = took;
+      if (took > failover_ms_max)
+        failover_ms_max = took;
+      Serial.printf("Sensor link failover to %s in %lu ms (max %lu ms, %lu failovers)\n", to, took,
+                    failover_ms_max, (unsigned long)failovers);
+    } else {
+      Serial.printf("Sensor link back on %s\n", to);
+    }
+    Report_Event(MOBI_EV_FAILOVER, link);
+  }
+};
+
+template <class P, class S> uint8_t       FailoverTransport<P, S>::active           = P::link;
+template <class P, class S> bool          FailoverTransport<P, S>::primary_seen     = false;
+template <class P, class S> unsigned long FailoverTransport<P, S>::primary_up_since = 0;
+template <class P, class S> uint32_t      FailoverTransport<P, S>::failovers        = 0;
+template <class P, class S> unsigned long FailoverTransport<P, S>::failover_ms_last = 0;
+template <class P, class S> unsigned long FailoverTransport<P, S>::failover_ms_max  = 0;
+
+#if UART_COMM && BLE_COMM
+typedef FailoverTransport<UartTransport, BleTransport> SensorTransport;
+#elif UART_COMM
+typedef UartTransport SensorTransport;
+#elif BLE_COMM
+typedef BleTransport SensorTransport;
+#else
+#error "Enable BLE_COMM and/or UART_COMM in config.h"
+#endif
+
+#endif // TRANSPORT_H
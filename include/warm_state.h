@@ -0,0 +1,42 @@
+/* Control state kept over a warm restart
+ *
+ * The relay state, the remaining hold and the queued passes are mirrored into RTC slow memory, which keeps its
+ * contents over watchdog, panic, software and brownout resets but not over a power-on. After such a reset the
+ * firmware takes them back first thing in setup(), so a pass in progress does not lose its relay.
+ *
+ * A crash that keeps coming back after the restore would otherwise loop forever: after WARM_MAX_RESTARTS warm
+ * restarts without WARM_STABLE_MS of uptime in between the state is dropped and the controller starts cold.
+ */
+
+#ifndef WARM_STATE_H
+#define WARM_STATE_H
+
+#include <stdint.h>
+
+#define WARM_MAX_RESTARTS     3
+#define WARM_STABLE_MS        60000UL
+
+#define WARM_OUTPUTS          2
+
+// Per relay output
+struct Warm_State {
+  int32_t         relay_count[WARM_OUTPUTS];    // remaining hold in loop() ticks
+  uint8_t         relay_on[WARM_OUTPUTS];       // a timed hold or counter pulse is running
+  uint8_t         relay_out[WARM_OUTPUTS];      // relay pin level, barrier mode keeps it up without relay_on
+  uint8_t         vehicle_count[WARM_OUTPUTS];  // counter mode passes still to be pulsed out
+  uint8_t         operation_mode;   // the state only applies to the mode it was saved in
+  uint8_t         detect_synced;
+  uint16_t        detect_next;
+};
+
+// Returns true and fills state if the reset kept a valid copy. Call before anything else in setup().
+bool    Warm_Restore(Warm_State& state);
+// Call whenever the state changed, it is cheap enough for every loop() pass
+void    Warm_Save(const Warm_State& state);
+// Counts the boot as stable once WARM_STABLE_MS have passed, call from loop()
+void    Warm_Poll();
+const char* Warm_Reset_Reason();
+// The reset was a power-on, everything else on the board restarted as well
+bool    Warm_Power_On();
+
+#endif // WARM_STATE_H
@@ -0,0 +1,135 @@
+/* Line console on the USB serial port, see console.h
+ */
+
+#include <Arduino.h>
+#include "console.h"
+#include "detect_filter.h"
+#include "detect_seq.h"
+#include "fw_update.h"
+#include "rollup.h"
+#include "rules.h"
+#include "settings.h"
+#include "transport.h"
+
+struct Console_Command {
+  const char*     name;
+  void            (*run)(char* args);
+  const char*     help;
+};
+
+static void Cmd_Help(char* args);
+
+static void Cmd_Rollup(char* args) {
+  Rollup_Print();
+}
+
+static void Cmd_Filter(char* args) {
+  Detect_Filter_Print();
+}
+
+static void Cmd_Seq(char* args) {
+  Detect_Seq_Print();
+}
+
+#if BLE_COMM
+// @BLE,<backend>,<init heap>,<connection heap>,<connects>,<cached connects>,<last connect ms>,<max connect ms>,
+//      <notifications>,<frames>,<dropped notifications>
+static void Cmd_Ble(char* args) {
+  const Ble_Stats& s = BleTransport::stats();
+  Serial.printf("@BLE,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", BleTransport::backend(), (unsigned long)s.heap_init,
+                (unsigned long)s.heap_connected, (unsigned long)s.connects, (unsigned long)s.cached_connects,
+                (unsigned long)s.connect_ms_last, (unsigned long)s.connect_ms_max, (unsigned long)s.notifications,
+                (unsigned long)s.frames, (unsigned long)s.rx_dropped);
+}
+#endif
+
+static void Cmd_Save(char* args) {
+  Serial.println(Settings_Save() ? "@OK" : "@ERR,NVS write failed");
+}
+
+static void Cmd_Clear(char* args) {
+  Serial.println(Settings_Clear() ? "@OK" : "@ERR,NVS write failed");
+}
+
+static const Console_Command Commands[] = {
+  {"help",    Cmd_Help,      "list commands"},
+  {"get",     Settings_Get,  "get <name>: one parameter"},
+  {"set",     Settings_Set,  "set <name> <value> ...: change parameters, applied together"},
+  {"list",    Settings_List, "all parameters with their ranges"},
+  {"save",    Cmd_Save,      "keep the current parameters over a reboot"},
+  {"clear",   Cmd_Clear,     "forget saved parameters, the switches apply again at the next boot"},
+  {"rollup",  Cmd_Rollup,    "traffic rollups of all lanes, see rollup.h"},
+  {"filter",  Cmd_Filter,    "detection filter counters per lane, see detect_filter.h"},
+  {"seq",     Cmd_Seq,       "detection sequencing counters, see detect_seq.h"},
+  {"rule",    Rules_Command, "rule list|add|del|reset|save: what detections do in each operation mode, see rules.h"},
+  {"fw",      Fw_Command,    "fw stage|send|abort|status: sensor firmware update, see fw_update.h"},
+#if BLE_COMM
+  {"ble",     Cmd_Ble,       "BLE backend heap use, connect times and notification batching"},
+#endif
+};
+
+#define COMMAND_COUNT   (sizeof(Commands) / sizeof(Commands[0]))
+
+static char     Console_Line[CONSOLE_LINE_SIZE];
+static size_t   Console_Length    = 0;
+static bool     Console_Overflow  = false;
+static size_t   Console_Raw_Left  = 0;
+static void     (*Console_Raw_Sink)(const uint8_t* data, size_t length) = nullptr;
+
+static void Cmd_Help(char* args) {
+  for (size_t i = 0; i < COMMAND_COUNT; i++)
+    Serial.printf("%-10s %s\n", Commands[i].name, Commands[i].help);
+}
+
+static void Console_Run(char* line) {
+  char* args = line;
+  while (*args != '\0' && *args != ' ')
+    args++;
+  if (*args != '\0')
+    *args++ = '\0';
+  while (*args == ' ')
+    args++;
+
+  for (size_t i = 0; i < COMMAND_COUNT; i++) {
+    if (strcmp(line, Commands[i].name) == 0) {
+      Commands[i].run(args);
+      return;
+    }
+  }
+  Serial.printf("@ERR,unknown command %s\n", line);
+}
+
+void Console_Take(size_t length, void (*sink)(const uint8_t* data, size_t length)) {
+  Console_Raw_Left = sink != nullptr ? length : 0;
+  Console_Raw_Sink = sink;
+}
+
+void Console_Poll() {
+  while (Console_Raw_Left > 0 && Serial.available() > 0) {
+    uint8_t buf[CONSOLE_RAW_CHUNK];
+    size_t n = Serial.readBytes(buf, min(sizeof(buf), min(Console_Raw_Left, (size_t)Serial.available())));
+    if (n == 0)
+      break;
+    Console_Raw_Left -= n;
+    Console_Raw_Sink(buf, n);
+  }
+
+  while (Console_Raw_Left == 0 && Serial.available() > 0) {
+    char c = (char)Serial.read();
+
+    if (c == '\r' || c == '\n') {
+      if (Console_Overflow)
+        Serial.println("@ERR,line too long");
+      else if (Console_Length > 0) {
+        Console_Line[Console_Length] = '\0';
+        Console_Run(Console_Line);
+      }
+      Console_Length = 0;
+      Console_Overflow = false;
+    } else if (Console_Length < CONSOLE_LINE_SIZE - 1) {
+      Console_Line[Console_Length++] = c;
+    } else {
+      Console_Overflow = true;
+    }
+  }
+}
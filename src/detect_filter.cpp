@@ -0,0 +1,129 @@
+/* Detection conditioning per lane, see detect_filter.h
+ */
+
+#include <Arduino.h>
+#include "controller.h"
+#include "detect_filter.h"
+
+struct Filter_Lane {
+  uint8_t         state;          // last applied detection
+  bool            known;          // state was applied since the last reset, until then nothing is a duplicate
+  bool            pending;        // a transition to pending_value is waiting out its minimum time
+  uint8_t         pending_value;
+  unsigned long   pending_since;  // millis() of the frame that started it
+  unsigned long   pending_ms;     // its detection time, handed on when it is applied
+  bool            have_on;
+  unsigned long   last_on;        // millis() of the last applied 00:01
+  // Counters
+  uint32_t        applied;
+  uint32_t        duplicate;
+  uint32_t        chatter;
+  uint32_t        refractory;
+};
+
+int                   Filter_Min_On_Ms      = FILTER_MIN_ON_MS;
+int                   Filter_Min_Off_Ms     = FILTER_MIN_OFF_MS;
+int                   Filter_Refractory_Ms  = FILTER_REFRACTORY_MS;
+
+static Filter_Lane    Lanes[FILTER_LANES];
+static uint32_t       Reported_Drops[FILTER_LANES];
+static unsigned long  Last_Report_Ms        = 0;
+
+static uint32_t Filter_Drops(const Filter_Lane& l) {
+  return l.duplicate + l.chatter + l.refractory;
+}
+
+static void Filter_Apply(uint8_t lane, unsigned long now) {
+  Filter_Lane& l = Lanes[lane];
+
+  l.pending = false;
+  l.state = l.pending_value;
+  l.known = true;
+  l.applied++;
+  if (l.state == 1) {
+    l.have_on = true;
+    l.last_on = now;
+  }
+  Detect_Apply(lane, l.state, l.pending_ms);
+}
+
+static bool Filter_Held(const Filter_Lane& l, unsigned long now) {
+  int min_ms = l.pending_value == 1 ? Filter_Min_On_Ms : Filter_Min_Off_Ms;
+  return now - l.pending_since >= (unsigned long)min_ms;
+}
+
+void Detect_Filter_Input(uint8_t lane, uint8_t detect, unsigned long ms) {
+  if (lane >= FILTER_LANES)
+    return;
+  Filter_Lane& l = Lanes[lane];
+  unsigned long now = millis();
+
+  detect = detect ? 1 : 0;
+  if (l.pending) {
+    if (detect == l.pending_value) {
+      l.duplicate++;
+    } else {
+      // Taken back before it held: neither frame is applied.
+      l.pending = false;
+      l.chatter += 2;
+    }
+    return;
+  }
+
+  if (detect == l.state && l.known) {
+    l.duplicate++;
+    return;
+  }
+  if (detect == 1 && l.have_on && now - l.last_on < (unsigned long)Filter_Refractory_Ms) {
+    // The matching 00:00 then repeats the current state and goes as a duplicate.
+    l.refractory++;
+    return;
+  }
+
+  l.pending = true;
+  l.pending_value = detect;
+  l.pending_since = now;
+  l.pending_ms = ms;
+  if (Filter_Held(l, now))
+    Filter_Apply(lane, now);
+}
+
+void Detect_Filter_Poll() {
+  unsigned long now = millis();
+
+  for (uint8_t lane = 0; lane < FILTER_LANES; lane++) {
+    if (Lanes[lane].pending && Filter_Held(Lanes[lane], now))
+      Filter_Apply(lane, now);
+  }
+
+  if (now - Last_Report_Ms < FILTER_REPORT_MS)
+    return;
+  Last_Report_Ms = now;
+  for (uint8_t lane = 0; lane < FILTER_LANES; lane++) {
+    const Filter_Lane& l = Lanes[lane];
+    uint32_t drops = Filter_Drops(l);
+    if (drops == Reported_Drops[lane])
+      continue;
+    Serial.printf("Detect filter: lane %u dropped %lu (duplicate %lu, chatter %lu, refractory %lu)\n", lane,
+                  (unsigned long)(drops - Reported_Drops[lane]), (unsigned long)l.duplicate,
+                  (unsigned long)l.chatter, (unsigned long)l.refractory);
+    Reported_Drops[lane] = drops;
+  }
+}
+
+void Detect_Filter_Reset() {
+  for (uint8_t lane = 0; lane < FILTER_LANES; lane++) {
+    Lanes[lane].state = 0;
+    Lanes[lane].known = false;
+    Lanes[lane].pending = false;
+    Lanes[lane].have_on = false;
+  }
+}
+
+void Detect_Filter_Print() {
+  for (uint8_t lane = 0; lane < FILTER_LANES; lane++) {
+    const Filter_Lane& l = Lanes[lane];
+    Serial.printf("@FLT,%u,%lu,%lu,%lu,%lu\n", lane, (unsigned long)l.applied, (unsigned long)l.duplicate,
+                  (unsigned long)l.chatter, (unsigned long)l.refractory);
+  }
+}
@@ -0,0 +1,81 @@
+/* Detection sequencing, see detect_seq.h
+ */
+
+#include <Arduino.h>
+#include "detect_seq.h"
+
+static bool           Seq_Synced            = false;  // false until the first sequenced frame after a controller boot
+static uint16_t       Seq_Next              = 1;
+static bool           Seq_Gap               = false;
+static uint32_t       Seq_Applied           = 0;
+static uint32_t       Seq_Gaps              = 0;      // holes in the sequence, each one counted once
+static uint32_t       Seq_Dups              = 0;      // retransmissions of frames already applied
+static uint32_t       Reported_Gaps         = 0;
+static uint32_t       Reported_Dups         = 0;
+static unsigned long  Last_Report_Ms        = 0;
+
+bool Detect_Sequence(uint16_t seq, int32_t& ack) {
+  if (!Seq_Synced) {
+    Seq_Synced = true;
+    Seq_Next = seq;
+  }
+
+  int16_t ahead = (int16_t)(seq - Seq_Next);
+  if (ahead == 0) {
+    Seq_Next++;
+    Seq_Gap = false;
+    Seq_Applied++;
+    ack = seq;
+    return true;
+  }
+
+  if (ahead < 0) {
+    Seq_Dups++;
+  } else if (!Seq_Gap) {
+    Seq_Gap = true;
+    Seq_Gaps++;
+  }
+  // Tell the sensor where we are so it goes back to the first missing one.
+  ack = (uint16_t)(Seq_Next - 1);
+  return false;
+}
+
+void Detect_Seq_Reset() {
+  Seq_Synced = true;
+  Seq_Next = 1;
+  Seq_Gap = false;
+}
+
+bool Detect_Seq_Synced() {
+  return Seq_Synced;
+}
+
+uint16_t Detect_Seq_Next() {
+  return Seq_Next;
+}
+
+void Detect_Seq_Restore(bool synced, uint16_t next) {
+  Seq_Synced = synced;
+  Seq_Next = next;
+  Seq_Gap = false;
+}
+
+void Detect_Seq_Poll() {
+  unsigned long now = millis();
+
+  if (now - Last_Report_Ms < DETECT_SEQ_REPORT_MS)
+    return;
+  Last_Report_Ms = now;
+  if (Seq_Gaps == Reported_Gaps && Seq_Dups == Reported_Dups)
+    return;
+  Serial.printf("Detect sequence: %lu gaps, %lu duplicates (next %u, %lu gaps, %lu duplicates in all)\n",
+                (unsigned long)(Seq_Gaps - Reported_Gaps), (unsigned long)(Seq_Dups - Reported_Dups), Seq_Next,
+                (unsigned long)Seq_Gaps, (unsigned long)Seq_Dups);
+  Reported_Gaps = Seq_Gaps;
+  Reported_Dups = Seq_Dups;
+}
+
+void Detect_Seq_Print() {
+  Serial.printf("@SEQ,%u,%u,%lu,%lu,%lu\n", Seq_Synced ? 1 : 0, Seq_Next, (unsigned long)Seq_Applied,
+                (unsigned long)Seq_Gaps, (unsigned long)Seq_Dups);
+}
@@ -0,0 +1,35 @@
+/* Vehicle dwell per lane and the adaptive relay hold, see dwell.h
+ */
+
+#include <Arduino.h>
+#include "config.h"
+#include "dwell.h"
+#include "p2_quantile.h"
+
+static P2Quantile     Dwell_Estimate[DWELL_LANES] = {P2Quantile(ADAPTIVE_PERCENTILE), P2Quantile(ADAPTIVE_PERCENTILE)};
+static bool           Vehicle_Present[DWELL_LANES];
+static uint32_t       Vehicle_Enter_Ms[DWELL_LANES];
+
+void Dwell_Track(uint8_t lane, uint8_t detect, unsigned long ms) {
+  if (lane >= DWELL_LANES)
+    return;
+  if (detect == 1) {
+    Vehicle_Present[lane] = true;
+    Vehicle_Enter_Ms[lane] = (uint32_t)ms;
+  } else if (Vehicle_Present[lane]) {
+    uint32_t dwell = (uint32_t)ms - Vehicle_Enter_Ms[lane];
+    Vehicle_Present[lane] = false;
+    if (dwell >= DWELL_MIN_MS && dwell <= DWELL_MAX_MS)
+      Dwell_Estimate[lane].add((float)dwell);
+  }
+}
+
+int Dwell_Hold_Ticks(uint8_t lane, int pot_ticks, uint8_t timing) {
+  if (lane >= DWELL_LANES || pot_ticks <= 0 || timing != 0)
+    return pot_ticks;
+  if (Dwell_Estimate[lane].count() < ADAPTIVE_MIN_SAMPLES)
+    return pot_ticks;
+  int adaptive = ((int)Dwell_Estimate[lane].value() + ADAPTIVE_MARGIN_MS + 99) / 100;
+  adaptive = max(adaptive, ADAPTIVE_MIN_HOLD_MS / 100);
+  return min(pot_ticks, adaptive);
+}
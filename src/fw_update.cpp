@@ -0,0 +1,476 @@
+/* Sensor firmware update over the sensor link, see fw_update.h
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <rom/crc.h>
+#include "console.h"
+#include "fw_update.h"
+#include "transport.h"
+
+#define FW_OFFER_FRAME        "12"
+#define FW_BLOCK_FRAME        "13"
+#define FW_SECTOR_SIZE        4096
+#define FW_LINE_LENGTH(block) (20 + 4 * (((block) + 2) / 3))  // 13:<block>,<crc>,<base64>\n and the '\0'
+
+#define FW_IDLE               0
+#define FW_OFFER              1
+#define FW_SEND               2
+#define FW_VERIFY             3
+#define FW_PAUSED             4
+#define FW_DONE               5
+#define FW_FAILED             6
+
+static const char* const Fw_State_Names[] = {"idle", "offer", "send", "verify", "paused", "done", "failed"};
+
+static const char Base64_Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Staged image
+static const esp_partition_t* Stage_Part    = nullptr;
+static uint32_t       Image_Size            = 0;
+static uint32_t       Image_Crc             = 0;
+static bool           Image_Valid           = false;
+
+// Staging from the console
+static bool           Stage_Active          = false;
+static uint32_t       Stage_Offset          = 0;
+static uint32_t       Stage_Erased          = 0;
+static bool           Stage_Failed          = false;
+static unsigned long  Stage_Last_Ms         = 0;
+
+// Transfer
+static uint8_t        Fw_State              = FW_IDLE;
+static uint16_t       Fw_Blocks             = 0;
+static uint16_t       Fw_Block_Size         = FW_BLOCK_SIZE;
+static uint16_t       Fw_Acked              = 0;    // blocks the sensor has
+static uint16_t       Fw_Next               = 0;    // next block to send
+static uint16_t       Fw_Start_Block        = 0;    // where this run started, for the throughput
+static uint8_t        Fw_Offers             = 0;
+static bool           Fw_Rewound            = false;
+static uint32_t       Fw_Acks_Seen          = 0;
+static uint32_t       Fw_Retransmits        = 0;
+static uint32_t       Fw_Link_Bytes         = 0;
+static unsigned long  Fw_Offer_Ms           = 0;
+static unsigned long  Fw_Progress_Ms        = 0;
+static unsigned long  Fw_Start_Ms           = 0;
+static unsigned long  Fw_End_Ms             = 0;
+static unsigned long  Fw_Report_Ms          = 0;
+
+// Written by Fw_Ack()/Fw_Result() as frames are received
+static volatile uint16_t  Fw_Rx_Next        = 0;
+static volatile uint32_t  Fw_Rx_Acks        = 0;
+static volatile uint8_t   Fw_Rx_Dup_Run     = 0;
+static volatile int16_t   Fw_Rx_Result      = -1;
+
+static size_t Base64_Encode(const uint8_t* data, size_t length, char* out) {
+  size_t o = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t v = (uint32_t)data[i] << 16;
+    if (i + 1 < length)
+      v |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length)
+      v |= data[i + 2];
+    out[o++] = Base64_Chars[(v >> 18) & 0x3F];
+    out[o++] = Base64_Chars[(v >> 12) & 0x3F];
+    out[o++] = i + 1 < length ? Base64_Chars[(v >> 6) & 0x3F] : '=';
+    out[o++] = i + 2 < length ? Base64_Chars[v & 0x3F] : '=';
+  }
+  return o;
+}
+
+static bool Fw_Partition() {
+  if (Stage_Part == nullptr)
+    Stage_Part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FW_STAGE_LABEL);
+  return Stage_Part != nullptr;
+}
+
+static void Fw_Image_Load() {
+  Preferences prefs;
+
+  if (!prefs.begin("fw", true))
+    return;
+  Image_Size = prefs.getUInt("size", 0);
+  Image_Crc = prefs.getUInt("crc", 0);
+  prefs.end();
+  Image_Valid = Image_Size > 0 && Fw_Partition() && Image_Size <= Stage_Part->size;
+}
+
+static void Fw_Image_Save(bool valid) {
+  Preferences prefs;
+
+  Image_Valid = valid;
+  prefs.begin("fw", false);
+  prefs.putUInt("size", valid ? Image_Size : 0);
+  prefs.putUInt("crc", Image_Crc);
+  prefs.end();
+}
+
+static uint32_t Fw_Image_Crc() {
+  uint8_t   buf[FW_BLOCK_SIZE];
+  uint32_t  crc = 0;
+
+  for (uint32_t offset = 0; offset < Image_Size; offset += sizeof(buf)) {
+    uint32_t n = min((uint32_t)sizeof(buf), Image_Size - offset);
+    if (esp_partition_read(Stage_Part, offset, buf, n) != ESP_OK)
+      return ~Image_Crc;
+    crc = crc32_le(crc, buf, n);
+  }
+  return crc;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Staging from the console
+/////////////////////////////////////////////////////////////////////////
+
+static void Fw_Stage_Data(const uint8_t* data, size_t length) {
+  Stage_Last_Ms = millis();
+  if (!Stage_Failed) {
+    // Sectors are erased as the image reaches them, erasing all at once would stall loop() for seconds.
+    while (Stage_Erased < Stage_Offset + length) {
+      if (esp_partition_erase_range(Stage_Part, Stage_Erased, FW_SECTOR_SIZE) != ESP_OK)
+        Stage_Failed = true;
+      Stage_Erased += FW_SECTOR_SIZE;
+    }
+    if (esp_partition_write(Stage_Part, Stage_Offset, data, length) != ESP_OK)
+      Stage_Failed = true;
+  }
+  Stage_Offset += length;
+  if (Stage_Offset < Image_Size)
+    return;
+
+  Stage_Active = false;
+  if (Stage_Failed) {
+    Serial.println("@ERR,flash write failed");
+    return;
+  }
+  uint32_t crc = Fw_Image_Crc();
+  if (crc != Image_Crc) {
+    Serial.printf("@ERR,crc %08lx, expected %08lx\n", (unsigned long)crc, (unsigned long)Image_Crc);
+    return;
+  }
+  Fw_Image_Save(true);
+  Serial.printf("@OK,staged %lu bytes\n", (unsigned long)Image_Size);
+}
+
+static void Fw_Stage(char* args) {
+  char*         end;
+  unsigned long size = strtoul(args, &end, 10);
+  char*         crc_at = end;
+  unsigned long crc = strtoul(crc_at, &end, 16);
+
+  if (Fw_State == FW_OFFER || Fw_State == FW_SEND || Fw_State == FW_VERIFY || Fw_State == FW_PAUSED) {
+    Serial.println("@ERR,transfer running, fw abort first");
+    return;
+  }
+  // No CRC field would read as CRC 0
+  if (size == 0 || end == crc_at || *end != '\0') {
+    Serial.println("@ERR,usage: fw stage <size> <crc32 hex>");
+    return;
+  }
+  if (!Fw_Partition()) {
+    Serial.println("@ERR,no " FW_STAGE_LABEL " partition");
+    return;
+  }
+  if (size > Stage_Part->size) {
+    Serial.printf("@ERR,image larger than %lu bytes\n", (unsigned long)Stage_Part->size);
+    return;
+  }
+
+  Fw_Image_Save(false);
+  Image_Size = size;
+  Image_Crc = crc;
+  Stage_Active = true;
+  Stage_Offset = 0;
+  Stage_Erased = 0;
+  Stage_Failed = false;
+  Stage_Last_Ms = millis();
+  Fw_State = FW_IDLE;
+  Console_Take(size, Fw_Stage_Data);
+  Serial.printf("@OK,send %lu bytes\n", size);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Transfer
+/////////////////////////////////////////////////////////////////////////
+
+static void Fw_Finish(uint8_t state, const char* why) {
+  Fw_State = state;
+  Fw_End_Ms = millis();
+  Serial.printf("Sensor firmware update %s: %s\n", Fw_State_Names[state], why);
+}
+
+static void Fw_Offer() {
+  char line[48];
+
+  // Blocks are cut to what one write of the active link carries, BLE writes are bounded by the MTU.
+  Fw_Block_Size = FW_BLOCK_SIZE;
+  while (Fw_Block_Size > 16 && (size_t)FW_LINE_LENGTH(Fw_Block_Size) > SensorTransport::maxWrite())
+    Fw_Block_Size /= 2;
+  if ((size_t)FW_LINE_LENGTH(Fw_Block_Size) > SensorTransport::maxWrite()) {
+    // Lines would be cut off by the link
+    Fw_Finish(FW_FAILED, "link writes too short for a block");
+    return;
+  }
+  uint32_t blocks = (Image_Size + Fw_Block_Size - 1) / Fw_Block_Size;
+  if (blocks > 0xFFFF) {
+    Fw_Finish(FW_FAILED, "image has too many blocks for this link");
+    return;
+  }
+  Fw_Blocks = blocks;
+
+  int length = snprintf(line, sizeof(line), "%s:%lu,%08lx,%u\n", FW_OFFER_FRAME, (unsigned long)Image_Size,
+                        (unsigned long)Image_Crc, Fw_Block_Size);
+  SensorTransport::write(line, length);
+  Fw_Acks_Seen = Fw_Rx_Acks;
+  Fw_Rx_Result = -1;
+  Fw_Offers++;
+  Fw_Offer_Ms = millis();
+  Fw_State = FW_OFFER;
+}
+
+static bool Fw_Send_Block(uint16_t block) {
+  uint8_t   data[FW_BLOCK_SIZE];
+  char      line[FW_LINE_LENGTH(FW_BLOCK_SIZE)];
+  uint32_t  offset = (uint32_t)block * Fw_Block_Size;
+  uint32_t  n = min((uint32_t)Fw_Block_Size, Image_Size - offset);
+
+  if (esp_partition_read(Stage_Part, offset, data, n) != ESP_OK) {
+    Fw_Finish(FW_FAILED, "flash read failed");
+    return false;
+  }
+  size_t length = snprintf(line, sizeof(line), "%s:%u,%08lx,", FW_BLOCK_FRAME, block,
+                           (unsigned long)crc32_le(0, data, n));
+  length += Base64_Encode(data, n, line + length);
+  line[length++] = '\n';
+
+  if (length > SensorTransport::writeRoom())
+    return false;
+  if (SensorTransport::write(line, length) != length)
+    return false;
+  Fw_Link_Bytes += length;
+  return true;
+}
+
+// As many blocks of the window as the link has room for
+static void Fw_Send_Window() {
+  while (Fw_State == FW_SEND && Fw_Next < Fw_Blocks && Fw_Next - Fw_Acked < FW_WINDOW) {
+    if (!Fw_Send_Block(Fw_Next))
+      break;
+    Fw_Next++;
+  }
+}
+
+static void Fw_Rewind() {
+  Fw_Retransmits += Fw_Next - Fw_Acked;
+  Fw_Next = Fw_Acked;
+  Fw_Rewound = true;
+  Fw_Progress_Ms = millis();
+}
+
+static unsigned long Fw_Elapsed_Ms() {
+  unsigned long end = (Fw_State == FW_DONE || Fw_State == FW_FAILED) ? Fw_End_Ms : millis();
+  return Fw_Start_Ms != 0 && end != Fw_Start_Ms ? end - Fw_Start_Ms : 1;
+}
+
+static void Fw_Status() {
+  unsigned long ms = Fw_Elapsed_Ms();
+  uint32_t payload = (uint32_t)(Fw_Acked - Fw_Start_Block) * Fw_Block_Size;
+
+  Serial.printf("@FW,%s,%u,%u,%lu,%lu,%lu\n", Fw_State_Names[Fw_State], Fw_Acked, Fw_Blocks,
+                (unsigned long)((uint64_t)payload * 1000 / ms), (unsigned long)((uint64_t)Fw_Link_Bytes * 1000 / ms),
+                (unsigned long)Fw_Retransmits);
+}
+
+static void Fw_Send(char* args) {
+  if (Stage_Active || !Image_Valid) {
+    Serial.println("@ERR,no staged image");
+    return;
+  }
+  if (Fw_State == FW_OFFER || Fw_State == FW_SEND || Fw_State == FW_VERIFY || Fw_State == FW_PAUSED) {
+    Serial.println("@ERR,transfer running");
+    return;
+  }
+  Fw_Acked = 0;
+  Fw_Next = 0;
+  Fw_Start_Block = 0;
+  Fw_Retransmits = 0;
+  Fw_Link_Bytes = 0;
+  Fw_Start_Ms = 0;
+  Fw_Offers = 0;
+  Fw_Report_Ms = millis();
+  if (SensorTransport::ready())
+    Fw_Offer();
+  else
+    Fw_State = FW_PAUSED;
+  Serial.println("@OK");
+}
+
+static void Fw_Abort(char* args) {
+  if (Stage_Active) {
+    Console_Take(0, nullptr);
+    Stage_Active = false;
+  }
+  if (Fw_State != FW_IDLE && Fw_State != FW_DONE && Fw_State != FW_FAILED)
+    Fw_Finish(FW_FAILED, "aborted");
+  Serial.println("@OK");
+}
+
+void Fw_Command(char* args) {
+  char* sub = args;
+  while (*args != '\0' && *args != ' ')
+    args++;
+  if (*args != '\0')
+    *args++ = '\0';
+
+  if (!Image_Valid && !Stage_Active)
+    Fw_Image_Load();
+
+  if (strcmp(sub, "stage") == 0)
+    Fw_Stage(args);
+  else if (strcmp(sub, "send") == 0)
+    Fw_Send(args);
+  else if (strcmp(sub, "abort") == 0)
+    Fw_Abort(args);
+  else if (strcmp(sub, "status") == 0)
+    Fw_Status();
+  else
+    Serial.println("@ERR,usage: fw stage|send|abort|status");
+}
+
+static bool Fw_Running() {
+  return Fw_State == FW_OFFER || Fw_State == FW_SEND || Fw_State == FW_VERIFY;
+}
+
+// Acks and verdicts outside a transfer (idle, aborted, a late answer after a failure) are ignored.
+void Fw_Ack(uint16_t next) {
+  if (!Fw_Running())
+    return;
+  if (next == Fw_Rx_Next && Fw_Rx_Dup_Run < 255)
+    Fw_Rx_Dup_Run++;
+  else if (next != Fw_Rx_Next)
+    Fw_Rx_Dup_Run = 0;
+  Fw_Rx_Next = next;
+  Fw_Rx_Acks++;
+}
+
+void Fw_Result(uint8_t code) {
+  if (!Fw_Running())
+    return;
+  Fw_Rx_Result = code;
+}
+
+void Fw_Poll() {
+  unsigned long now = millis();
+
+  if (Stage_Active && now - Stage_Last_Ms >= FW_STAGE_TIMEOUT_MS) {
+    Console_Take(0, nullptr);
+    Stage_Active = false;
+    Serial.printf("@ERR,stage timed out after %lu of %lu bytes\n", (unsigned long)Stage_Offset,
+                  (unsigned long)Image_Size);
+  }
+
+  if (Fw_State == FW_IDLE || Fw_State == FW_DONE || Fw_State == FW_FAILED)
+    return;
+
+  if (Fw_State == FW_PAUSED) {
+    if (SensorTransport::ready())
+      Fw_Offer();
+    return;
+  }
+  if (!SensorTransport::ready()) {
+    Serial.println("Sensor firmware update paused, sensor link down");
+    Fw_State = FW_PAUSED;
+    Fw_Offers = 0;
+    return;
+  }
+
+  int16_t result = Fw_Rx_Result;
+  if (result >= 0) {
+    Fw_Rx_Result = -1;
+    if (result == 0 && Fw_State == FW_VERIFY) {
+      Fw_Finish(FW_DONE, "image verified by the sensor");
+      Fw_Status();
+    } else if (result != 0) {
+      char why[32];
+      snprintf(why, sizeof(why), "sensor error %02d", result);
+      Fw_Finish(FW_FAILED, why);
+    }
+    return;
+  }
+
+  uint32_t acks = Fw_Rx_Acks;
+  if (acks != Fw_Acks_Seen) {
+    Fw_Acks_Seen = acks;
+    uint16_t next = Fw_Rx_Next;
+    if (next > Fw_Blocks)
+      next = Fw_Blocks;
+    if (Fw_State == FW_OFFER) {
+      // The answer to the offer: where the sensor wants to start.
+      if (next > 0)
+        Serial.printf("Sensor firmware update resumes at block %u of %u\n", next, Fw_Blocks);
+      Fw_Acked = next;
+      Fw_Next = next;
+      Fw_Start_Block = next;
+      Fw_Start_Ms = now;
+      Fw_Link_Bytes = 0;
+      Fw_Progress_Ms = now;
+      Fw_Rewound = false;
+      Fw_Rx_Dup_Run = 0;
+      Fw_State = FW_SEND;
+    } else if (Fw_State == FW_SEND && next > Fw_Acked && next <= Fw_Next) {
+      Fw_Acked = next;
+      Fw_Progress_Ms = now;
+      Fw_Rewound = false;
+    }
+  }
+
+  if (Fw_State == FW_OFFER) {
+    if (now - Fw_Offer_Ms < FW_OFFER_MS)
+      return;
+    if (Fw_Offers >= FW_OFFER_TRIES)
+      Fw_Finish(FW_FAILED, "no answer to the offer");
+    else
+      Fw_Offer();
+    return;
+  }
+
+  if (Fw_State == FW_SEND) {
+    if (Fw_Acked == Fw_Blocks) {
+      Fw_State = FW_VERIFY;
+      Fw_Progress_Ms = now;
+      return;
+    }
+    // Dropped blocks: repeated acks for the block the sensor is missing, or no progress at all.
+    if (Fw_Next > Fw_Acked && !Fw_Rewound && Fw_Rx_Dup_Run >= FW_DUP_ACKS)
+      Fw_Rewind();
+    else if (Fw_Next > Fw_Acked && now - Fw_Progress_Ms >= FW_RTO_MS)
+      Fw_Rewind();
+
+    if (Fw_Next == Fw_Acked)
+      Fw_Progress_Ms = now;
+    Fw_Send_Window();
+  } else if (Fw_State == FW_VERIFY && now - Fw_Progress_Ms >= FW_VERIFY_MS) {
+    Fw_Finish(FW_FAILED, "no verdict from the sensor");
+    return;
+  }
+
+  if (now - Fw_Report_Ms >= FW_REPORT_MS) {
+    Fw_Report_Ms = now;
+    Fw_Status();
+  }
+}
+
+void Fw_Delay(unsigned long ms) {
+  unsigned long start = millis();
+
+  // Acks are only taken in at the next Fw_Poll(), so this sends at most the rest of the window.
+  while (Fw_State == FW_SEND && millis() - start + FW_PACE_MS <= ms) {
+    delay(FW_PACE_MS);
+    if (SensorTransport::ready())
+      Fw_Send_Window();
+  }
+  unsigned long spent = millis() - start;
+  if (spent < ms)
+    delay(ms - spent);
+}
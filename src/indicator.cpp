@@ -0,0 +1,145 @@
+/* Front panel indicator engine, see indicator.h
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "indicator.h"
+
+#define DUTY_ON       ((1 << INDICATOR_LEDC_BITS) - 1)
+#define DUTY_DIM      (DUTY_ON / 4)
+
+struct Indicator_Step {
+  uint8_t         duty;
+  uint16_t        ms;       // 0: hold for as long as the pattern is shown
+};
+
+struct Indicator_Pattern {
+  const Indicator_Step* steps;
+  uint8_t         count;
+  uint8_t         code_steps; // leading steps repeated `code` times (IND_PAT_CODE)
+};
+
+static const Indicator_Step Steps_On[]         = {{DUTY_ON, 0}};
+static const Indicator_Step Steps_Dim[]        = {{DUTY_DIM, 0}};
+static const Indicator_Step Steps_Blink_Fast[] = {{DUTY_ON, 100}, {0, 100}};
+static const Indicator_Step Steps_Blink_Slow[] = {{DUTY_ON, 500}, {0, 500}};
+static const Indicator_Step Steps_Code[]       = {{DUTY_ON, 200}, {0, 300}, {0, 1500}};
+
+#define STEPS(s)  s, sizeof(s) / sizeof(s[0])
+
+// Indexed by Indicator_Pattern_Id
+static const Indicator_Pattern Patterns[IND_PAT_COUNT] = {
+  {nullptr, 0, 0},                  // IND_PAT_NONE
+  {STEPS(Steps_On), 0},             // IND_PAT_ON
+  {STEPS(Steps_Dim), 0},            // IND_PAT_DIM
+  {STEPS(Steps_Blink_Fast), 0},     // IND_PAT_BLINK_FAST
+  {STEPS(Steps_Blink_Slow), 0},     // IND_PAT_BLINK_SLOW
+  {STEPS(Steps_Code), 2},           // IND_PAT_CODE
+};
+
+struct Indicator_State {
+  bool            attached;
+  uint8_t         pattern[IND_PRIO_COUNT];
+  uint8_t         code[IND_PRIO_COUNT];
+  // Pattern being played, owned by the timer callback
+  uint8_t         playing;
+  uint8_t         playing_code;
+  uint8_t         step;
+  uint8_t         rep;
+  uint16_t        left_ms;
+  int16_t         duty;
+};
+
+static Indicator_State    Indicators[IND_COUNT];
+static portMUX_TYPE       Indicator_Mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t Indicator_Timer;
+
+static void Indicator_Output(uint8_t led, Indicator_State& s, uint8_t duty) {
+  if (s.duty == duty)
+    return;
+  s.duty = duty;
+  ledcWrite(INDICATOR_LEDC_CHANNEL + led, duty);
+}
+
+static void Indicator_Tick(void* arg) {
+  for (uint8_t led = 0; led < IND_COUNT; led++) {
+    Indicator_State& s = Indicators[led];
+    if (!s.attached)
+      continue;
+
+    uint8_t pattern = IND_PAT_NONE;
+    uint8_t code = 0;
+    portENTER_CRITICAL(&Indicator_Mux);
+    for (int prio = IND_PRIO_COUNT - 1; prio >= 0; prio--) {
+      if (s.pattern[prio] != IND_PAT_NONE) {
+        pattern = s.pattern[prio];
+        code = s.code[prio];
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&Indicator_Mux);
+
+    if (pattern == IND_PAT_NONE) {
+      s.playing = IND_PAT_NONE;
+      Indicator_Output(led, s, 0);
+      continue;
+    }
+
+    const Indicator_Pattern& p = Patterns[pattern];
+    if (pattern != s.playing || code != s.playing_code) {
+      s.playing = pattern;
+      s.playing_code = code;
+      s.step = 0;
+      s.rep = 0;
+      s.left_ms = p.steps[0].ms;
+    } else if (s.left_ms != 0) {
+      if (s.left_ms > INDICATOR_TICK_MS) {
+        s.left_ms -= INDICATOR_TICK_MS;
+      } else {
+        s.step++;
+        if (p.code_steps && s.step == p.code_steps && s.rep + 1 < code) {
+          s.rep++;
+          s.step = 0;
+        } else if (s.step >= p.count) {
+          s.rep = 0;
+          s.step = 0;
+        }
+        s.left_ms = p.steps[s.step].ms;
+      }
+    }
+    Indicator_Output(led, s, p.steps[s.step].duty);
+  }
+}
+
+void Indicator_Attach(uint8_t led, int pin) {
+  Indicator_State& s = Indicators[led];
+  s.attached = true;
+  s.duty = -1;
+  ledcSetup(INDICATOR_LEDC_CHANNEL + led, INDICATOR_LEDC_FREQ, INDICATOR_LEDC_BITS);
+  ledcAttachPin(pin, INDICATOR_LEDC_CHANNEL + led);
+  Indicator_Output(led, s, 0);
+}
+
+void Indicator_Begin() {
+  const esp_timer_create_args_t args = {
+    .callback = Indicator_Tick,
+    .arg = nullptr,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "indicator",
+  };
+  esp_timer_create(&args, &Indicator_Timer);
+  esp_timer_start_periodic(Indicator_Timer, INDICATOR_TICK_MS * 1000);
+}
+
+void Indicator_Show(uint8_t led, uint8_t priority, uint8_t pattern, uint8_t code) {
+  if (led >= IND_COUNT || priority >= IND_PRIO_COUNT || pattern >= IND_PAT_COUNT)
+    return;
+  portENTER_CRITICAL(&Indicator_Mux);
+  Indicators[led].pattern[priority] = pattern;
+  Indicators[led].code[priority] = min(code, (uint8_t)IND_CODE_MAX);
+  portEXIT_CRITICAL(&Indicator_Mux);
+}
+
+void Indicator_Set(uint8_t led, bool on) {
+  Indicator_Show(led, IND_PRIO_STATE, on ? IND_PAT_ON : IND_PAT_NONE);
+}
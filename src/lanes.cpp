@@ -0,0 +1,126 @@
+/* Two-channel lane model, see lanes.h
+ */
+
+#include <Arduino.h>
+#include "controller.h"
+#include "lanes.h"
+#include "indicator.h"
+#include "rollup.h"
+#include "rules.h"
+#include "dwell.h"
+
+Relay_Channel   Relay_Channels[OUTPUT_COUNT] = {{0, false, false, 0, 0, 0}, {0, false, false, 0, 0, 1}};
+
+void Relay_Output(uint8_t output, bool on) {
+  Relay_Channels[output].out = on;
+  digitalWrite(Relay_Pins[output], on ? HIGH : LOW);
+  Warm_Mirror();
+  Report_Event(MOBI_EV_RELAY, MOBI_EV_VALUE(output, on));
+  Indicator_Set(IND_RELAY, Relay_Channels[0].out || Relay_Channels[1].out);
+  Rollup_Relay(Relay_Channels[output].lane, on);
+}
+
+// Switches an output for a lane; a lane taking over a running output (two-in-one) ends the other lane's relay time
+static void Relay_Lane_Output(uint8_t output, uint8_t lane, bool on) {
+  Relay_Channel& ch = Relay_Channels[output];
+
+  if (ch.out && ch.lane != lane)
+    Rollup_Relay(ch.lane, false);
+  ch.lane = lane;
+  Relay_Output(output, on);
+}
+
+// The BLE scan is held off while any output is busy
+bool Relay_Busy() {
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+    if (Relay_Channels[i].on || Relay_Channels[i].out)
+      return true;
+  }
+  return false;
+}
+
+int Lane_Relay_Timer(uint8_t lane) {
+  return lane == 0 ? RELAYTIMER_PARAM : RELAYTIMER_PARAM1;
+}
+
+uint8_t Lane_Relay_Timing(uint8_t lane) {
+  return lane == 0 ? RELAYTIMING_PARAM : RELAYTIMING_PARAM1;
+}
+
+bool Lane_Enabled(uint8_t lane) {
+  if (lane == 1 && TWOCHANNLEMODE_PARAM == 0) {
+    if (Frame_Log)
+      Serial.println("Second channel is off.");
+    return false;
+  }
+  return true;
+}
+
+uint8_t Lane_Output(uint8_t lane) {
+  return TWOINONEMODE_PARAM == 1 ? 0 : lane;
+}
+
+int Relay_Hold_Ticks(uint8_t lane) {
+  int ticks = Lane_Relay_Timer(lane) * 10;
+#if ADAPTIVE_RELAY
+  ticks = Dwell_Hold_Ticks(lane, ticks, Lane_Relay_Timing(lane));
+#endif
+  return ticks;
+}
+
+void Lane_Detect(uint8_t lane, uint8_t detect) {
+  uint8_t         output = Lane_Output(lane);
+  Relay_Channel&  ch = Relay_Channels[output];
+  uint8_t         action = Rule_Action(lane, detect);
+
+  if (action == RULE_NONE)
+    return;
+  Serial.println(detect == 1 ? "입차" : "출차");
+  switch (action) {
+    case RULE_HOLD:
+      ch.count = Relay_Hold_Ticks(lane);
+      Serial.printf("[%u] Relay_Count : %d\n", output, ch.count);
+      if (Lane_Relay_Timer(lane) != 0)
+      {
+        ch.on = true;
+        Relay_Lane_Output(output, lane, true);
+      }
+      break;
+    case RULE_ON:
+    case RULE_OFF:
+      Relay_Lane_Output(output, lane, action == RULE_ON);
+      break;
+    case RULE_PULSE:
+      ch.queued = ch.queued + 1;
+      if (lane == 1)
+        ch.queued1 = ch.queued1 + 1;
+      break;
+  }
+}
+
+void Relay_Tick() {
+  for (uint8_t output = 0; output < OUTPUT_COUNT; output++) {
+    Relay_Channel& ch = Relay_Channels[output];
+
+    if (ch.count <= 0 && !ch.on && ch.queued > 0)
+    {
+      ch.count = RELAY_PULSE_TICKS;
+      Serial.println(ch.count);
+      ch.on = true;
+      // Lane 0's passes first, the pulse is booked to the lane it is for
+      Relay_Lane_Output(output, ch.queued > ch.queued1 ? 0 : 1, true);
+    } else if (ch.count <= 0 && ch.on)
+    {
+      Relay_Output(output, false);
+      ch.on = false;
+      if (ch.queued > 0 && ch.lane == 1 && ch.queued1 > 0)
+        ch.queued1--;
+      ch.queued = ch.queued > 0 ? ch.queued - 1 : 0;
+    }
+    else if (ch.count > 0) {
+      Serial.printf("%u[%d] : ", output, ch.queued);
+      Serial.println(ch.count);
+      ch.count--;
+    }
+  }
+}
@@ -52,55 +52,25 @@
  */
 
 #include <Arduino.h>
-#include <BLEDevice.h>
-#include <BLEServer.h>
-#include <BLEUtils.h>
-#include <BLEScan.h>
 #include <stdio.h>
 #include <string.h>
 #include "esp_adc_cal.h"
+#include "config.h"
+#include "controller.h"
+#include "transport.h"
+#include "indicator.h"
+#include "detect_filter.h"
+#include "detect_seq.h"
+#include "rollup.h"
+#include "console.h"
+#include "settings.h"
+#include "warm_state.h"
+#include "fw_update.h"
+#include "rules.h"
+#include "dwell.h"
+#include "lanes.h"
 
-#define  BLE_COMM             false
-#define  UART_COMM            true
-
-static boolean doConnect        = false;
-static boolean connected        = false;
-
-#if BLE_COMM
-// The remote service we wish to connect to.
-static BLEUUID serviceUUID("6e400001-b5a3-f393-e0a9-e50e24dcca9e");
-// The characteristic of the remote service we are interested in.
-static BLEUUID readUUID("6e400002-b5a3-f393-e0a9-e50e24dcca9e");
-static BLEUUID charUUID("6e400003-b5a3-f393-e0a9-e50e24dcca9e");
-
-// static boolean doConnect        = false;
-// static boolean connected        = false;
-static boolean doScan           = false;
-static BLERemoteCharacteristic* pRemoteCharacteristic;
-static BLERemoteCharacteristic* pRemoteCharacteristicRx;
-static BLEAdvertisedDevice*     myDevice;
-static BLEScan*                 pBLEScan; 
-#endif
-
-#if UART_COMM
-
-#define TX1 10 //23
-#define RX1 9  //27
 
-#define UART_TX_BUF_SIZE                256                                         /**< UART TX buffer size. */
-#define UART_RX_BUF_SIZE                256                                         /**< UART RX buffer size. */
-
-char UART_TX_BUF[UART_TX_BUF_SIZE];
-char UART_RX_BUF[UART_RX_BUF_SIZE];
-uint8_t UART_RX_BUF_Index = 0;
-uint8_t Uart_Msg_Length = 0;
-
-bool Sensor_Started = false;
-#endif
-
-
-int             Relay_Count             = 0;
-bool            Relay_On                = false;
 
 String          VEHICLEDETECT_CMD       = "00";
 String          DIRECTION_CMD           = "01";
@@ -111,6 +81,15 @@ String          BATTERYLEVEL_CMD        = "05";
 String          OPERATIONMODE_CMD       = "06";
 String          BLETXPOWER_CMD          = "07";
 String          DIRECTION_CAT_CMD       = "08";
+String          BAUDRATE_CMD            = "09";
+String          DETECT_ACK_CMD          = "10";
+String          FWRESULT_CMD            = "12";
+String          FWACK_CMD               = "14";
+String          VEHICLEDETECT1_CMD      = "20";
+String          DIRECTION1_CMD          = "21";
+String          RELAYTIMER1_CMD         = "22";
+String          BATCHWINDOW_CMD         = "23";
+String          SENSORERROR1_CMD        = "98";
 String          SENSORERROR_CMD         = "99";
 
 String          Front_CMD;
@@ -118,14 +97,11 @@ String          Back_CMD;
 
 const int       RelayLED                = 2;  // power LED
 const int       RelayPin                = 21;  //16; //RELAY
+const int       RelayPin1               = 25;  //RELAY 2, second lane
+const int       Relay_Pins[OUTPUT_COUNT] = {RelayPin, RelayPin1};
 const int       ERRLED                  = 33;   // ERR LED
 const int       PowerLED                = 4;   //13; //LED
 
-const uint8_t   notificationOff[]       = {0x0, 0x0};
-const uint8_t   notificationOn[]        = {0x1, 0x0};
-bool            onoff                   = true;
-bool            onoff1                  = true;
-
 const int       Operation_DipSwitch[]   = {14, 15}; // 1 - 0 : ramp, 1: bar / 2 - 0 : nc, 1 : counter
 const int       DipSwitch_2             = 36; //Sensor0 Direction, 0 : L -> R, 1 : R -> L
 const int       DipSwitch_3             = 32; //Direction Sensitivity 0
@@ -156,15 +132,16 @@ uint8_t         DIRECTION_PARAM         = 0;  //0: Left->Right, 1: Right->Left
 uint8_t         RELAYTIMING_PARAM       = 0;  //00: In, 01: Out
 
 int             RELAYTIMER_PARAM        = 5;  //5 secs
+int             RELAYTIMER_PARAM1       = 5;  //5 secs
 uint8_t         BATTERYLEVEL_PARAM      = 9;  //00: Off, 9: Max
-uint8_t         SENSORERR_PARAM         = 0;  //0: OK, 1: Error
+uint8_t         SENSORERR_PARAM         = 0;  //0: OK, else the sensor's error code
 
 uint8_t         DIRECTION_PARAM1        = 0;  //0: Left->Right, 1: Right->Left
 uint8_t         RELAYTIMING_PARAM1      = 0;  //00: In, 01: Out
 
 int             SENSITIVITY_VALUE       = 5;  //Sersitivity value 0 ~ 9
 uint8_t         BATTERYLEVEL_PARAM1     = 9;  //00: Off, 9: Max 
-uint8_t         SENSORERR_PARAM1        = 0;  //0: OK, 1: Error
+uint8_t         SENSORERR_PARAM1        = 0;  //0: OK, else the sensor's error code
 
 uint8_t         DIRECTION_SENSITIVITY   = 0;  //
 uint8_t         DIRECTION_SENSITIVITY1  = 0;  //
@@ -176,23 +153,68 @@ uint8_t         SENSITIVITY_LEVEL3      = 0;  //
 int             OPERATION_VALUE         = 0;
 int             DIRECTION_VALUE         = 0;
 int             SENSITIVITY_LEVEL_VALUE = 0;
+int             BATCHWINDOW_PARAM       = BATCH_WINDOW_MS;  //ms, 0: no batching
+int             Frame_Log               = 0;  //1: log every raw sensor frame
 
 uint8_t         RelayTimerArr[9]        = {0, 3, 5, 7, 10, 12, 15, 20, 30};
 uint8_t         SensitivityArr[8]       = {0, 1, 2, 3, 4, 5, 6, 7};
 
-static boolean  sendParam               = false;
-
 bool            Mobi_Ramp_Sensor0_Connected = false;
 
 bool            Mobi_Ramp_Sensor0_Error = false;
-bool            Mobi_Ramp_Sensor0_Error_Flag = false;
+bool            Mobi_Ramp_Sensor1_Error = false;
 
-uint8_t         Vehicle_Count = 0;
+uint32_t        Event_Seq = 0;
 
 //For ADC
 #define         DEFAULT_VREF            1100
 esp_adc_cal_characteristics_t           *adc_chars;
 
+/////////////////////////////////////////////////////////////////////////
+//Report an event to the host gateway, see include/mobi_event.h
+/////////////////////////////////////////////////////////////////////////
+
+void Report_Event(char kind, int value) {
+#if EVENT_REPORT
+  Serial.printf(MOBI_EVENT_FMT, (unsigned long)Event_Seq++, (unsigned long)millis(), kind, value);
+#endif
+}
+
+// Mirrors the control state into RTC memory for a warm restart
+void Warm_Mirror() {
+  Warm_State state = {};
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+    state.relay_count[i] = Relay_Channels[i].count;
+    state.relay_on[i] = Relay_Channels[i].on;
+    state.relay_out[i] = Relay_Channels[i].out;
+    state.vehicle_count[i] = Relay_Channels[i].queued;
+  }
+  state.operation_mode = OPERATIONMODE_PARAM;
+  state.detect_synced = Detect_Seq_Synced();
+  state.detect_next = Detect_Seq_Next();
+  Warm_Save(state);
+}
+
+void Operation_Mode_Changed() {
+  Serial.printf("Operation mode changed to %d\n", OPERATIONMODE_PARAM);
+  Detect_Filter_Reset();
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+    Relay_Channels[i].count = 0;
+    Relay_Channels[i].on = false;
+    Relay_Channels[i].queued = 0;
+    Relay_Channels[i].queued1 = 0;
+    Relay_Output(i, false);
+  }
+}
+
+void Sensor_Error_Set(uint8_t lane, bool active) {
+  if (lane == 0)
+    Mobi_Ramp_Sensor0_Error = active;
+  else
+    Mobi_Ramp_Sensor1_Error = active;
+  Rollup_Error(lane, active);
+}
+
 void Split_Word_F(String Buffer) {
 
   int Split_Word = Buffer.indexOf(":");
@@ -204,432 +226,174 @@ void Split_Word_F(String Buffer) {
     Front_CMD = Buffer.substring(max(Split_Word - 2, 0), min(Split_Word, Split_Length));
     Back_CMD = Buffer.substring(Split_Word + 1, min(Split_Word + 3, Split_Length));
 
-    Serial.println("Front_CMD : " + Front_CMD);
-    Serial.println("Back_CMD : " + Back_CMD);
+    if (Frame_Log) {
+      Serial.println("Front_CMD : " + Front_CMD);
+      Serial.println("Back_CMD : " + Back_CMD);
+    }
   }
   else {
     Serial.println("Invalid Command.");
   }
 }
 
-//////////////////////////////////////////////////////////////////////////////
-////////////////////////--BLE Callback--//////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
-#if BLE_COMM
-
-static void notifyCallback(
-  BLERemoteCharacteristic* pBLERemoteCharacteristic,
-  uint8_t* pData,
-  size_t length,
-  bool isNotify) 
-  {
-    String          Buffer;
-
-    if (sendParam == false)
-      return;
-
-    Serial.print("Notify callback for characteristic ");
-    Serial.print(pBLERemoteCharacteristic->getUUID().toString().c_str());
-    Serial.print(" of data length ");
-    Serial.println(length);
-    Serial.print("data: ");
-    Serial.write(pData, length);
-    Serial.println();
-
-    String rxValue = (char*)pData;
-
-    if (rxValue.length() > 0) {
-      Serial.println("*********");
-      Serial.print("Received Value: ");
-      Serial.print(rxValue.length());
-      for (int i = 0; i < rxValue.length(); i++) {
-        Serial.print(rxValue[i]);
-        Buffer += (char)rxValue[i];
-      }
-      Serial.println();
-      Serial.println("*********");
-      Serial.println(Buffer);
-    }
+String converter(uint8_t val) {
+  char c_str[4];
+  sprintf(c_str, "%2d", val);
+  return String(c_str);
+}
 
-    Split_Word_F(Buffer);
+/////////////////////////////////////////////////////////////////////////
+//Detection sequencing: acks for detect_seq.h
+/////////////////////////////////////////////////////////////////////////
 
-    if(Front_CMD == VEHICLEDETECT_CMD)             //VehicleDetect_Command Mode
-    {
-      //VEHICLEDETECT_PARAM = atoi(Buffer.substring(msg_start, msg_start+2).c_str());
-      VEHICLEDETECT_PARAM = atoi(Back_CMD.c_str());
-
-      if (OPERATIONMODE_PARAM == 0) {  //경광등 모드
-        if (VEHICLEDETECT_PARAM == 1 && RELAYTIMING_PARAM == 0)
-        {
-          Serial.println("입차");
-          Relay_Count = RELAYTIMER_PARAM * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }      
-        }
-        else if(VEHICLEDETECT_PARAM == 0 && RELAYTIMING_PARAM == 1) {
-          Serial.println("출차");
-          Relay_Count = RELAYTIMER_PARAM * 10;
-          Buffer = "";
-          Serial.println("Relay_Count : " + Relay_Count);
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }           
-        }
-      } else if (OPERATIONMODE_PARAM == 1) {  // 차단봉 모드 
-        if (VEHICLEDETECT_PARAM == 1)
-        {
-          Serial.println("입차");
-          Buffer = "";
-          digitalWrite(RelayPin, HIGH);
-          digitalWrite(SensorPin, HIGH); 
-
-          /*
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(RelayLed, HIGH); 
-          }
-          */         
-        } else if (VEHICLEDETECT_PARAM == 0)
-        {
-          Serial.println("출차");
-          Buffer = "";
-          digitalWrite(RelayPin, LOW);
-          digitalWrite(SensorPin, LOW); 
-          //Relay_On = true;        
-          //Relay_Count = RELAYTIMER_PARAM * 10;        
-        }
-      } else if(OPERATIONMODE_PARAM == 2 || OPERATIONMODE_PARAM == 3) { // 카운터 모드
-
-        if (VEHICLEDETECT_PARAM == 1 && RELAYTIMING_PARAM == 0)
-        {
-          Serial.println("입차");
-          Vehicle_Count = Vehicle_Count + 1;
-          /*
-          Relay_Count = 1 * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }
-        */    
-        }
-        else if(VEHICLEDETECT_PARAM == 0 && RELAYTIMING_PARAM == 1) {
-          Serial.println("출차");
-          Vehicle_Count = Vehicle_Count + 1;
-          /*
-          Relay_Count = 1 * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }
-        */          
-        }
-      }
-    }
-    else if(Front_CMD == (SENSORERROR_CMD))
-    {
-      //SENSORERR_PARAM = atoi(Buffer.substring(msg_start, msg_start+2).c_str());
-      SENSORERR_PARAM = atoi(Back_CMD.c_str());
+void Detect_Ack(uint16_t seq) {
+  String ack = DETECT_ACK_CMD + ":" + String((unsigned)seq) + "\n";
+  SensorTransport::write(ack.c_str(), ack.length());
+}
 
-      if(SENSORERR_PARAM == 1)
-        Mobi_Ramp_Sensor0_Error = true;
-      else 
-        Mobi_Ramp_Sensor0_Error = false;
+/////////////////////////////////////////////////////////////////////////
+//Sensor link events from the transports
+/////////////////////////////////////////////////////////////////////////
 
-      Buffer = "";
-      Serial.println("mobi-ramp sensor err");
-    }
-    else {
-      Serial.println("This command does not exist.");
-      Buffer = "";
-    }  
-}
+void Sensor_Link_Changed(uint8_t link, bool up) {
+  // In a failover build the standby link coming and going does not change what the sensor reports.
+  if (!SensorTransport::accepts(link))
+    return;
 
-class MyClientCallback : public BLEClientCallbacks {
-  void onConnect(BLEClient* pclient) {
-    Mobi_Ramp_Sensor0_Connected = true;
-    Serial.println("Connected to device 1");
+  Mobi_Ramp_Sensor0_Connected = up;
+  if (up) {
     SENSORERR_PARAM = 0;
+  } else {
+    Sensor_Error_Set(0, false);
+    Sensor_Error_Set(1, false);
   }
+  Report_Event(MOBI_EV_LINK, up ? 1 : 0);
+}
 
-  void onDisconnect(BLEClient* pclient) {
-    Mobi_Ramp_Sensor0_Connected = false;
-    Mobi_Ramp_Sensor0_Error = false;
-    connected = false;
-    sendParam = false;
-    Serial.println("onDisconnect");
-  }
-};
-
-bool connectToServer() {
-    Serial.print("Forming a connection to ");
-    Serial.println(myDevice->getAddress().toString().c_str());
-    
-    BLEClient*  pClient  = BLEDevice::createClient();
-    Serial.println(" - Created client");
-
-    pClient->setClientCallbacks(new MyClientCallback());
-
-    // Connect to the remove BLE Server.
-    pClient->connect(myDevice);  // if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
-    Serial.println(" - Connected to server");
-    pClient->setMTU(517); //set client to request maximum MTU from server (default is 23 otherwise)
-  
-    // Obtain a reference to the service we are after in the remote BLE server.
-    BLERemoteService* pRemoteService = pClient->getService(serviceUUID);
-    if (pRemoteService == nullptr) {
-      Serial.print("Failed to find our service UUID: ");
-      Serial.println(serviceUUID.toString().c_str());
-      pClient->disconnect();
-      return false;
-    }
-    Serial.println(" - Found our service");
-
-    // Obtain a reference to the characteristic in the service of the remote BLE server.
-    pRemoteCharacteristicRx = pRemoteService->getCharacteristic(readUUID);
-    if (pRemoteCharacteristicRx == nullptr) {
-      Serial.print("Failed to find our characteristic UUID: ");
-      Serial.println(readUUID.toString().c_str());
-      pClient->disconnect();
-      return false;
-    }
-    Serial.println(" - Found our Rx characteristic");
-
-    // Obtain a reference to the characteristic in the service of the remote BLE server.
-    pRemoteCharacteristic = pRemoteService->getCharacteristic(charUUID);
-    if (pRemoteCharacteristic == nullptr) {
-      Serial.print("Failed to find our characteristic UUID: ");
-      Serial.println(charUUID.toString().c_str());
-      pClient->disconnect();
-      return false;
-    }
-    Serial.println(" - Found our characteristic");
-
-    // Read the value of the characteristic.
-    if(pRemoteCharacteristic->canRead()) {
-      std::string value = pRemoteCharacteristic->readValue();
-      Serial.print("The characteristic value was: ");
-      Serial.println(value.c_str());
-    }
+void Sensor_Restarted(uint8_t link) {
+  if (!SensorTransport::accepts(link))
+    return;
 
-    if(pRemoteCharacteristic->canNotify()) {
-      pRemoteCharacteristic->registerForNotify(notifyCallback);
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++)
+    Relay_Output(i, false);
 
-      Serial.println("Notifications turned on");
-      pRemoteCharacteristic->getDescriptor(BLEUUID((uint16_t)0x2902))->writeValue((uint8_t*)notificationOn, 2, true);
-    }
-    
-    connected = true;
-    return true;
+  Detect_Seq_Reset();
+  Detect_Filter_Reset();
+  Indicator_Show(IND_ERROR, IND_PRIO_FAULT, IND_PAT_NONE);
 }
 
+/////////////////////////////////////////////////////////////////////////
+//Lanes: detections to relay outputs
+/////////////////////////////////////////////////////////////////////////
 
-/**
- * Scan for BLE servers and find the first one that advertises the service we are looking for.
- */
-class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
- /**
-   * Called for each advertising BLE server.
-   */
-  void onResult(BLEAdvertisedDevice advertisedDevice) {
-    Serial.print("BLE Advertised Device found: ");
-    Serial.println(advertisedDevice.toString().c_str());
-
-    // We have found a device, let us now see if it contains the service we are looking for.
-    if (advertisedDevice.haveServiceUUID() 
-    && advertisedDevice.isAdvertisingService(serviceUUID)
-    && (advertisedDevice.getName().compare("[intervoid]mobi-ramp_01") == 0)    
-    ) 
-    {
-      Mobi_Ramp_Sensor0_Connected = true;
-   
-      BLEDevice::getScan()->stop();
-      myDevice = new BLEAdvertisedDevice(advertisedDevice);
-      doConnect = true;
-      doScan = true;
-    } // Found our server
-  } // onResult
-}; // MyAdvertisedDeviceCallbacks
-
-#endif
-
-#if UART_COMM
+// A detection that passed the filter (detect_filter.h)
+void Detect_Apply(uint8_t lane, uint8_t detect, unsigned long ms) {
+  Serial.printf("Lane %u detect %u\n", lane, detect);
+  if (lane == 0)
+    VEHICLEDETECT_PARAM = detect;
+  else
+    VEHICLEDETECT_PARAM1 = detect;
+  Report_Event(MOBI_EV_DETECT, MOBI_EV_VALUE(lane, detect));
+  Dwell_Track(lane, detect, ms);
+  Rollup_Detect(lane, detect);
+  Lane_Detect(lane, detect);
+}
 
-static void UART_CMD_PROCESSOR (
-  uint8_t* pData,
-  size_t length ) 
+// One frame from the sensor, ack is set when a detection has to be acknowledged
+void Sensor_Frame(uint8_t link, const uint8_t* pData, size_t length, int32_t& ack)
   {
     String          Buffer;
 
-    if (sendParam == false)
+    for (size_t i = 0; i < length && pData[i] != '\0'; i++) {
+      Buffer += (char)pData[i];
+    }
+
+    // Firmware transfer acks come many times a second, they are not logged.
+    if (Buffer.startsWith(FWACK_CMD + ":")) {
+      Fw_Ack((uint16_t)strtoul(Buffer.c_str() + 3, nullptr, 10));
       return;
+    }
 
-    Serial.print("Notify callback for UART ");
-    Serial.print("mobi-ramp sensor");
-    Serial.print(" of data length ");
-    Serial.println(length);
-    Serial.print("data: ");
-    Serial.write(pData, length);
-    Serial.println();
-
-    String rxValue = (char*)pData;
-
-    if (rxValue.length() > 0) {
-      // Serial.println("*********");
-      // Serial.print("Received Value: ");
-      // Serial.print(rxValue.length());
-      for (int i = 0; i < rxValue.length(); i++) {
-        Serial.print(rxValue[i]);
-        Buffer += (char)rxValue[i];
-      }
-      // Serial.println();
-      // Serial.println("*********");
-      // Serial.println(Buffer);
+    // Every raw frame, chatter included: off unless frame_log is set. Applied detections are logged by Detect_Apply.
+    if (Frame_Log) {
+      Serial.print("Notify callback for ");
+      Serial.print(link == LINK_BLE ? "BLE" : "UART");
+      Serial.print(" mobi-ramp sensor");
+      Serial.print(" of data length ");
+      Serial.println(length);
+      Serial.print("data: ");
+      Serial.write(pData, length);
+      Serial.println();
     }
 
     Split_Word_F(Buffer);
 
-    if(Front_CMD == VEHICLEDETECT_CMD)             //VehicleDetect_Command Mode
+    uint8_t lane = (Front_CMD == VEHICLEDETECT1_CMD || Front_CMD == SENSORERROR1_CMD) ? 1 : 0;
+
+    if(Front_CMD == VEHICLEDETECT_CMD || Front_CMD == VEHICLEDETECT1_CMD)             //VehicleDetect_Command Mode
     {
-      //VEHICLEDETECT_PARAM = atoi(Buffer.substring(msg_start, msg_start+2).c_str());
-      VEHICLEDETECT_PARAM = atoi(Back_CMD.c_str());
-
-      if (OPERATIONMODE_PARAM == 0) {  //경광등 모드
-        if (VEHICLEDETECT_PARAM == 1 && RELAYTIMING_PARAM == 0)
-        {
-          Serial.println("입차");
-          Relay_Count = RELAYTIMER_PARAM * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(RelayLED, HIGH); 
-          }      
-        }
-        else if(VEHICLEDETECT_PARAM == 0 && RELAYTIMING_PARAM == 1) {
-          Serial.println("출차");
-          Relay_Count = RELAYTIMER_PARAM * 10;
-          Buffer = "";
-          Serial.println("Relay_Count : " + Relay_Count);
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(RelayLED, HIGH); 
-          }           
-        }
-      } else if (OPERATIONMODE_PARAM == 1) {  // 차단봉 모드 
-        if (VEHICLEDETECT_PARAM == 1)
-        {
-          Serial.println("입차");
-          Buffer = "";
-          digitalWrite(RelayPin, HIGH);
-          digitalWrite(RelayLED, HIGH); 
-
-          /*
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(RelayLed, HIGH); 
-          }
-          */         
-        } else if (VEHICLEDETECT_PARAM == 0)
-        {
-          Serial.println("출차");
-          Buffer = "";
-          digitalWrite(RelayPin, LOW);
-          digitalWrite(RelayLED, LOW); 
-          //Relay_On = true;        
-          //Relay_Count = RELAYTIMER_PARAM * 10;        
-        }
-      } else if(OPERATIONMODE_PARAM == 2 || OPERATIONMODE_PARAM == 3) { // 카운터 모드
-
-        if (VEHICLEDETECT_PARAM == 1 && RELAYTIMING_PARAM == 0)
-        {
-          Serial.println("입차");
-          Vehicle_Count = Vehicle_Count + 1;
-          /*
-          Relay_Count = 1 * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }
-        */    
-        }
-        else if(VEHICLEDETECT_PARAM == 0 && RELAYTIMING_PARAM == 1) {
-          Serial.println("출차");
-          Vehicle_Count = Vehicle_Count + 1;
-          /*
-          Relay_Count = 1 * 10;
-          Buffer = "";
-          Serial.println(Relay_Count);
-
-          if(RELAYTIMER_PARAM != 0)
-          {
-            Relay_On = true;
-            digitalWrite(RelayPin, HIGH);
-            digitalWrite(SensorPin, HIGH); 
-          }
-        */          
+      unsigned long detect_ms = millis();
+      int seq_at = Buffer.indexOf(',');
+      if (seq_at != -1) {
+        // Sequenced: 00:0V,<seq>,<sensor ms>
+        const char* p = Buffer.c_str() + seq_at + 1;
+        char* end;
+        uint16_t seq = (uint16_t)strtoul(p, &end, 10);
+        if (end == p || *end != ',') {
+          Serial.println("Invalid detection frame.");
+          return;
         }
+        detect_ms = strtoul(end + 1, nullptr, 10);
+        if (!Detect_Sequence(seq, ack))
+          return;
       }
+      // Still sequenced and acked above, so the sensor does not send it again
+      if (!Lane_Enabled(lane))
+        return;
+
+      Detect_Filter_Input(lane, atoi(Back_CMD.c_str()), detect_ms);
     }
-    else if(Front_CMD == (SENSORERROR_CMD))
+    else if(Front_CMD == FWRESULT_CMD)
     {
-      //SENSORERR_PARAM = atoi(Buffer.substring(msg_start, msg_start+2).c_str());
-      SENSORERR_PARAM = atoi(Back_CMD.c_str());
+      Fw_Result(atoi(Back_CMD.c_str()));
+    }
+    else if(Front_CMD == SENSORERROR_CMD || Front_CMD == SENSORERROR1_CMD)
+    {
+      if (!Lane_Enabled(lane))
+        return;
+      uint8_t code = atoi(Back_CMD.c_str());
+      if (lane == 0)
+        SENSORERR_PARAM = code;
+      else
+        SENSORERR_PARAM1 = code;
+      Report_Event(MOBI_EV_ERROR, MOBI_EV_ERROR_VALUE(lane, code));
 
-      if(SENSORERR_PARAM == 1)
-        Mobi_Ramp_Sensor0_Error = true;
-      else 
-        Mobi_Ramp_Sensor0_Error = false;
+      Sensor_Error_Set(lane, code != 0);
 
-      Buffer = "";
       Serial.println("mobi-ramp sensor err");
     }
     else {
       Serial.println("This command does not exist.");
-      Buffer = "";
     }  
 }
 
-#endif
-
 
 /////////////////////////////////////////////////////////////////////////
 //Read Dip Switch Values
 /////////////////////////////////////////////////////////////////////////
 
+// Relay timer pot (VariableR, VariableR1), 0-4095 in 9 steps of RelayTimerArr
+int Relay_Timer_From_Pot(int raw)
+{
+  Serial.println((String)"VariableR: " + raw);
+  int step = raw / 500;
+  if (step < 0)
+    step = 0;
+  if (step > 8)
+    step = 8;
+  return RelayTimerArr[step];
+}
+
 void readDipSwitchVal()
 {
   for(int i = 0; i <2 ; i++) {
@@ -690,7 +454,7 @@ void readDipSwitchVal()
   
   //full voltage range
   adc1_config_channel_atten(ADC1_CHANNEL_7, ADC_ATTEN_11db); 
-  //adc1_config_channel_atten(ADC1_CHANNEL_6, ADC_ATTEN_11db); 
+  adc1_config_channel_atten(ADC1_CHANNEL_6, ADC_ATTEN_11db); 
 
   /*
   //get the ADC characteristics
@@ -703,35 +467,14 @@ void readDipSwitchVal()
   );
   */
 
-  RELAYTIMER_PARAM        = adc1_get_raw(ADC1_CHANNEL_7);
+  RELAYTIMER_PARAM        = Relay_Timer_From_Pot(adc1_get_raw(ADC1_CHANNEL_7));
+  RELAYTIMER_PARAM1       = Relay_Timer_From_Pot(adc1_get_raw(ADC1_CHANNEL_6));
   //SENSITIVITY_VALUE       = adc1_get_raw(ADC1_CHANNEL_6);
 
   //RELAYTIMER_PARAM        = analogRead(VariableR);
-  Serial.println((String)"VariableR: " + RELAYTIMER_PARAM);
   //RELAYTIMER_PARAM1       = analogRead(VariableR1);
  // Serial.println((String)"Sensitivity: " + SENSITIVITY_VALUE);
 
-  
-  //uint8_t         RelayTimerArr[9]       = {0, 3, 5, 7, 10, 12, 15, 20, 30};
-  if (RELAYTIMER_PARAM < 500)
-    RELAYTIMER_PARAM = RelayTimerArr[0];
-  else if (RELAYTIMER_PARAM >= 500 && RELAYTIMER_PARAM < 1000)  
-    RELAYTIMER_PARAM = RelayTimerArr[1];
-  else if (RELAYTIMER_PARAM >= 1000 && RELAYTIMER_PARAM < 1500)  
-    RELAYTIMER_PARAM = RelayTimerArr[2];
-  else if (RELAYTIMER_PARAM >= 1500 && RELAYTIMER_PARAM < 2000)  
-    RELAYTIMER_PARAM = RelayTimerArr[3];
-  else if (RELAYTIMER_PARAM >= 2000 && RELAYTIMER_PARAM < 2500)  
-    RELAYTIMER_PARAM = RelayTimerArr[4];
-  else if (RELAYTIMER_PARAM >= 2500 && RELAYTIMER_PARAM < 3000)  
-    RELAYTIMER_PARAM = RelayTimerArr[5];
-  else if (RELAYTIMER_PARAM >= 3000 && RELAYTIMER_PARAM < 3500)  
-    RELAYTIMER_PARAM = RelayTimerArr[6];
-  else if (RELAYTIMER_PARAM >= 3500 && RELAYTIMER_PARAM < 4000)  
-    RELAYTIMER_PARAM = RelayTimerArr[7];
-  else if (RELAYTIMER_PARAM >= 4000)  
-    RELAYTIMER_PARAM = RelayTimerArr[8];                        
-
 //SensitivityTimerArr
 /*
 
@@ -761,6 +504,7 @@ void readDipSwitchVal()
 
   Serial.println((String)"DIRECTION_PARAM: " + DIRECTION_PARAM);
   Serial.println((String)"RELAYTIMER_PARAM: " + RELAYTIMER_PARAM);
+  Serial.println((String)"RELAYTIMER_PARAM1: " + RELAYTIMER_PARAM1);
   Serial.println((String)"RELAYTIMING_PARAM: " + RELAYTIMING_PARAM);
   Serial.println((String)"SENSITIVITY_PARAM: " + SENSITIVITY_PARAM);
   Serial.println((String)"BATTERTLEVEL: " + BATTERYLEVEL_PARAM);
@@ -772,264 +516,114 @@ void readDipSwitchVal()
   Serial.println("Read DipSwitch Mode finished...");
 }
 
-String converter(uint8_t val) {
-  char c_str[2];
-  sprintf(c_str, "%2d", val);
-  return String(c_str);
-}
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////-- Arduino Code--////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void setup() {
+  // Before anything else: after a watchdog, panic or brownout reset put the relay back where it was.
+  Warm_State warm;
+  bool warm_restart = Warm_Restore(warm);
+  if (warm_restart) {
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+      Relay_Channels[i].count = warm.relay_count[i];
+      Relay_Channels[i].on = warm.relay_on[i];
+      Relay_Channels[i].out = warm.relay_out[i];
+      Relay_Channels[i].queued = warm.vehicle_count[i];
+      // Which lane ran an output is not kept over a reset, book it to the output's own lane
+      Relay_Channels[i].queued1 = i == 1 ? Relay_Channels[i].queued : 0;
+      pinMode(Relay_Pins[i], OUTPUT);
+      digitalWrite(Relay_Pins[i], Relay_Channels[i].out ? HIGH : LOW);
+    }
+    Detect_Seq_Restore(warm.detect_synced, warm.detect_next);
+  }
+  unsigned long restored_ms = millis();
+
+  Serial.setRxBufferSize(CONSOLE_RX_RING_SIZE);
   Serial.begin(115200);
   Serial.println("Starting Arduino BLE Client application...");
+  Serial.printf("Reset reason: %s\n", Warm_Reset_Reason());
+  if (warm_restart) {
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+      Serial.printf("Warm restart: relay %u %s, hold %d ticks, %d passes queued\n", i,
+                    Relay_Channels[i].out ? "on" : "off", Relay_Channels[i].count, Relay_Channels[i].queued);
+    }
+  }
 
-#if BLE_COMM
-  BLEDevice::init("");
-#endif
-
-#if UART_COMM
-  Serial2.begin(115200, SERIAL_8N1, RX1, TX1);
-#endif
+  SensorTransport::begin();
+  // Only a power-on restarts the sensor with the controller, after any other reset it is still connected
+  if (!Warm_Power_On())
+    SensorTransport::resume();
 
   delay(500);  
   readDipSwitchVal();
+  Settings_Load();
+  Rules_Begin();
+  // What was held for another operation mode does not apply any more.
+  if (warm_restart && warm.operation_mode != OPERATIONMODE_PARAM)
+    Operation_Mode_Changed();
   delay(500); 
 
-#if BLE_COMM
-  // Retrieve a Scanner and set the callback we want to use to be informed when we
-  // have detected a new device.  
-  // Specify that we want active scanning and start the
-  // scan to run for 5 seconds.
-
-  pBLEScan = BLEDevice::getScan();
-  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
-  pBLEScan->setInterval(1349);
-  pBLEScan->setWindow(449);
-  pBLEScan->setActiveScan(true);
-  //pBLEScan->start(10);
-#endif
-
-  pinMode(RelayPin, OUTPUT);
-  pinMode(RelayLED, OUTPUT);
-  pinMode(ERRLED, OUTPUT);
-  pinMode(PowerLED, OUTPUT);
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++)
+    pinMode(Relay_Pins[i], OUTPUT);
+  Indicator_Attach(IND_RELAY, RelayLED);
+  Indicator_Attach(IND_ERROR, ERRLED);
+  Indicator_Attach(IND_POWER, PowerLED);
+  Indicator_Set(IND_POWER, true);
+  Indicator_Begin();
+
+  Rollup_Begin();
+  if (warm_restart) {
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++)
+      Relay_Output(i, Relay_Channels[i].out);
+  }
 
   delay(1000);  
+
+  // The hold kept running while setup() waited.
+  for (uint8_t i = 0; warm_restart && i < OUTPUT_COUNT; i++) {
+    if (Relay_Channels[i].count > 0)
+      Relay_Channels[i].count = max(0, Relay_Channels[i].count - (int)((millis() - restored_ms) / 100));
+  }
 }
 
 void loop() {
   
-  if (Relay_Count <= 0 && !Relay_On && Vehicle_Count > 0)
-  {
-    Relay_Count = 1 * 10;
-    Serial.println(Relay_Count);
-    Relay_On = true;
-    digitalWrite(RelayPin, HIGH);
-    digitalWrite(RelayLED, HIGH); 
-  } else if (Relay_Count <= 0 && Relay_On)
-  {
-    digitalWrite(RelayPin, LOW);
-    digitalWrite(RelayLED, LOW);
-    Relay_On = false;
-    Vehicle_Count = Vehicle_Count > 0 ? Vehicle_Count - 1 : 0;
-  }
-  else if (Relay_Count > 0) {
-    Serial.printf("[%d] : ", Vehicle_Count);
-    Serial.println(Relay_Count);
-    Relay_Count--;
-  }
-
-#if BLE_COMM
-  // If the flag "doConnect" is true then we have scanned for and found the desired
-  // BLE Server with which we wish to connect.  Now we connect to it.  Once we are 
-  // connected we set the connected flag to be true.
-  if (doConnect == true) {
-    if (connectToServer()) {
-      Serial.println("We are now connected to the BLE Server.");
-    } else {
-      Serial.println("We have failed to connect to the server; there is nothin more we will do.");
-    }
-    doConnect = false;
-  }
-
-  // If we are connected to a peer BLE Server, update the characteristic each time we are reached
-  // with the current time since boot.
-  if (connected) {
-    if (sendParam == false)
-    {
-      delay(500);
-
-      String newValue = (OPERATIONMODE_CMD + ":" + converter(OPERATIONMODE_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      pRemoteCharacteristicRx->writeValue(newValue.c_str(), newValue.length());
-      delay(500);
-
-      newValue = (DIRECTION_CMD + ":" + converter(DIRECTION_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      pRemoteCharacteristicRx->writeValue(newValue.c_str(), newValue.length());
-      delay(500);
-
-      newValue = (RELAYTIMER_CMD + ":" + converter(RELAYTIMER_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      pRemoteCharacteristicRx->writeValue(newValue.c_str(), newValue.length());
-      delay(500);
-
-      newValue = (SENSITIVITY_CMD + ":" + converter(SENSITIVITY_LEVEL_VALUE) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      pRemoteCharacteristicRx->writeValue(newValue.c_str(), newValue.length());
-      delay(500);
-
-      newValue = (DIRECTION_CAT_CMD + ":" + converter(DIRECTION_VALUE) + "\n");
-      //Serial.println("Setting new characteristic value to \"" + DIRECTION_CAT_CMD + ": " + String(DIRECTION_VALUE, BIN) + "\"");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      pRemoteCharacteristicRx->writeValue(newValue.c_str(), newValue.length());
-      delay(500);
-     
-      sendParam = true;
-    }
-  }
-    
-  if(Relay_On)
-  {
-    pBLEScan->stop();
-  } else {
-    if (!connected)
-    {
-      pBLEScan->start(1);  // this is just example to start scan after disconnect, most likely there is better way to do it in arduino
-      delay(50); // Delay a second between loops.
-    }
-  }
-
+  Relay_Tick();
+
+  SensorTransport::poll();
+  Detect_Filter_Poll();
+  Detect_Seq_Poll();
+
+  // Indicators only pick a pattern here, the indicator timer does the blinking.
+  if (SensorTransport::connected()) {
+#if LINK_FAILOVER
+    // Dimmed while the sensor is only reachable over the standby link
+    Indicator_Show(IND_POWER, IND_PRIO_LINK, SensorTransport::active == LINK_BLE ? IND_PAT_DIM : IND_PAT_NONE);
+#else
+    Indicator_Show(IND_POWER, IND_PRIO_LINK, IND_PAT_NONE);
 #endif
-
-#if UART_COMM
-
-  if (connected) {
-    if (sendParam == false)
-    {
-      delay(500);
-
-      String newValue = (OPERATIONMODE_CMD + ":" + converter(OPERATIONMODE_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      Serial2.write(newValue.c_str());
-      delay(500);
-
-      newValue = (DIRECTION_CMD + ":" + converter(DIRECTION_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      Serial2.write(newValue.c_str());
-      delay(500);
-
-      newValue = (RELAYTIMER_CMD + ":" + converter(RELAYTIMER_PARAM) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      Serial2.write(newValue.c_str());
-      delay(500);
-
-      newValue = (SENSITIVITY_CMD + ":" + converter(SENSITIVITY_LEVEL_VALUE) + "\n");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      Serial2.write(newValue.c_str());
-      delay(500);
-
-      newValue = (DIRECTION_CAT_CMD + ":" + converter(DIRECTION_VALUE) + "\n");
-      //Serial.println("Setting new characteristic value to \"" + DIRECTION_CAT_CMD + ": " + String(DIRECTION_VALUE, BIN) + "\"");
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-      Serial2.write(newValue.c_str());
-      delay(500);
-     
-      sendParam = true;
-    }
-  } else {
-    if (Sensor_Started)
-    {
-      Serial.println("send _mobi-ramp msg to sensor\n");    
-      Serial2.write("_mobi-ramp\n");
-      delay(1000);
-    }
-  }
-
-  //Receive UART Msg From mobi-ramp sensor
-  Uart_Msg_Length = Serial2.available();
-
-  if( Uart_Msg_Length > 0 )
-  {
-    char ch;
-    memset(&UART_RX_BUF, 0, UART_RX_BUF_SIZE);
-    for (int i = 0; i < Uart_Msg_Length; i++)
-    {
-      Serial2.read(&ch, 1);
-      UART_RX_BUF[i] = ch;
-    }
-    Serial.printf("received %s from sensor\n", UART_RX_BUF);      
-    String recv_Str = UART_RX_BUF;
-
-    if (!connected)
-    {
-      if (recv_Str.indexOf("start") > -1)
-      {
-        Sensor_Started = true;
-        Serial.printf("Sensor_Started is True\n"); 
-      }
-      else if (recv_Str.indexOf("sensor") > -1)
-      {
-        connected = true;
-        Serial.write("mobi-ramp sensor connected\n");
-      }
-    } else {
-      if (recv_Str.indexOf("start") > -1)
-      {
-        connected = false;
-        sendParam = false;
-        Sensor_Started = true;
-
-        digitalWrite(RelayLED, LOW);
-        digitalWrite(RelayPin, LOW);
-        digitalWrite(ERRLED, LOW);
-        digitalWrite(PowerLED, LOW);
-
-        Serial.printf("Sensor_Started is True\n"); 
-      } else if (recv_Str.indexOf("sensor") == -1)
-      {
-        UART_CMD_PROCESSOR((uint8_t *)&UART_RX_BUF[0], Uart_Msg_Length);
-      }
-    }
-  }
-#endif
-
-  if (!connected) {    
-    if (onoff)
-      digitalWrite(PowerLED, LOW);
+    // Blinks the sensor's error code (99:xx, 98:xx), the first channel's while both have one
+    if (Mobi_Ramp_Sensor0_Error)
+      Indicator_Show(IND_ERROR, IND_PRIO_FAULT, IND_PAT_CODE, SENSORERR_PARAM);
+    else if (Mobi_Ramp_Sensor1_Error)
+      Indicator_Show(IND_ERROR, IND_PRIO_FAULT, IND_PAT_CODE, SENSORERR_PARAM1);
     else
-      digitalWrite(PowerLED, HIGH); 
+      Indicator_Show(IND_ERROR, IND_PRIO_FAULT, IND_PAT_NONE);
   } else {
-    digitalWrite(PowerLED, HIGH);
+    Indicator_Show(IND_POWER, IND_PRIO_LINK, IND_PAT_BLINK_FAST);
+    Indicator_Show(IND_ERROR, IND_PRIO_FAULT, IND_PAT_NONE);
+    if (Mobi_Ramp_Sensor0_Error)
+      Sensor_Error_Set(0, false);
+    if (Mobi_Ramp_Sensor1_Error)
+      Sensor_Error_Set(1, false);
   }
 
-  // Err Function
-  if (connected) {    
-    if(Mobi_Ramp_Sensor0_Error)
-    {
-      if (onoff){
-        digitalWrite(ERRLED, LOW);
-        delay(400);
-      }
-      else{
-        digitalWrite(ERRLED, HIGH);
-        delay(400);
-      }
-      Mobi_Ramp_Sensor0_Error_Flag = true;
-    }
-    else {
-      if(Mobi_Ramp_Sensor0_Error_Flag){
-        digitalWrite(ERRLED, LOW);
-        Mobi_Ramp_Sensor0_Error_Flag = false;
-      }
-    }
-  } else {
-    digitalWrite(ERRLED, LOW);
-    Mobi_Ramp_Sensor0_Error = false;
-  }
+  Rollup_Poll();
+  Console_Poll();
+  Warm_Mirror();
+  Warm_Poll();
+  Fw_Poll();
 
-  onoff = !onoff;
-  delay(100); // Delay a second between loops.
+  Fw_Delay(100); // Delay a second between loops.
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "p2_quantile.h"
+
+P2Quantile::P2Quantile(float p) : p_(p) {
+  reset();
+}
+
+void P2Quantile::reset() {
+  for (int i = 0; i < 5; i++) {
+    q_[i] = 0;
+    n_[i] = i;
+  }
+  np_[0] = 0;
+  np_[1] = 2 * p_;
+  np_[2] = 4 * p_;
+  np_[3] = 2 + 2 * p_;
+  np_[4] = 4;
+  dn_[0] = 0;
+  dn_[1] = p_ / 2;
+  dn_[2] = p_;
+  dn_[3] = (1 + p_) / 2;
+  dn_[4] = 1;
+  count_ = 0;
+}
+
+void P2Quantile::add(float x) {
+  // The first five samples just fill the markers, kept sorted.
+  if (count_ < 5) {
+    int i = count_++;
+    while (i > 0 && q_[i - 1] > x) {
+      q_[i] = q_[i - 1];
+      i--;
+    }
+    q_[i] = x;
+    return;
+  }
+  if (count_ < UINT32_MAX)
+    count_++;
+
+  int k;
+  if (x < q_[0]) {
+    q_[0] = x;
+    k = 0;
+  } else if (x < q_[1]) {
+    k = 0;
+  } else if (x < q_[2]) {
+    k = 1;
+  } else if (x < q_[3]) {
+    k = 2;
+  } else if (x <= q_[4]) {
+    k = 3;
+  } else {
+    q_[4] = x;
+    k = 3;
+  }
+
+  for (int i = k + 1; i < 5; i++)
+    n_[i] += 1;
+  for (int i = 0; i < 5; i++)
+    np_[i] += dn_[i];
+
+  // Move the three middle markers towards their desired positions.
+  for (int i = 1; i <= 3; i++) {
+    float d = np_[i] - n_[i];
+    if ((d >= 1 && n_[i + 1] - n_[i] > 1) || (d <= -1 && n_[i - 1] - n_[i] < -1)) {
+      int ds = d > 0 ? 1 : -1;
+      float qp = parabolic(i, ds);
+      if (q_[i - 1] < qp && qp < q_[i + 1])
+        q_[i] = qp;
+      else
+        q_[i] = linear(i, ds);
+      n_[i] += ds;
+    }
+  }
+}
+
+float P2Quantile::value() const {
+  if (count_ == 0)
+    return 0;
+  if (count_ < 5) {
+    int i = (int)(p_ * (count_ - 1) + 0.5f);
+    return q_[i];
+  }
+  return q_[2];
+}
+
+float P2Quantile::parabolic(int i, float d) const {
+  return q_[i] + d / (n_[i + 1] - n_[i - 1])
+    * ((n_[i] - n_[i - 1] + d) * (q_[i + 1] - q_[i]) / (n_[i + 1] - n_[i])
+     + (n_[i + 1] - n_[i] - d) * (q_[i] - q_[i - 1]) / (n_[i] - n_[i - 1]));
+}
+
+float P2Quantile::linear(int i, int d) const {
+  return q_[i] + d * (q_[i + d] - q_[i]) / (n_[i + d] - n_[i]);
+}
@@ -0,0 +1,322 @@
+/* Traffic rollups per lane, see rollup.h
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "rollup.h"
+
+#define ROLLUP_MAGIC          0x4D525532UL  // "MRU2", bump when the layout changes
+#define MINUTE_MS             60000UL
+#define MINUTES_PER_HOUR      60UL
+#define MINUTES_PER_DAY       1440UL
+
+// NVS chunks of one lane: the minute, hour and day rings in ROLLUP_CHUNK buckets each, then the totals
+#define MINUTE_CHUNKS         ((ROLLUP_MINUTES + ROLLUP_CHUNK - 1) / ROLLUP_CHUNK)
+#define HOUR_CHUNKS           ((ROLLUP_HOURS + ROLLUP_CHUNK - 1) / ROLLUP_CHUNK)
+#define DAY_CHUNKS            ((ROLLUP_DAYS + ROLLUP_CHUNK - 1) / ROLLUP_CHUNK)
+#define FIRST_MINUTE_CHUNK    0
+#define FIRST_HOUR_CHUNK      (FIRST_MINUTE_CHUNK + MINUTE_CHUNKS)
+#define FIRST_DAY_CHUNK       (FIRST_HOUR_CHUNK + HOUR_CHUNKS)
+#define TOTAL_CHUNK           (FIRST_DAY_CHUNK + DAY_CHUNKS)
+#define CHUNKS                (TOTAL_CHUNK + 1)
+
+struct Rollup_Bucket {
+  uint16_t        entries;
+  uint16_t        exits;
+  uint16_t        peak;       // most entries in one minute
+  uint32_t        relay_ms;
+  uint32_t        error_ms;
+};
+
+struct Rollup_Totals {
+  uint32_t        entries;
+  uint32_t        exits;
+  uint32_t        errors;
+  uint16_t        peak;
+  uint64_t        relay_ms;
+  uint64_t        error_ms;
+};
+
+struct Rollup_Lane {
+  Rollup_Bucket   minutes[ROLLUP_MINUTES];
+  Rollup_Bucket   hours[ROLLUP_HOURS];
+  Rollup_Bucket   days[ROLLUP_DAYS];
+  Rollup_Totals   total;
+};
+
+// Everything that goes to NVS
+struct Rollup_Store {
+  uint32_t        minute;     // powered-on minute of the current buckets
+  Rollup_Lane     lanes[ROLLUP_LANES];
+};
+
+static_assert(CHUNKS <= 16, "one dirty bit per chunk");
+
+int                   Rollup_Checkpoint_Min = ROLLUP_CHECKPOINT_MIN;
+
+static Rollup_Store   Store;
+static uint16_t       Dirty[ROLLUP_LANES];          // bit per chunk changed since the last checkpoint
+static bool           Magic_Saved       = false;
+static uint32_t       Current_Minute    = 0;    // powered-on minute, counted on over the millis() wrap
+static uint32_t       Last_Minute_Ms    = 0;    // millis() the current minute started at
+static uint32_t       Last_Account_Ms   = 0;
+static uint32_t       Last_Checkpoint_Ms = 0;
+static bool           Lane_Relay_On[ROLLUP_LANES];
+static bool           Lane_Error_On[ROLLUP_LANES];
+
+static uint32_t Minute_Index() { return Store.minute % ROLLUP_MINUTES; }
+static uint32_t Hour_Index()   { return (Store.minute / MINUTES_PER_HOUR) % ROLLUP_HOURS; }
+static uint32_t Day_Index()    { return (Store.minute / MINUTES_PER_DAY) % ROLLUP_DAYS; }
+
+static Rollup_Bucket& Minute_Bucket(Rollup_Lane& l) { return l.minutes[Minute_Index()]; }
+static Rollup_Bucket& Hour_Bucket(Rollup_Lane& l)   { return l.hours[Hour_Index()]; }
+static Rollup_Bucket& Day_Bucket(Rollup_Lane& l)    { return l.days[Day_Index()]; }
+
+// The current buckets and the totals of a lane changed
+static void Mark_Current(uint8_t lane) {
+  Dirty[lane] |= (1u << (FIRST_MINUTE_CHUNK + Minute_Index() / ROLLUP_CHUNK))
+               | (1u << (FIRST_HOUR_CHUNK + Hour_Index() / ROLLUP_CHUNK))
+               | (1u << (FIRST_DAY_CHUNK + Day_Index() / ROLLUP_CHUNK))
+               | (1u << TOTAL_CHUNK);
+}
+
+// Empties a bucket a ring rotates into, it only counts as a change if there was something in it
+static void Clear_Bucket(uint8_t lane, Rollup_Bucket& b, uint8_t first_chunk, uint32_t index) {
+  static const Rollup_Bucket empty = {};
+  if (memcmp(&b, &empty, sizeof(b)) == 0)
+    return;
+  b = empty;
+  Dirty[lane] |= 1u << (first_chunk + index / ROLLUP_CHUNK);
+}
+
+static void* Chunk_Data(uint8_t lane, uint8_t chunk, size_t& length) {
+  Rollup_Lane&    l = Store.lanes[lane];
+  Rollup_Bucket*  ring;
+  uint32_t        count;
+
+  if (chunk == TOTAL_CHUNK) {
+    length = sizeof(l.total);
+    return &l.total;
+  }
+  if (chunk < FIRST_HOUR_CHUNK) {
+    ring = l.minutes;
+    count = ROLLUP_MINUTES;
+    chunk -= FIRST_MINUTE_CHUNK;
+  } else if (chunk < FIRST_DAY_CHUNK) {
+    ring = l.hours;
+    count = ROLLUP_HOURS;
+    chunk -= FIRST_HOUR_CHUNK;
+  } else {
+    ring = l.days;
+    count = ROLLUP_DAYS;
+    chunk -= FIRST_DAY_CHUNK;
+  }
+  uint32_t start = (uint32_t)chunk * ROLLUP_CHUNK;
+  length = min((uint32_t)ROLLUP_CHUNK, count - start) * sizeof(Rollup_Bucket);
+  return ring + start;
+}
+
+static void Chunk_Key(uint8_t lane, uint8_t chunk, char* key) {
+  snprintf(key, 8, "c%u_%u", lane, chunk);
+}
+
+static void Rollup_Account(uint32_t now) {
+  uint32_t elapsed = now - Last_Account_Ms;
+  Last_Account_Ms = now;
+
+  for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+    Rollup_Lane& l = Store.lanes[lane];
+    if ((Lane_Relay_On[lane] || Lane_Error_On[lane]) && elapsed > 0)
+      Mark_Current(lane);
+    if (Lane_Relay_On[lane]) {
+      Minute_Bucket(l).relay_ms += elapsed;
+      Hour_Bucket(l).relay_ms += elapsed;
+      Day_Bucket(l).relay_ms += elapsed;
+      l.total.relay_ms += elapsed;
+    }
+    if (Lane_Error_On[lane]) {
+      Minute_Bucket(l).error_ms += elapsed;
+      Hour_Bucket(l).error_ms += elapsed;
+      Day_Bucket(l).error_ms += elapsed;
+      l.total.error_ms += elapsed;
+    }
+  }
+}
+
+static void Rollup_Rotate(uint32_t minute) {
+  // A skipped stretch longer than all rings only has to clear each bucket once.
+  if (minute - Store.minute > ROLLUP_DAYS * MINUTES_PER_DAY)
+    Store.minute = minute - ROLLUP_DAYS * MINUTES_PER_DAY;
+
+  while (Store.minute != minute) {
+    Store.minute++;
+    for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+      Rollup_Lane& l = Store.lanes[lane];
+      Clear_Bucket(lane, Minute_Bucket(l), FIRST_MINUTE_CHUNK, Minute_Index());
+      if (Store.minute % MINUTES_PER_HOUR == 0)
+        Clear_Bucket(lane, Hour_Bucket(l), FIRST_HOUR_CHUNK, Hour_Index());
+      if (Store.minute % MINUTES_PER_DAY == 0)
+        Clear_Bucket(lane, Day_Bucket(l), FIRST_DAY_CHUNK, Day_Index());
+    }
+  }
+}
+
+void Rollup_Begin() {
+  Preferences prefs;
+  bool        valid;
+
+  memset(&Store, 0, sizeof(Store));
+  Current_Minute = 0;
+  prefs.begin("rollup", false);
+  valid = prefs.getUInt("magic", 0) == ROLLUP_MAGIC;
+  if (valid) {
+    Store.minute = prefs.getUInt("minute", 0);
+    for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+      for (uint8_t chunk = 0; chunk < CHUNKS; chunk++) {
+        char    key[8];
+        size_t  length;
+        void*   data = Chunk_Data(lane, chunk, length);
+        Chunk_Key(lane, chunk, key);
+        // A chunk that was never written stays empty
+        if (prefs.isKey(key) && prefs.getBytes(key, data, length) != length)
+          memset(data, 0, length);
+      }
+    }
+  } else {
+    // Older layouts, including the single "store" blob
+    prefs.clear();
+  }
+  prefs.end();
+  Magic_Saved = valid;
+
+  if (!valid) {
+    Serial.println("Rollups: no checkpoint, starting empty");
+  } else {
+    // Continue in a fresh minute after the one the checkpoint was taken in.
+    Current_Minute = Store.minute + 1;
+    Serial.printf("Rollups: restored checkpoint from minute %lu\n", (unsigned long)Store.minute);
+    Rollup_Rotate(Current_Minute);
+  }
+
+  Last_Account_Ms = millis();
+  Last_Minute_Ms = Last_Account_Ms;
+  Last_Checkpoint_Ms = Last_Account_Ms;
+}
+
+void Rollup_Poll() {
+  uint32_t now = millis();
+
+  Rollup_Account(now);
+  // Unsigned differences, so the minutes keep counting on when millis() wraps after 49.7 days
+  uint32_t minutes = (now - Last_Minute_Ms) / MINUTE_MS;
+  if (minutes > 0) {
+    Current_Minute += minutes;
+    Last_Minute_Ms += minutes * MINUTE_MS;
+    Rollup_Rotate(Current_Minute);
+  }
+
+  if (now - Last_Checkpoint_Ms >= (uint32_t)Rollup_Checkpoint_Min * MINUTE_MS)
+    Rollup_Checkpoint();
+}
+
+void Rollup_Detect(uint8_t lane, uint8_t detect) {
+  if (lane >= ROLLUP_LANES)
+    return;
+  Rollup_Lane& l = Store.lanes[lane];
+
+  Mark_Current(lane);
+  if (detect == 1) {
+    uint16_t per_min = ++Minute_Bucket(l).entries;
+    Minute_Bucket(l).peak = per_min;
+    Hour_Bucket(l).entries++;
+    Hour_Bucket(l).peak = max(Hour_Bucket(l).peak, per_min);
+    Day_Bucket(l).entries++;
+    Day_Bucket(l).peak = max(Day_Bucket(l).peak, per_min);
+    l.total.entries++;
+    l.total.peak = max(l.total.peak, per_min);
+  } else {
+    Minute_Bucket(l).exits++;
+    Hour_Bucket(l).exits++;
+    Day_Bucket(l).exits++;
+    l.total.exits++;
+  }
+}
+
+void Rollup_Relay(uint8_t lane, bool on) {
+  if (lane >= ROLLUP_LANES)
+    return;
+  Rollup_Account(millis());
+  Lane_Relay_On[lane] = on;
+}
+
+void Rollup_Error(uint8_t lane, bool active) {
+  if (lane >= ROLLUP_LANES)
+    return;
+  Rollup_Account(millis());
+  if (active && !Lane_Error_On[lane]) {
+    Store.lanes[lane].total.errors++;
+    Dirty[lane] |= 1u << TOTAL_CHUNK;
+  }
+  Lane_Error_On[lane] = active;
+}
+
+static void Rollup_Print_Ring(uint8_t lane, char name, const Rollup_Bucket* ring, uint32_t count, uint32_t current) {
+  // Newest first, the empty tail is left out.
+  uint32_t used = count;
+  while (used > 0) {
+    const Rollup_Bucket& b = ring[(current + count - (used - 1)) % count];
+    if (b.entries || b.exits || b.relay_ms || b.error_ms)
+      break;
+    used--;
+  }
+
+  Serial.printf("@RU,%u,%c,", lane, name);
+  for (uint32_t i = 0; i < used; i++) {
+    const Rollup_Bucket& b = ring[(current + count - i) % count];
+    Serial.printf("%s%u/%u/%u/%lu/%lu", i ? ";" : "", b.entries, b.exits, b.peak,
+                  (unsigned long)(b.relay_ms / 1000), (unsigned long)(b.error_ms / 1000));
+  }
+  Serial.println();
+}
+
+void Rollup_Print() {
+  Rollup_Poll();
+
+  for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+    const Rollup_Lane& l = Store.lanes[lane];
+    Rollup_Print_Ring(lane, 'm', l.minutes, ROLLUP_MINUTES, Store.minute % ROLLUP_MINUTES);
+    Rollup_Print_Ring(lane, 'h', l.hours, ROLLUP_HOURS, (Store.minute / MINUTES_PER_HOUR) % ROLLUP_HOURS);
+    Rollup_Print_Ring(lane, 'd', l.days, ROLLUP_DAYS, (Store.minute / MINUTES_PER_DAY) % ROLLUP_DAYS);
+    Serial.printf("@RU,%u,t,%lu/%lu/%u/%lu/%lu/%lu\n", lane, (unsigned long)l.total.entries,
+                  (unsigned long)l.total.exits, l.total.peak, (unsigned long)(l.total.relay_ms / 1000),
+                  (unsigned long)(l.total.error_ms / 1000), (unsigned long)l.total.errors);
+  }
+  Serial.printf("@RU,END,%lu\n", (unsigned long)Store.minute);
+}
+
+// Writes the minute counter and the chunks that changed since the last checkpoint
+void Rollup_Checkpoint() {
+  Preferences prefs;
+
+  Rollup_Account(millis());
+  Last_Checkpoint_Ms = millis();
+  if (!prefs.begin("rollup", false))
+    return;
+  for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+    for (uint8_t chunk = 0; Dirty[lane] != 0 && chunk < CHUNKS; chunk++) {
+      if (!(Dirty[lane] & (1u << chunk)))
+        continue;
+      char    key[8];
+      size_t  length;
+      void*   data = Chunk_Data(lane, chunk, length);
+      Chunk_Key(lane, chunk, key);
+      if (prefs.putBytes(key, data, length) == length)
+        Dirty[lane] &= (uint16_t)~(1u << chunk);
+    }
+  }
+  prefs.putUInt("minute", Store.minute);
+  // Last, so a checkpoint cut short by a reset is not taken for a complete one the first time
+  if (!Magic_Saved)
+    Magic_Saved = prefs.putUInt("magic", ROLLUP_MAGIC) == sizeof(uint32_t);
+  prefs.end();
+}
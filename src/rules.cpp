@@ -0,0 +1,206 @@
+/* Operation mode rules, see rules.h
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "controller.h"
+#include "rules.h"
+
+struct Rule {
+  uint8_t         mode;
+  uint8_t         edge;       // RULE_EDGE_*
+  uint8_t         action;     // RULE_*
+};
+
+// The operation modes as shipped
+static const Rule Rules_Builtin[] = {
+  {0, RULE_EDGE_TRIGGER, RULE_HOLD},   // 경광등: the relay timer from the selected edge
+  {1, RULE_EDGE_IN,      RULE_ON},     // 차단봉: the relay follows the detection
+  {1, RULE_EDGE_OUT,     RULE_OFF},
+  {2, RULE_EDGE_TRIGGER, RULE_PULSE},  // 카운터: one pulse per pass
+  {3, RULE_EDGE_TRIGGER, RULE_PULSE},
+};
+
+#define RULES_BUILTIN_COUNT   (sizeof(Rules_Builtin) / sizeof(Rules_Builtin[0]))
+
+static const char* const Edge_Names[]   = {"in", "out", "trigger", "release"};
+static const char* const Action_Names[] = {"none", "hold", "on", "off", "pulse"};
+
+#define EDGE_COUNT      (sizeof(Edge_Names) / sizeof(Edge_Names[0]))
+#define ACTION_COUNT    (sizeof(Action_Names) / sizeof(Action_Names[0]))
+
+uint8_t         Rule_Flat[RULE_LANES][2];
+
+static Rule     Rules[RULES_MAX];
+static size_t   Rule_Count = 0;
+
+static void Rules_Default() {
+  memcpy(Rules, Rules_Builtin, sizeof(Rules_Builtin));
+  Rule_Count = RULES_BUILTIN_COUNT;
+}
+
+// Whether a rule's edge covers a detection on a lane with the given relaytiming
+static bool Rule_Matches(const Rule& r, uint8_t detect, uint8_t timing) {
+  // relaytiming 0 triggers on 00:01, 1 on 00:00
+  bool trigger = detect != timing;
+  switch (r.edge) {
+    case RULE_EDGE_IN:      return detect == 1;
+    case RULE_EDGE_OUT:     return detect == 0;
+    case RULE_EDGE_TRIGGER: return trigger;
+    case RULE_EDGE_RELEASE: return !trigger;
+  }
+  return false;
+}
+
+void Rules_Compile() {
+  for (uint8_t lane = 0; lane < RULE_LANES; lane++) {
+    uint8_t timing = lane == 0 ? RELAYTIMING_PARAM : RELAYTIMING_PARAM1;
+    for (uint8_t detect = 0; detect < 2; detect++) {
+      uint8_t action = RULE_NONE;
+      for (size_t i = 0; i < Rule_Count; i++) {
+        if (Rules[i].mode == OPERATIONMODE_PARAM && Rule_Matches(Rules[i], detect, timing))
+          action = Rules[i].action;
+      }
+      Rule_Flat[lane][detect] = action;
+    }
+  }
+}
+
+#if RULES_RUNTIME
+static bool Rule_Valid(const Rule& r) {
+  return r.mode < RULE_MODES && r.edge < EDGE_COUNT && r.action < ACTION_COUNT;
+}
+
+static bool Rules_Load() {
+  Preferences prefs;
+  Rule        loaded[RULES_MAX];
+
+  if (!prefs.begin("rules", true))
+    return false;
+  size_t length = prefs.isKey("table") ? prefs.getBytesLength("table") : 0;
+  if (length > 0 && length <= sizeof(loaded) && length % sizeof(Rule) == 0)
+    prefs.getBytes("table", loaded, length);
+  else
+    length = 0;
+  prefs.end();
+
+  size_t count = length / sizeof(Rule);
+  for (size_t i = 0; i < count; i++) {
+    if (!Rule_Valid(loaded[i]))
+      return false;
+  }
+  if (count == 0)
+    return false;
+  memcpy(Rules, loaded, length);
+  Rule_Count = count;
+  return true;
+}
+
+static bool Rules_Save() {
+  Preferences prefs;
+
+  if (!prefs.begin("rules", false))
+    return false;
+  bool ok = prefs.putBytes("table", Rules, Rule_Count * sizeof(Rule)) == Rule_Count * sizeof(Rule);
+  prefs.end();
+  return ok;
+}
+
+static bool Rules_Forget() {
+  Preferences prefs;
+
+  if (!prefs.begin("rules", false))
+    return false;
+  bool ok = prefs.clear();
+  prefs.end();
+  return ok;
+}
+#endif
+
+void Rules_Begin() {
+  Rules_Default();
+#if RULES_RUNTIME
+  if (Rules_Load())
+    Serial.printf("Rules: %u from NVS\n", (unsigned)Rule_Count);
+#endif
+  Rules_Compile();
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Console command
+/////////////////////////////////////////////////////////////////////////
+
+#if RULES_RUNTIME
+static int Name_Index(const char* const* names, size_t count, const char* name) {
+  for (size_t i = 0; name != nullptr && i < count; i++) {
+    if (strcmp(name, names[i]) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+#endif
+
+// @RULE,<index>,<mode>,<edge>,<action>
+static void Rules_List() {
+  for (size_t i = 0; i < Rule_Count; i++)
+    Serial.printf("@RULE,%u,%u,%s,%s\n", (unsigned)i, Rules[i].mode, Edge_Names[Rules[i].edge],
+                  Action_Names[Rules[i].action]);
+}
+
+// rule list|add <mode> <edge> <action>|del <index>|reset|save
+void Rules_Command(char* args) {
+  char* save;
+  char* sub = strtok_r(args, " ", &save);
+
+  if (sub == nullptr || strcmp(sub, "list") == 0) {
+    Rules_List();
+    Serial.println("@OK");
+    return;
+  }
+#if RULES_RUNTIME
+  if (strcmp(sub, "add") == 0) {
+    char* mode = strtok_r(nullptr, " ", &save);
+    int   edge = Name_Index(Edge_Names, EDGE_COUNT, strtok_r(nullptr, " ", &save));
+    int   action = Name_Index(Action_Names, ACTION_COUNT, strtok_r(nullptr, " ", &save));
+    if (mode == nullptr || mode[0] < '0' || mode[0] >= '0' + RULE_MODES || mode[1] != '\0' || edge < 0 ||
+        action < 0) {
+      Serial.println("@ERR,usage: rule add <0..3> <in|out|trigger|release> <none|hold|on|off|pulse>");
+      return;
+    }
+    if (Rule_Count == RULES_MAX) {
+      Serial.println("@ERR,rule table full");
+      return;
+    }
+    Rules[Rule_Count++] = {(uint8_t)(mode[0] - '0'), (uint8_t)edge, (uint8_t)action};
+  } else if (strcmp(sub, "del") == 0) {
+    char* text = strtok_r(nullptr, " ", &save);
+    char* end;
+    long  index = text != nullptr ? strtol(text, &end, 10) : -1;
+    if (text == nullptr || end == text || *end != '\0' || index < 0 || (size_t)index >= Rule_Count) {
+      Serial.printf("@ERR,index must be 0..%d\n", (int)Rule_Count - 1);
+      return;
+    }
+    memmove(&Rules[index], &Rules[index + 1], (Rule_Count - index - 1) * sizeof(Rule));
+    Rule_Count--;
+  } else if (strcmp(sub, "reset") == 0) {
+    // Back to the built-in table, also at the next boot
+    Rules_Default();
+    if (!Rules_Forget()) {
+      Rules_Compile();
+      Serial.println("@ERR,NVS write failed");
+      return;
+    }
+  } else if (strcmp(sub, "save") == 0) {
+    Serial.println(Rules_Save() ? "@OK" : "@ERR,NVS write failed");
+    return;
+  } else {
+    Serial.printf("@ERR,unknown rule command %s\n", sub);
+    return;
+  }
+  Rules_Compile();
+  Rules_List();
+  Serial.println("@OK");
+#else
+  Serial.println("@ERR,rules are fixed in this build");
+#endif
+}
@@ -0,0 +1,113 @@
+/* Controller side of the sensor link: the parameter push and frames in, see controller.h
+ *
+ * What a frame means is main.cpp's (Sensor_Frame); this file paces the parameters out to each transport and splits
+ * what the transports deliver into frames.
+ */
+
+#include <Arduino.h>
+#include "controller.h"
+#include "transport.h"
+
+/////////////////////////////////////////////////////////////////////////
+//Sensor parameters, pushed to the sensor after every handshake
+/////////////////////////////////////////////////////////////////////////
+
+static String Sensor_Param_Frame(uint8_t index) {
+  switch (index) {
+    case SENSOR_PARAM_OPERATIONMODE:  return OPERATIONMODE_CMD + ":" + converter(OPERATIONMODE_PARAM) + "\n";
+    case SENSOR_PARAM_DIRECTION:      return DIRECTION_CMD + ":" + converter(DIRECTION_PARAM) + "\n";
+    case SENSOR_PARAM_RELAYTIMER:     return RELAYTIMER_CMD + ":" + converter(RELAYTIMER_PARAM) + "\n";
+    case SENSOR_PARAM_SENSITIVITY:    return SENSITIVITY_CMD + ":" + converter(SENSITIVITY_LEVEL_VALUE) + "\n";
+    case SENSOR_PARAM_DIRECTION1:     return DIRECTION1_CMD + ":" + converter(DIRECTION_PARAM1) + "\n";
+    case SENSOR_PARAM_RELAYTIMER1:    return RELAYTIMER1_CMD + ":" + converter(RELAYTIMER_PARAM1) + "\n";
+    case SENSOR_PARAM_BATCH:          return BATCHWINDOW_CMD + ":" + converter(BATCHWINDOW_PARAM) + "\n";
+    default:                          return DIRECTION_CAT_CMD + ":" + converter(DIRECTION_VALUE) + "\n";
+  }
+}
+
+static Param_Push*  Param_Pushes[PARAM_PUSH_MAX];
+static uint8_t      Param_Push_Count        = 0;
+
+// The second channel's parameters only go out while the sensor runs both channels. The batch window only to a
+// sensor that batches: UART and older BLE sensor firmware do not know 23.
+uint8_t Sensor_Param_Mask(const Param_Push& push) {
+  uint8_t mask = push.batch ? SENSOR_PARAM_ALL | (1u << SENSOR_PARAM_BATCH) : SENSOR_PARAM_ALL;
+  return TWOCHANNLEMODE_PARAM == 1 ? mask | SENSOR_PARAM_CH2 : mask;
+}
+
+void Param_Push_Start(Param_Push& push) {
+  push.pending = Sensor_Param_Mask(push);
+  push.last_ms = millis();
+
+  for (uint8_t i = 0; i < Param_Push_Count; i++) {
+    if (Param_Pushes[i] == &push)
+      return;
+  }
+  if (Param_Push_Count < PARAM_PUSH_MAX)
+    Param_Pushes[Param_Push_Count++] = &push;
+}
+
+void Param_Push_Changed(uint8_t mask) {
+  for (uint8_t i = 0; i < Param_Push_Count; i++)
+    Param_Pushes[i]->pending |= mask & Sensor_Param_Mask(*Param_Pushes[i]);
+}
+
+// Sends the next pending parameter once PARAM_PUSH_INTERVAL_MS has passed, returns true when all are through.
+bool Param_Push_Step(Param_Push& push, size_t (*write)(const char* data, size_t length)) {
+  if (millis() - push.last_ms < PARAM_PUSH_INTERVAL_MS)
+    return false;
+  if (push.pending == 0)
+    return true;
+  push.last_ms = millis();
+
+  uint8_t index = 0;
+  while (!(push.pending & (1u << index)))
+    index++;
+  push.pending &= (uint8_t)~(1u << index);
+
+  String newValue = Sensor_Param_Frame(index);
+  Serial.println("Setting new characteristic value to \"" + newValue + "\"");
+  write(newValue.c_str(), newValue.length());
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Frames from the transports
+/////////////////////////////////////////////////////////////////////////
+
+void Sensor_Receive(uint8_t link, const uint8_t* pData, size_t length)
+{
+  int32_t ack = -1;
+
+  // Standby link in a failover build: the active link delivers the same events.
+  if (!SensorTransport::accepts(link))
+    return;
+  Sensor_Frame(link, pData, length, ack);
+  if (ack >= 0)
+    Detect_Ack((uint16_t)ack);
+}
+
+// A BLE notification carries as many frames as the sensor gathered within BATCHWINDOW_PARAM, each ended by '\n'.
+// They are handed on in place, the notification is not a C string. The batch is answered with one ack.
+size_t Sensor_Receive_Batch(uint8_t link, const uint8_t* pData, size_t length)
+{
+  size_t  frames = 0;
+  size_t  start = 0;
+  int32_t ack = -1;
+
+  if (!SensorTransport::accepts(link))
+    return 0;
+  for (size_t i = 0; i <= length; i++) {
+    if (i < length && pData[i] != '\n' && pData[i] != '\r' && pData[i] != '\0')
+      continue;
+    if (i > start) {
+      Sensor_Frame(link, pData + start, i - start, ack);
+      frames++;
+    }
+    start = i + 1;
+  }
+
+  if (ack >= 0)
+    Detect_Ack((uint16_t)ack);
+  return frames;
+}
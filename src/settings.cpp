@@ -0,0 +1,184 @@
+/* Operating parameters at runtime, see settings.h
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "controller.h"
+#include "settings.h"
+#include "detect_filter.h"
+#include "rules.h"
+#include "rollup.h"
+
+struct Setting {
+  const char*     name;       // also the NVS key, at most 15 characters
+  uint8_t*        u8;         // one of u8/value points at the parameter
+  int*            value;
+  int             min;
+  int             max;
+  uint8_t         push;       // SENSOR_PARAM_* bits pushed to the sensor on a change, 0: controller only
+  bool            reset;      // changes how detections drive the relays, restarts them
+};
+
+#define PUSH(p)   (1u << (p))
+
+static const Setting Settings[] = {
+  {"operationmode", &OPERATIONMODE_PARAM,  nullptr,                  0, 3,     PUSH(SENSOR_PARAM_OPERATIONMODE), true},
+  {"direction",     &DIRECTION_PARAM,      nullptr,                  0, 1,     PUSH(SENSOR_PARAM_DIRECTION),     false},
+  {"relaytiming",   &RELAYTIMING_PARAM,    nullptr,                  0, 1,     0,                                false},
+  {"relaytimer",    nullptr,               &RELAYTIMER_PARAM,        0, 99,    PUSH(SENSOR_PARAM_RELAYTIMER),    false},
+  {"sensitivity",   nullptr,               &SENSITIVITY_LEVEL_VALUE, 0, 3,     PUSH(SENSOR_PARAM_SENSITIVITY),   false},
+  {"direction_cat", nullptr,               &DIRECTION_VALUE,         0, 3,     PUSH(SENSOR_PARAM_DIRECTION_CAT), false},
+  {"twochannel",    &TWOCHANNLEMODE_PARAM, nullptr,                  0, 1,     SENSOR_PARAM_CH2,                 true},
+  {"twoinone",      &TWOINONEMODE_PARAM,   nullptr,                  0, 1,     0,                                true},
+  {"direction1",    &DIRECTION_PARAM1,     nullptr,                  0, 1,     PUSH(SENSOR_PARAM_DIRECTION1),    false},
+  {"relaytiming1",  &RELAYTIMING_PARAM1,   nullptr,                  0, 1,     0,                                false},
+  {"relaytimer1",   nullptr,               &RELAYTIMER_PARAM1,       0, 99,    PUSH(SENSOR_PARAM_RELAYTIMER1),   false},
+  {"filter_on_ms",  nullptr,               &Filter_Min_On_Ms,        0, 5000,  0,                                false},
+  {"filter_off_ms", nullptr,               &Filter_Min_Off_Ms,       0, 5000,  0,                                false},
+  {"refractory_ms", nullptr,               &Filter_Refractory_Ms,    0, 10000, 0,                                false},
+  {"frame_log",     nullptr,               &Frame_Log,               0, 1,     0,                                false},
+  {"batch_ms",      nullptr,               &BATCHWINDOW_PARAM,       0, 250,   PUSH(SENSOR_PARAM_BATCH),         false},
+  {"rollup_ckpt_min", nullptr,             &Rollup_Checkpoint_Min,   1, 1440,  0,                                false},
+};
+
+#define SETTING_COUNT   (sizeof(Settings) / sizeof(Settings[0]))
+
+static int Setting_Read(const Setting& s) {
+  return s.u8 != nullptr ? *s.u8 : *s.value;
+}
+
+static void Setting_Write(const Setting& s, int v) {
+  if (s.u8 != nullptr)
+    *s.u8 = (uint8_t)v;
+  else
+    *s.value = v;
+}
+
+static const Setting* Setting_Find(const char* name) {
+  for (size_t i = 0; i < SETTING_COUNT; i++) {
+    if (strcmp(name, Settings[i].name) == 0)
+      return &Settings[i];
+  }
+  return nullptr;
+}
+
+static void Setting_Print(const Setting& s) {
+  Serial.printf("@PARAM,%s,%d,%d,%d\n", s.name, Setting_Read(s), s.min, s.max);
+}
+
+void Settings_Load() {
+  Preferences prefs;
+
+  if (!prefs.begin("settings", true))
+    return;
+  for (size_t i = 0; i < SETTING_COUNT; i++) {
+    const Setting& s = Settings[i];
+    if (!prefs.isKey(s.name))
+      continue;
+    int v = prefs.getInt(s.name, Setting_Read(s));
+    if (v < s.min || v > s.max)
+      continue;
+    Setting_Write(s, v);
+    Serial.printf("%s = %d (saved, overrides the switches)\n", s.name, v);
+  }
+  prefs.end();
+}
+
+bool Settings_Save() {
+  Preferences prefs;
+
+  if (!prefs.begin("settings", false))
+    return false;
+  for (size_t i = 0; i < SETTING_COUNT; i++)
+    prefs.putInt(Settings[i].name, Setting_Read(Settings[i]));
+  prefs.end();
+  return true;
+}
+
+bool Settings_Clear() {
+  Preferences prefs;
+
+  if (!prefs.begin("settings", false))
+    return false;
+  bool ok = prefs.clear();
+  prefs.end();
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Console commands
+/////////////////////////////////////////////////////////////////////////
+
+void Settings_Get(char* args) {
+  const Setting* s = Setting_Find(args);
+  if (s == nullptr) {
+    Serial.printf("@ERR,unknown parameter %s\n", args);
+    return;
+  }
+  Setting_Print(*s);
+}
+
+void Settings_List(char* args) {
+  for (size_t i = 0; i < SETTING_COUNT; i++)
+    Setting_Print(Settings[i]);
+}
+
+// set <name> <value> [<name> <value> ...]: everything is checked before anything is applied.
+void Settings_Set(char* args) {
+  const Setting*  target[SETTINGS_MAX_SET];
+  int             value[SETTINGS_MAX_SET];
+  size_t          count = 0;
+  char*           save;
+
+  for (char* name = strtok_r(args, " ", &save); name != nullptr; name = strtok_r(nullptr, " ", &save)) {
+    char* text = strtok_r(nullptr, " ", &save);
+    if (text == nullptr) {
+      Serial.printf("@ERR,no value for %s\n", name);
+      return;
+    }
+    if (count == SETTINGS_MAX_SET) {
+      Serial.println("@ERR,too many parameters");
+      return;
+    }
+
+    const Setting* s = Setting_Find(name);
+    if (s == nullptr) {
+      Serial.printf("@ERR,unknown parameter %s\n", name);
+      return;
+    }
+    char* end;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || v < s->min || v > s->max) {
+      Serial.printf("@ERR,%s must be %d..%d\n", name, s->min, s->max);
+      return;
+    }
+    target[count] = s;
+    value[count] = (int)v;
+    count++;
+  }
+  if (count == 0) {
+    Serial.println("@ERR,usage: set <name> <value> ...");
+    return;
+  }
+
+  uint8_t sensor_changed = 0;
+  bool    mode_changed = false;
+  for (size_t i = 0; i < count; i++) {
+    if (Setting_Read(*target[i]) == value[i])
+      continue;
+    Setting_Write(*target[i], value[i]);
+    sensor_changed |= target[i]->push;
+    if (target[i]->reset)
+      mode_changed = true;
+  }
+
+  Rules_Compile();
+  if (mode_changed)
+    Operation_Mode_Changed();
+  if (sensor_changed)
+    Param_Push_Changed(sensor_changed);
+
+  for (size_t i = 0; i < count; i++)
+    Setting_Print(*target[i]);
+  Serial.println("@OK");
+}
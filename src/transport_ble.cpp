@@ -0,0 +1,339 @@
+/* Sensor link over BLE, central mode (client) Nordic UART Service
+ *
+ * Scans for the sensor's advertised NUS service, connects, turns notifications on for the TX characteristic and
+ * writes to the RX characteristic. See the header of main.cpp for the client/server roles.
+ *
+ * Copyright <2018> <Josh Campbell>
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions: The above copyright
+ * notice and this permission notice shall be included in all copies or substantial portions of the Software. THE
+ * SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "transport.h"
+
+#if BLE_COMM && !BLE_NIMBLE
+
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+#include <BLEScan.h>
+#include <freertos/ringbuf.h>
+
+#define BLE_SENSOR_NAME       "[intervoid]mobi-ramp_01"
+
+// The remote service we wish to connect to.
+static BLEUUID serviceUUID("6e400001-b5a3-f393-e0a9-e50e24dcca9e");
+// The characteristic of the remote service we are interested in.
+static BLEUUID readUUID("6e400002-b5a3-f393-e0a9-e50e24dcca9e");
+static BLEUUID charUUID("6e400003-b5a3-f393-e0a9-e50e24dcca9e");
+
+static const uint8_t            notificationOn[]  = {0x1, 0x0};
+
+static boolean                  Ble_Do_Connect    = false;
+static boolean                  Ble_Connected     = false;
+static volatile boolean         Ble_Disconnected  = false;
+static boolean                  Ble_Sensor_Batch  = false;  // advertises BLE_CAP_BATCH
+static boolean                  Ble_Param_Sent    = false;
+static boolean                  Ble_Scanning      = false;
+static BLEClient*               pClient;
+static BLERemoteCharacteristic* pRemoteCharacteristic;
+static BLERemoteCharacteristic* pRemoteCharacteristicRx;
+static BLEAdvertisedDevice*     myDevice;
+static BLEScan*                 pBLEScan;
+static Param_Push               Ble_Push;
+static volatile unsigned long   Ble_Rx_Last_Ms    = 0;
+static Ble_Stats                Ble_Stat;
+static RingbufHandle_t          Ble_Rx_Ring       = nullptr;
+static uint8_t                  Ble_Tx_Credits    = BLE_TX_CREDITS;
+static unsigned long            Ble_Tx_Credit_Ms  = 0;
+
+static void notifyCallback(
+  BLERemoteCharacteristic* pBLERemoteCharacteristic,
+  uint8_t* pData,
+  size_t length,
+  bool isNotify)
+  {
+    if (Ble_Param_Sent == false)
+      return;
+
+    Ble_Rx_Last_Ms = millis();
+    // BLE host task: queue it, Ble_Receive() runs the frames from loop()
+    if (xRingbufferSend(Ble_Rx_Ring, pData, length, 0) != pdTRUE)
+      Ble_Stat.rx_dropped++;
+}
+
+// Hands the queued notifications on, from poll()
+static void Ble_Receive() {
+  size_t  length;
+  void*   item;
+
+  while ((item = xRingbufferReceive(Ble_Rx_Ring, &length, 0)) != nullptr) {
+    Ble_Stat.notifications++;
+    Ble_Stat.frames += Sensor_Receive_Batch(LINK_BLE, (const uint8_t*)item, length);
+    vRingbufferReturnItem(Ble_Rx_Ring, item);
+  }
+}
+
+class MyClientCallback : public BLEClientCallbacks {
+  void onConnect(BLEClient* pclient) {
+    Serial.println("Connected to device 1");
+  }
+
+  void onDisconnect(BLEClient* pclient) {
+    Ble_Connected = false;
+    Ble_Param_Sent = false;
+    Serial.println("onDisconnect");
+    // BLE host task: poll() reports it from loop()
+    Ble_Disconnected = true;
+  }
+};
+
+bool connectToServer() {
+    unsigned long start_ms = millis();
+    uint32_t heap_before = ESP.getFreeHeap();
+
+    Serial.print("Forming a connection to ");
+    Serial.println(myDevice->getAddress().toString().c_str());
+
+    if (pClient == nullptr) {
+      pClient = BLEDevice::createClient();
+      pClient->setClientCallbacks(new MyClientCallback());
+      Serial.println(" - Created client");
+    }
+
+    // Connect to the remove BLE Server.
+    if (!pClient->connect(myDevice)) {  // if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
+      Serial.println(" - Connection failed");
+      return false;
+    }
+    Serial.println(" - Connected to server");
+    pClient->setMTU(517); //set client to request maximum MTU from server (default is 23 otherwise)
+
+    esp_ble_conn_update_params_t conn_params = {};
+    memcpy(conn_params.bda, *pClient->getPeerAddress().getNative(), sizeof(esp_bd_addr_t));
+    conn_params.min_int = BLE_CONN_INTERVAL_MIN;
+    conn_params.max_int = BLE_CONN_INTERVAL_MAX;
+    conn_params.latency = BLE_CONN_LATENCY;
+    conn_params.timeout = BLE_CONN_TIMEOUT;
+    esp_ble_gap_update_conn_params(&conn_params);
+
+    // Obtain a reference to the service we are after in the remote BLE server.
+    BLERemoteService* pRemoteService = pClient->getService(serviceUUID);
+    if (pRemoteService == nullptr) {
+      Serial.print("Failed to find our service UUID: ");
+      Serial.println(serviceUUID.toString().c_str());
+      pClient->disconnect();
+      return false;
+    }
+    Serial.println(" - Found our service");
+
+    // Obtain a reference to the characteristic in the service of the remote BLE server.
+    pRemoteCharacteristicRx = pRemoteService->getCharacteristic(readUUID);
+    if (pRemoteCharacteristicRx == nullptr) {
+      Serial.print("Failed to find our characteristic UUID: ");
+      Serial.println(readUUID.toString().c_str());
+      pClient->disconnect();
+      return false;
+    }
+    Serial.println(" - Found our Rx characteristic");
+
+    // Obtain a reference to the characteristic in the service of the remote BLE server.
+    pRemoteCharacteristic = pRemoteService->getCharacteristic(charUUID);
+    if (pRemoteCharacteristic == nullptr) {
+      Serial.print("Failed to find our characteristic UUID: ");
+      Serial.println(charUUID.toString().c_str());
+      pClient->disconnect();
+      return false;
+    }
+    Serial.println(" - Found our characteristic");
+
+    // Read the value of the characteristic.
+    if(pRemoteCharacteristic->canRead()) {
+      std::string value = pRemoteCharacteristic->readValue();
+      Serial.print("The characteristic value was: ");
+      Serial.println(value.c_str());
+    }
+
+    if(pRemoteCharacteristic->canNotify()) {
+      pRemoteCharacteristic->registerForNotify(notifyCallback);
+
+      Serial.println("Notifications turned on");
+      pRemoteCharacteristic->getDescriptor(BLEUUID((uint16_t)0x2902))->writeValue((uint8_t*)notificationOn, 2, true);
+    }
+
+    Ble_Connected = true;
+    Ble_Stat.connects++;
+    Ble_Stat.connect_ms_last = millis() - start_ms;
+    Ble_Stat.connect_ms_max = max(Ble_Stat.connect_ms_max, Ble_Stat.connect_ms_last);
+    if (Ble_Stat.connects == 1)
+      Ble_Stat.heap_connected = heap_before - ESP.getFreeHeap();
+    Serial.printf("BLE connected in %lu ms\n", (unsigned long)Ble_Stat.connect_ms_last);
+    return true;
+}
+
+
+/**
+ * Scan for BLE servers and find the first one that advertises the service we are looking for.
+ */
+class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
+ /**
+   * Called for each advertising BLE server.
+   */
+  void onResult(BLEAdvertisedDevice advertisedDevice) {
+    Serial.print("BLE Advertised Device found: ");
+    Serial.println(advertisedDevice.toString().c_str());
+
+    // We have found a device, let us now see if it contains the service we are looking for.
+    if (advertisedDevice.haveServiceUUID()
+    && advertisedDevice.isAdvertisingService(serviceUUID)
+    && (advertisedDevice.getName().compare(BLE_SENSOR_NAME) == 0)
+    )
+    {
+      BLEDevice::getScan()->stop();
+      Ble_Scanning = false;
+      delete myDevice;
+      myDevice = new BLEAdvertisedDevice(advertisedDevice);
+      Ble_Sensor_Batch = advertisedDevice.haveManufacturerData() &&
+                         (Ble_Sensor_Caps(advertisedDevice.getManufacturerData()) & BLE_CAP_BATCH);
+      Ble_Do_Connect = true;
+    } // Found our server
+  } // onResult
+}; // MyAdvertisedDeviceCallbacks
+
+static void scanComplete(BLEScanResults results) {
+  Ble_Scanning = false;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Transport policy
+/////////////////////////////////////////////////////////////////////////
+
+void BleTransport::begin() {
+  uint32_t heap_before = ESP.getFreeHeap();
+  BLEDevice::init("");
+  Ble_Stat.heap_init = heap_before - ESP.getFreeHeap();
+  Ble_Rx_Ring = xRingbufferCreate(BLE_RX_RING_SIZE, RINGBUF_TYPE_NOSPLIT);
+
+  // Retrieve a Scanner and set the callback we want to use to be informed when we
+  // have detected a new device.
+  // Specify that we want active scanning; scans are started from poll().
+  pBLEScan = BLEDevice::getScan();
+  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
+  pBLEScan->setInterval(1349);
+  pBLEScan->setWindow(449);
+  pBLEScan->setActiveScan(true);
+}
+
+void BleTransport::poll() {
+  Ble_Receive();
+
+  if (Ble_Disconnected) {
+    Ble_Disconnected = false;
+    Sensor_Link_Changed(LINK_BLE, false);
+  }
+
+  // If the flag "doConnect" is true then we have scanned for and found the desired
+  // BLE Server with which we wish to connect.  Now we connect to it.  Once we are
+  // connected we set the connected flag to be true.
+  // Connecting blocks loop() for the GATT round trips; in a failover build this only happens while the
+  // standby link (re)connects, never on the switch itself.
+  if (Ble_Do_Connect == true) {
+    if (connectToServer()) {
+      Serial.println("We are now connected to the BLE Server.");
+      Ble_Param_Sent = false;
+      Ble_Push.batch = Ble_Sensor_Batch;
+      Param_Push_Start(Ble_Push);
+      Sensor_Link_Changed(LINK_BLE, true);
+    } else {
+      Serial.println("We have failed to connect to the server; there is nothin more we will do.");
+    }
+    Ble_Do_Connect = false;
+  }
+
+  if (Ble_Connected && !Ble_Param_Sent) {
+    if (Param_Push_Step(Ble_Push, BleTransport::write)) {
+      Ble_Param_Sent = true;
+      Ble_Rx_Last_Ms = millis();
+    }
+  } else if (Ble_Connected) {
+    // Parameters changed from the console
+    Param_Push_Step(Ble_Push, BleTransport::write);
+  }
+
+  if(Relay_Busy())
+  {
+    if (Ble_Scanning) {
+      pBLEScan->stop();
+      Ble_Scanning = false;
+    }
+  } else if (!Ble_Connected && !Ble_Scanning && !Ble_Do_Connect) {
+    // Non-blocking one second scan, scanComplete() clears the flag
+    pBLEScan->clearResults();
+    Ble_Scanning = pBLEScan->start(1, scanComplete, false);
+  }
+}
+
+bool BleTransport::connected() {
+  return Ble_Connected;
+}
+
+bool BleTransport::ready() {
+  return Ble_Connected && Ble_Param_Sent;
+}
+
+bool BleTransport::alive() {
+  // The BLE stack supervises the connection itself, a dead link shows up as onDisconnect.
+  return ready();
+}
+
+unsigned long BleTransport::lastRxMs() {
+  return Ble_Rx_Last_Ms;
+}
+
+const char* BleTransport::backend() {
+  return "bluedroid";
+}
+
+const Ble_Stats& BleTransport::stats() {
+  return Ble_Stat;
+}
+
+// Credits for writes without response, see BLE_TX_CREDITS
+static void Ble_Tx_Refill() {
+  unsigned long now = millis();
+  unsigned long back = (now - Ble_Tx_Credit_Ms) / BLE_TX_CREDIT_MS;
+
+  if (back == 0)
+    return;
+  Ble_Tx_Credits = (uint8_t)min((unsigned long)BLE_TX_CREDITS, Ble_Tx_Credits + back);
+  Ble_Tx_Credit_Ms = Ble_Tx_Credits == BLE_TX_CREDITS ? now : Ble_Tx_Credit_Ms + back * BLE_TX_CREDIT_MS;
+}
+
+size_t BleTransport::write(const char* data, size_t length) {
+  if (!Ble_Connected || pRemoteCharacteristicRx == nullptr)
+    return 0;
+  Ble_Tx_Refill();
+  if (Ble_Tx_Credits > 0)
+    Ble_Tx_Credits--;
+  pRemoteCharacteristicRx->writeValue((uint8_t*)data, length);
+  return length;
+}
+
+size_t BleTransport::writeRoom() {
+  Ble_Tx_Refill();
+  return Ble_Tx_Credits > 0 ? maxWrite() : 0;
+}
+
+size_t BleTransport::maxWrite() {
+  if (!Ble_Connected || pClient == nullptr)
+    return 0;
+  return pClient->getMTU() - 3;
+}
+
+#endif
@@ -0,0 +1,287 @@
+/* Sensor link over BLE on the NimBLE stack (NimBLE-Arduino), central mode Nordic UART Service
+ *
+ * Same link as transport_ble.cpp, for builds with BLE_NIMBLE. NimBLE needs a fraction of Bluedroid's RAM and flash,
+ * and the connection is set up with fewer round trips:
+ *
+ *  - the client is created once and connects with deleteAttributes false, so the service, characteristic and
+ *    descriptor handles found on the first connection are reused on every reconnect instead of discovered again;
+ *  - a lost link is found again by the same non-blocking scan, and the connect only starts once the sensor is
+ *    seen advertising, so it is over in a few connection intervals instead of waiting out a timeout in loop();
+ *  - the TX characteristic is not read on connect, it only carries notifications.
+ */
+
+#include "transport.h"
+
+#if BLE_COMM && BLE_NIMBLE
+
+#include <NimBLEDevice.h>
+#include <freertos/ringbuf.h>
+
+#define BLE_SENSOR_NAME       "[intervoid]mobi-ramp_01"
+#define BLE_CONNECT_TIMEOUT_S 1     // the sensor was just seen advertising
+
+static NimBLEUUID serviceUUID("6e400001-b5a3-f393-e0a9-e50e24dcca9e");
+static NimBLEUUID readUUID("6e400002-b5a3-f393-e0a9-e50e24dcca9e");
+static NimBLEUUID charUUID("6e400003-b5a3-f393-e0a9-e50e24dcca9e");
+
+static volatile bool              Ble_Do_Connect    = false;
+static volatile bool              Ble_Connected     = false;
+static volatile bool              Ble_Disconnected  = false;
+static bool                       Ble_Sensor_Batch  = false;  // advertises BLE_CAP_BATCH
+static bool                       Ble_Param_Sent    = false;
+static bool                       Ble_Scanning      = false;
+static NimBLEAddress              Ble_Address;
+static NimBLEClient*              pClient;
+static NimBLERemoteCharacteristic* pRemoteCharacteristic;
+static NimBLERemoteCharacteristic* pRemoteCharacteristicRx;
+static NimBLEScan*                pBLEScan;
+static Param_Push                 Ble_Push;
+static volatile unsigned long     Ble_Rx_Last_Ms    = 0;
+static Ble_Stats                  Ble_Stat;
+static RingbufHandle_t            Ble_Rx_Ring       = nullptr;
+static uint8_t                    Ble_Tx_Credits    = BLE_TX_CREDITS;
+static unsigned long              Ble_Tx_Credit_Ms  = 0;
+
+static void notifyCallback(NimBLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length,
+                           bool isNotify) {
+  if (Ble_Param_Sent == false)
+    return;
+
+  Ble_Rx_Last_Ms = millis();
+  // NimBLE host task: queue it, Ble_Receive() runs the frames from loop()
+  if (xRingbufferSend(Ble_Rx_Ring, pData, length, 0) != pdTRUE)
+    Ble_Stat.rx_dropped++;
+}
+
+// Hands the queued notifications on, from poll()
+static void Ble_Receive() {
+  size_t  length;
+  void*   item;
+
+  while ((item = xRingbufferReceive(Ble_Rx_Ring, &length, 0)) != nullptr) {
+    Ble_Stat.notifications++;
+    Ble_Stat.frames += Sensor_Receive_Batch(LINK_BLE, (const uint8_t*)item, length);
+    vRingbufferReturnItem(Ble_Rx_Ring, item);
+  }
+}
+
+class MyClientCallback : public NimBLEClientCallbacks {
+  void onConnect(NimBLEClient* pclient) {
+    Serial.println("Connected to device 1");
+  }
+
+  void onDisconnect(NimBLEClient* pclient) {
+    Ble_Connected = false;
+    Ble_Param_Sent = false;
+    Serial.println("onDisconnect");
+    // BLE host task: poll() reports it from loop()
+    Ble_Disconnected = true;
+  }
+};
+
+static bool connectToServer() {
+  unsigned long start_ms = millis();
+  uint32_t heap_before = ESP.getFreeHeap();
+
+  if (pClient == nullptr) {
+    pClient = NimBLEDevice::createClient();
+    pClient->setClientCallbacks(new MyClientCallback(), true);
+    pClient->setConnectTimeout(BLE_CONNECT_TIMEOUT_S);
+    pClient->setConnectionParams(BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX, BLE_CONN_LATENCY, BLE_CONN_TIMEOUT);
+  }
+
+  Serial.print("Forming a connection to ");
+  Serial.println(Ble_Address.toString().c_str());
+
+  // Keep the attribute database: the handles of the last connection are used again.
+  if (!pClient->connect(Ble_Address, false)) {
+    Serial.println(" - Connection failed");
+    return false;
+  }
+
+  bool cached = pRemoteCharacteristic != nullptr && pRemoteCharacteristicRx != nullptr;
+  if (!cached) {
+    NimBLERemoteService* pRemoteService = pClient->getService(serviceUUID);
+    if (pRemoteService == nullptr) {
+      Serial.print("Failed to find our service UUID: ");
+      Serial.println(serviceUUID.toString().c_str());
+      pClient->disconnect();
+      return false;
+    }
+    pRemoteCharacteristicRx = pRemoteService->getCharacteristic(readUUID);
+    pRemoteCharacteristic = pRemoteService->getCharacteristic(charUUID);
+    if (pRemoteCharacteristicRx == nullptr || pRemoteCharacteristic == nullptr || !pRemoteCharacteristic->canNotify()) {
+      Serial.println("Failed to find our characteristics");
+      pRemoteCharacteristicRx = nullptr;
+      pRemoteCharacteristic = nullptr;
+      pClient->deleteServices();
+      pClient->disconnect();
+      return false;
+    }
+  }
+
+  // The sensor does not bond, notifications have to be switched on again on every connection.
+  if (!pRemoteCharacteristic->subscribe(true, notifyCallback, true)) {
+    Serial.println("Failed to turn notifications on");
+    // The sensor's attribute table may have changed, discover it again next time.
+    pRemoteCharacteristicRx = nullptr;
+    pRemoteCharacteristic = nullptr;
+    pClient->deleteServices();
+    pClient->disconnect();
+    return false;
+  }
+
+  Ble_Connected = true;
+  Ble_Stat.connects++;
+  if (cached)
+    Ble_Stat.cached_connects++;
+  Ble_Stat.connect_ms_last = millis() - start_ms;
+  Ble_Stat.connect_ms_max = max(Ble_Stat.connect_ms_max, Ble_Stat.connect_ms_last);
+  if (Ble_Stat.connects == 1)
+    Ble_Stat.heap_connected = heap_before - ESP.getFreeHeap();
+  Serial.printf("BLE connected in %lu ms%s\n", (unsigned long)Ble_Stat.connect_ms_last, cached ? " (cached)" : "");
+  return true;
+}
+
+class MyAdvertisedDeviceCallbacks : public NimBLEAdvertisedDeviceCallbacks {
+  void onResult(NimBLEAdvertisedDevice* advertisedDevice) {
+    if (advertisedDevice->isAdvertisingService(serviceUUID)
+    && (advertisedDevice->getName().compare(BLE_SENSOR_NAME) == 0)
+    )
+    {
+      Serial.print("BLE sensor found: ");
+      Serial.println(advertisedDevice->toString().c_str());
+      NimBLEDevice::getScan()->stop();
+      Ble_Scanning = false;
+      Ble_Address = advertisedDevice->getAddress();
+      Ble_Sensor_Batch = advertisedDevice->haveManufacturerData() &&
+                         (Ble_Sensor_Caps(advertisedDevice->getManufacturerData()) & BLE_CAP_BATCH);
+      Ble_Do_Connect = true;
+    }
+  }
+};
+
+static void scanComplete(NimBLEScanResults results) {
+  Ble_Scanning = false;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Transport policy
+/////////////////////////////////////////////////////////////////////////
+
+void BleTransport::begin() {
+  uint32_t heap_before = ESP.getFreeHeap();
+  NimBLEDevice::init("");
+  NimBLEDevice::setMTU(517);  // firmware blocks (fw_update.h) need the large MTU, default is 23
+  Ble_Stat.heap_init = heap_before - ESP.getFreeHeap();
+  Ble_Rx_Ring = xRingbufferCreate(BLE_RX_RING_SIZE, RINGBUF_TYPE_NOSPLIT);
+
+  pBLEScan = NimBLEDevice::getScan();
+  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks(), false);
+  pBLEScan->setInterval(1349);
+  pBLEScan->setWindow(449);
+  pBLEScan->setActiveScan(true);
+}
+
+void BleTransport::poll() {
+  Ble_Receive();
+
+  if (Ble_Disconnected) {
+    Ble_Disconnected = false;
+    Sensor_Link_Changed(LINK_BLE, false);
+  }
+
+  // Only after the scan saw the sensor advertising. Connecting blocks loop() for the GATT round trips; in a
+  // failover build this only happens while the standby link (re)connects, never on the switch itself.
+  if (Ble_Do_Connect) {
+    Ble_Do_Connect = false;
+    if (connectToServer()) {
+      Ble_Param_Sent = false;
+      Ble_Push.batch = Ble_Sensor_Batch;
+      Param_Push_Start(Ble_Push);
+      Sensor_Link_Changed(LINK_BLE, true);
+    }
+  }
+
+  if (Ble_Connected && !Ble_Param_Sent) {
+    if (Param_Push_Step(Ble_Push, BleTransport::write)) {
+      Ble_Param_Sent = true;
+      Ble_Rx_Last_Ms = millis();
+    }
+  } else if (Ble_Connected) {
+    // Parameters changed from the console
+    Param_Push_Step(Ble_Push, BleTransport::write);
+  }
+
+  if (Relay_Busy()) {
+    if (Ble_Scanning) {
+      pBLEScan->stop();
+      Ble_Scanning = false;
+    }
+  } else if (!Ble_Connected && !Ble_Scanning && !Ble_Do_Connect) {
+    // Non-blocking one second scan, scanComplete() clears the flag
+    pBLEScan->clearResults();
+    Ble_Scanning = pBLEScan->start(1, scanComplete, false);
+  }
+}
+
+bool BleTransport::connected() {
+  return Ble_Connected;
+}
+
+bool BleTransport::ready() {
+  return Ble_Connected && Ble_Param_Sent;
+}
+
+bool BleTransport::alive() {
+  // The BLE stack supervises the connection itself, a dead link shows up as onDisconnect.
+  return ready();
+}
+
+unsigned long BleTransport::lastRxMs() {
+  return Ble_Rx_Last_Ms;
+}
+
+const char* BleTransport::backend() {
+  return "nimble";
+}
+
+const Ble_Stats& BleTransport::stats() {
+  return Ble_Stat;
+}
+
+// Credits for writes without response, see BLE_TX_CREDITS
+static void Ble_Tx_Refill() {
+  unsigned long now = millis();
+  unsigned long back = (now - Ble_Tx_Credit_Ms) / BLE_TX_CREDIT_MS;
+
+  if (back == 0)
+    return;
+  Ble_Tx_Credits = (uint8_t)min((unsigned long)BLE_TX_CREDITS, Ble_Tx_Credits + back);
+  Ble_Tx_Credit_Ms = Ble_Tx_Credits == BLE_TX_CREDITS ? now : Ble_Tx_Credit_Ms + back * BLE_TX_CREDIT_MS;
+}
+
+size_t BleTransport::write(const char* data, size_t length) {
+  if (!Ble_Connected || pRemoteCharacteristicRx == nullptr)
+    return 0;
+  Ble_Tx_Refill();
+  if (Ble_Tx_Credits > 0)
+    Ble_Tx_Credits--;
+  // Fails when the stack is out of buffers
+  if (!pRemoteCharacteristicRx->writeValue((const uint8_t*)data, length, false))
+    return 0;
+  return length;
+}
+
+size_t BleTransport::writeRoom() {
+  Ble_Tx_Refill();
+  return Ble_Tx_Credits > 0 ? maxWrite() : 0;
+}
+
+size_t BleTransport::maxWrite() {
+  if (!Ble_Connected || pClient == nullptr)
+    return 0;
+  return pClient->getMTU() - 3;
+}
+
+#endif
@@ -0,0 +1,348 @@
+/* Sensor link over UART (Serial2)
+ *
+ * Handshake: the sensor sends "start" after boot, the controller answers with "_mobi-ramp" once a second until
+ * the sensor replies "sensor". Then the parameters are pushed and a faster baud rate is negotiated.
+ */
+
+#include "transport.h"
+
+#if UART_COMM
+
+#define TX1 10 //23
+#define RX1 9  //27
+#define RTS1 18
+#define CTS1 19
+
+#define UART_TX_BUF_SIZE                256                                         /**< UART TX buffer size. */
+#define UART_RX_BUF_SIZE                256                                         /**< UART RX line buffer size. */
+#define UART_RX_RING_SIZE               4096                                        /**< UART driver RX ring size. */
+#define UART_TX_RING_SIZE               8192                                        /**< UART driver TX ring size, a loop() of firmware blocks at 921600. */
+#define UART_RX_IDLE_MS                 20                                          /**< Flush a line without '\n' after this idle time. */
+
+#define UART_HW_FLOWCTRL                false   // RTS1/CTS1 wired between controller and sensor
+#define UART_BAUD_REQUEST               3       // index into UartBaudArr asked for after the handshake, 0: stay at 115200
+#define UART_BAUD_VERIFY_MS             500     // wait for the ack / the verify reply
+#define UART_BAUD_ERR_LIMIT             8       // line errors per window at the negotiated rate before falling back
+#define UART_BAUD_ERR_WINDOW_MS         10000
+#define UART_PROBE_MS                   1000    // _mobi-ramp while waiting for the sensor
+#define UART_HUNT_MS                    200     // _mobi-ramp at the next rate while looking for it after a warm restart
+#define UART_KEEPALIVE_MS               200     // _mobi-ramp while connected, failover builds only
+#define UART_LINK_TIMEOUT_MS            600     // no byte for this long: link not alive
+
+#define BAUD_IDLE                       0
+#define BAUD_WAIT_ACK                   1
+#define BAUD_VERIFY                     2
+
+char UART_TX_BUF[UART_TX_BUF_SIZE];
+char UART_RX_BUF[UART_RX_BUF_SIZE];
+uint16_t UART_RX_BUF_Index = 0;
+size_t Uart_Msg_Length = 0;
+bool Uart_Rx_Overflow = false;
+unsigned long Uart_Rx_Last_Ms = 0;
+
+const uint32_t UartBaudArr[4] = {115200, 230400, 460800, 921600};
+uint8_t Uart_Baud_Index = 0;
+uint8_t Uart_Baud_State = BAUD_IDLE;
+unsigned long Uart_Baud_Timer = 0;
+bool Uart_Baud_Failed = false;
+
+// Written from the UART driver's event task, see UART_RX_ERROR_CB
+volatile uint32_t Uart_Fifo_Overflows = 0;
+volatile uint32_t Uart_Buffer_Full = 0;
+volatile uint32_t Uart_Frame_Errors = 0;
+volatile uint32_t Uart_Parity_Errors = 0;
+uint32_t Uart_Long_Lines = 0;
+uint32_t Uart_Errors_Reported = 0;
+uint32_t Uart_Errors_Window_Base = 0;
+unsigned long Uart_Errors_Window_Start = 0;
+
+bool Sensor_Started = false;
+bool Uart_Connected = false;
+bool Uart_Param_Sent = false;
+Param_Push Uart_Push;
+unsigned long Uart_Probe_Ms = 0;
+bool Uart_Probe_Hunt = false;
+uint8_t Uart_Hunt_Probes = 0;
+unsigned long Uart_Keepalive_Ms = 0;
+
+void UART_RX_ERROR_CB(hardwareSerial_error_t err) {
+  switch (err) {
+    case UART_FIFO_OVF_ERROR:     Uart_Fifo_Overflows++;  break;
+    case UART_BUFFER_FULL_ERROR:  Uart_Buffer_Full++;     break;
+    case UART_FRAME_ERROR:        Uart_Frame_Errors++;    break;
+    case UART_PARITY_ERROR:       Uart_Parity_Errors++;   break;
+    default:                                              break;
+  }
+}
+
+uint32_t Uart_Error_Total() {
+  return Uart_Fifo_Overflows + Uart_Buffer_Full + Uart_Frame_Errors + Uart_Parity_Errors + Uart_Long_Lines;
+}
+
+void UartTransport::begin() {
+  // The driver ring must be sized before begin(); the default one is what used to overrun under load.
+  Serial2.setRxBufferSize(UART_RX_RING_SIZE);
+  Serial2.setTxBufferSize(UART_TX_RING_SIZE);
+  Serial2.begin(UartBaudArr[0], SERIAL_8N1, RX1, TX1);
+#if UART_HW_FLOWCTRL
+  Serial2.setPins(RX1, TX1, CTS1, RTS1);
+  Serial2.setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS, 64);
+#endif
+  Serial2.onReceiveError(UART_RX_ERROR_CB);
+}
+
+// The controller restarted but the sensor did not: it stays connected, does not send "start" again and may still
+// talk at the negotiated rate. Probe right away and step through the rates until it answers.
+void UartTransport::resume() {
+  Sensor_Started = true;
+  Uart_Probe_Hunt = true;
+  Uart_Hunt_Probes = 0;
+  Uart_Probe_Ms = millis() - UART_HUNT_MS;
+  Serial.println("UART: looking for a connected sensor");
+}
+
+void Uart_Set_Baud(uint8_t index) {
+  Serial2.flush();  // let the last frame at the old rate leave the FIFO
+  Serial2.updateBaudRate(UartBaudArr[index]);
+  Uart_Baud_Index = index;
+  UART_RX_BUF_Index = 0;
+  Uart_Rx_Overflow = false;
+  Uart_Errors_Window_Base = Uart_Error_Total();
+  Uart_Errors_Window_Start = millis();
+  Serial.printf("UART baud rate %lu\n", (unsigned long)UartBaudArr[index]);
+}
+
+/*
+ * Baud rate negotiation, after the parameter push:
+ *   controller -> 09:NN          NN index into UartBaudArr
+ *   sensor     -> 09:NN          ack at the old rate, then the sensor switches
+ *   controller -> _mobi-ramp     at the new rate
+ *   sensor     -> sensor         at the new rate
+ * The sensor goes back to 115200 if it does not get a valid line within a second of switching, so the controller
+ * only has to revert itself when the verify reply does not come. A sensor that does not know 09 never acks and
+ * the link stays at 115200.
+ */
+void Uart_Request_Baud() {
+  if (UART_BAUD_REQUEST == 0 || Uart_Baud_Failed || Uart_Baud_Index != 0)
+    return;
+
+  String newValue = (BAUDRATE_CMD + ":" + converter(UART_BAUD_REQUEST) + "\n");
+  Serial.println("Requesting baud rate \"" + newValue + "\"");
+  Serial2.write(newValue.c_str());
+  Uart_Baud_State = BAUD_WAIT_ACK;
+  Uart_Baud_Timer = millis();
+}
+
+void Uart_Baud_Fallback() {
+  Serial.println("UART falling back to default baud rate");
+  if (Uart_Baud_Index != 0) {
+    // Best effort, the sensor also falls back on its own
+    String newValue = (BAUDRATE_CMD + ":" + converter(0) + "\n");
+    Serial2.write(newValue.c_str());
+    Uart_Set_Baud(0);
+  }
+  Uart_Baud_State = BAUD_IDLE;
+  Uart_Baud_Failed = true;
+}
+
+void Uart_Baud_Poll() {
+  uint32_t errors = Uart_Error_Total();
+
+  if (errors != Uart_Errors_Reported) {
+    Uart_Errors_Reported = errors;
+    Serial.printf("UART errors: fifo_ovf %lu, buf_full %lu, frame %lu, parity %lu, long_lines %lu\n",
+      (unsigned long)Uart_Fifo_Overflows, (unsigned long)Uart_Buffer_Full, (unsigned long)Uart_Frame_Errors,
+      (unsigned long)Uart_Parity_Errors, (unsigned long)Uart_Long_Lines);
+  }
+
+  if (Uart_Baud_State == BAUD_WAIT_ACK && millis() - Uart_Baud_Timer > UART_BAUD_VERIFY_MS) {
+    Serial.println("No answer to baud rate request");
+    Uart_Baud_State = BAUD_IDLE;
+    Uart_Baud_Failed = true;
+  } else if (Uart_Baud_State == BAUD_VERIFY && millis() - Uart_Baud_Timer > UART_BAUD_VERIFY_MS) {
+    Uart_Baud_Fallback();
+  } else if (Uart_Baud_State == BAUD_IDLE && Uart_Baud_Index != 0) {
+    if (errors - Uart_Errors_Window_Base > UART_BAUD_ERR_LIMIT) {
+      // Too noisy at this rate: drop to the default and redo the handshake there.
+      Uart_Baud_Fallback();
+      Uart_Connected = false;
+      Uart_Param_Sent = false;
+      Sensor_Started = true;
+      Sensor_Link_Changed(LINK_UART, false);
+    } else if (millis() - Uart_Errors_Window_Start > UART_BAUD_ERR_WINDOW_MS) {
+      Uart_Errors_Window_Base = errors;
+      Uart_Errors_Window_Start = millis();
+    }
+  }
+}
+
+void Uart_Handle_Line(char* line, size_t length) {
+  String recv_Str = line;
+
+  // Every line, handshake included: off unless frame_log is set. Firmware acks come many times a second, never.
+  if (Frame_Log && recv_Str.indexOf(FWACK_CMD + ":") != 0)
+    Serial.printf("received %s from sensor\n", line);
+
+  if (Uart_Baud_State == BAUD_WAIT_ACK && recv_Str.indexOf(BAUDRATE_CMD + ":") == 0) {
+    Uart_Set_Baud(UART_BAUD_REQUEST);
+    Serial2.write("_mobi-ramp\n");
+    Uart_Baud_State = BAUD_VERIFY;
+    Uart_Baud_Timer = millis();
+    return;
+  }
+  if (Uart_Baud_State == BAUD_VERIFY && recv_Str.indexOf("sensor") > -1) {
+    Serial.println("UART baud rate verified");
+    Uart_Baud_State = BAUD_IDLE;
+    // Garbage from the switch itself does not count against the new rate
+    Uart_Errors_Window_Base = Uart_Error_Total();
+    Uart_Errors_Window_Start = millis();
+    return;
+  }
+
+  if (!Uart_Connected)
+  {
+    if (recv_Str.indexOf("start") > -1)
+    {
+      Sensor_Started = true;
+      // It rebooted after all and talks at the default rate
+      if (Uart_Probe_Hunt && Uart_Baud_Index != 0)
+        Uart_Set_Baud(0);
+      Uart_Probe_Hunt = false;
+      Serial.printf("Sensor_Started is True\n"); 
+    }
+    else if (recv_Str.indexOf("sensor") > -1)
+    {
+      Uart_Probe_Hunt = false;
+      Uart_Connected = true;
+      Uart_Param_Sent = false;
+      Param_Push_Start(Uart_Push);
+      Serial.write("mobi-ramp sensor connected\n");
+      Sensor_Link_Changed(LINK_UART, true);
+    }
+  } else {
+    if (recv_Str.indexOf("start") > -1)
+    {
+      Uart_Connected = false;
+      Uart_Param_Sent = false;
+      Sensor_Started = true;
+      Sensor_Link_Changed(LINK_UART, false);
+
+      // A rebooted sensor talks at the default rate again
+      if (Uart_Baud_Index != 0)
+        Uart_Set_Baud(0);
+      Uart_Baud_State = BAUD_IDLE;
+      Uart_Baud_Failed = false;
+
+      Sensor_Restarted(LINK_UART);
+
+      Serial.printf("Sensor_Started is True\n"); 
+    } else if (Uart_Param_Sent && recv_Str.indexOf("sensor") == -1)
+    {
+      Sensor_Receive(LINK_UART, (const uint8_t *)line, length);
+    }
+  }
+}
+
+void Uart_Receive() {
+  int avail = Serial2.available();
+
+  // Frames are '\n' terminated; split and coalesced frames are reassembled here.
+  while (avail-- > 0) {
+    char ch = (char)Serial2.read();
+    Uart_Rx_Last_Ms = millis();
+
+    if (ch == '\n' || ch == '\r') {
+      if (Uart_Rx_Overflow) {
+        Uart_Long_Lines++;
+      } else if (UART_RX_BUF_Index > 0) {
+        UART_RX_BUF[UART_RX_BUF_Index] = '\0';
+        Uart_Msg_Length = UART_RX_BUF_Index;
+        UART_RX_BUF_Index = 0;
+        Uart_Handle_Line(UART_RX_BUF, Uart_Msg_Length);
+      }
+      UART_RX_BUF_Index = 0;
+      Uart_Rx_Overflow = false;
+    } else if (UART_RX_BUF_Index < UART_RX_BUF_SIZE - 1) {
+      UART_RX_BUF[UART_RX_BUF_Index++] = ch;
+    } else {
+      Uart_Rx_Overflow = true;
+    }
+  }
+
+  // Sensor firmware that does not terminate its frames: take whatever arrived once the line goes quiet.
+  if (UART_RX_BUF_Index > 0 && !Uart_Rx_Overflow && millis() - Uart_Rx_Last_Ms > UART_RX_IDLE_MS) {
+    UART_RX_BUF[UART_RX_BUF_Index] = '\0';
+    Uart_Msg_Length = UART_RX_BUF_Index;
+    UART_RX_BUF_Index = 0;
+    Uart_Handle_Line(UART_RX_BUF, Uart_Msg_Length);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Transport policy
+/////////////////////////////////////////////////////////////////////////
+
+void UartTransport::poll() {
+  if (Uart_Connected) {
+    if (!Uart_Param_Sent) {
+      if (Param_Push_Step(Uart_Push, UartTransport::write)) {
+        Uart_Param_Sent = true;
+        Uart_Request_Baud();
+      }
+    } else if (Uart_Baud_State == BAUD_IDLE) {
+      // Parameters changed from the console
+      Param_Push_Step(Uart_Push, UartTransport::write);
+    }
+#if LINK_FAILOVER
+    // The sensor answers _mobi-ramp at any time; the replies are what alive() is based on.
+    if (Uart_Param_Sent && Uart_Baud_State == BAUD_IDLE && millis() - Uart_Keepalive_Ms >= UART_KEEPALIVE_MS) {
+      Uart_Keepalive_Ms = millis();
+      Serial2.write("_mobi-ramp\n");
+    }
+#endif
+  } else if (Uart_Probe_Hunt && millis() - Uart_Probe_Ms >= UART_HUNT_MS) {
+    // The last probe went unanswered at this rate
+    if (Uart_Hunt_Probes++ > 0)
+      Uart_Set_Baud((Uart_Baud_Index + 1) % (sizeof(UartBaudArr) / sizeof(UartBaudArr[0])));
+    Uart_Probe_Ms = millis();
+    Serial2.write("_mobi-ramp\n");
+  } else if (Sensor_Started && millis() - Uart_Probe_Ms >= UART_PROBE_MS) {
+    Uart_Probe_Ms = millis();
+    Serial.println("send _mobi-ramp msg to sensor\n");
+    Serial2.write("_mobi-ramp\n");
+  }
+
+  //Receive UART Msg From mobi-ramp sensor
+  Uart_Receive();
+  Uart_Baud_Poll();
+}
+
+bool UartTransport::connected() {
+  return Uart_Connected;
+}
+
+bool UartTransport::ready() {
+  return Uart_Connected && Uart_Param_Sent;
+}
+
+bool UartTransport::alive() {
+  return ready() && millis() - Uart_Rx_Last_Ms < UART_LINK_TIMEOUT_MS;
+}
+
+unsigned long UartTransport::lastRxMs() {
+  return Uart_Rx_Last_Ms;
+}
+
+size_t UartTransport::write(const char* data, size_t length) {
+  return Serial2.write((const uint8_t*)data, length);
+}
+
+size_t UartTransport::writeRoom() {
+  return Serial2.availableForWrite();
+}
+
+size_t UartTransport::maxWrite() {
+  return UART_TX_RING_SIZE;
+}
+
+#endif
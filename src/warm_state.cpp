@@ -0,0 +1,92 @@
+/* Control state kept over a warm restart, see warm_state.h
+ */
+
+#include <Arduino.h>
+#include <esp_system.h>
+#include <rom/crc.h>
+#include "warm_state.h"
+
+#define WARM_MAGIC    0x4D525732UL  // "MRW2", bump when Warm_State changes
+
+struct Warm_Slot {
+  uint32_t        magic;
+  uint32_t        restarts;         // warm restarts since the last stable run
+  Warm_State      state;
+  uint32_t        crc;
+};
+
+static RTC_NOINIT_ATTR Warm_Slot  Slot;
+static bool                       Stable = false;
+
+static uint32_t Warm_Crc(const Warm_Slot& slot) {
+  return crc32_le(0, (const uint8_t*)&slot, offsetof(Warm_Slot, crc));
+}
+
+static bool Warm_Reset_Keeps_State(esp_reset_reason_t reason) {
+  switch (reason) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool Warm_Restore(Warm_State& state) {
+  bool valid = Warm_Reset_Keeps_State(esp_reset_reason()) && Slot.magic == WARM_MAGIC && Slot.crc == Warm_Crc(Slot);
+
+  if (!valid) {
+    memset(&Slot, 0, sizeof(Slot));
+    Slot.magic = WARM_MAGIC;
+    Slot.crc = Warm_Crc(Slot);
+    return false;
+  }
+
+  if (++Slot.restarts > WARM_MAX_RESTARTS) {
+    memset(&Slot.state, 0, sizeof(Slot.state));
+    Slot.restarts = 0;
+    Slot.crc = Warm_Crc(Slot);
+    return false;
+  }
+  Slot.crc = Warm_Crc(Slot);
+  state = Slot.state;
+  return true;
+}
+
+void Warm_Save(const Warm_State& state) {
+  if (memcmp(&Slot.state, &state, sizeof(state)) == 0)
+    return;
+  Slot.state = state;
+  Slot.crc = Warm_Crc(Slot);
+}
+
+void Warm_Poll() {
+  if (!Stable && millis() >= WARM_STABLE_MS) {
+    Stable = true;
+    Slot.restarts = 0;
+    Slot.crc = Warm_Crc(Slot);
+  }
+}
+
+bool Warm_Power_On() {
+  return esp_reset_reason() == ESP_RST_POWERON;
+}
+
+const char* Warm_Reset_Reason() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:   return "power-on";
+    case ESP_RST_EXT:       return "external";
+    case ESP_RST_SW:        return "software";
+    case ESP_RST_PANIC:     return "panic";
+    case ESP_RST_INT_WDT:   return "interrupt watchdog";
+    case ESP_RST_TASK_WDT:  return "task watchdog";
+    case ESP_RST_WDT:       return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep sleep";
+    case ESP_RST_BROWNOUT:  return "brownout";
+    default:                return "unknown";
+  }
+}
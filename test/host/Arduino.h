@@ -0,0 +1,139 @@
+/* Just enough of the Arduino core for the modules under test
+ *
+ * millis() returns Host_Millis, which the test sets, and digitalWrite() leaves the level in Host_Pin_Level. Serial
+ * keeps what was printed in Serial.out instead of writing it anywhere, so a test can check the replies; Serial2, the
+ * sensor link, works the same way and reads what the test puts in Serial2.in.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#define RTC_NOINIT_ATTR
+
+using std::max;
+using std::min;
+
+extern unsigned long  Host_Millis;
+
+static inline unsigned long millis() {
+  return Host_Millis;
+}
+
+// Time passes at once
+static inline void delay(unsigned long ms) {
+  Host_Millis += ms;
+}
+
+#define LOW                       0
+#define HIGH                      1
+#define OUTPUT                    0x03
+#define HOST_PINS                 40
+
+extern uint8_t        Host_Pin_Level[HOST_PINS];
+
+static inline void pinMode(uint8_t pin, uint8_t mode) {}
+
+static inline void digitalWrite(uint8_t pin, uint8_t val) {
+  Host_Pin_Level[pin] = val;
+}
+
+class String {
+ public:
+  String(const char* s = "") : s_(s) {}
+  String(const std::string& s) : s_(s) {}
+  const char* c_str() const { return s_.c_str(); }
+  unsigned length() const { return s_.size(); }
+  int indexOf(const char* s) const {
+    size_t at = s_.find(s);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  int indexOf(const String& s) const { return indexOf(s.c_str()); }
+  bool operator==(const char* s) const { return s_ == s; }
+  String operator+(const String& s) const { return String(s_ + s.s_); }
+  String operator+(const char* s) const { return String(s_ + s); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.s_); }
+
+ private:
+  std::string s_;
+};
+
+#define SERIAL_8N1                0x800001c
+#define UART_HW_FLOWCTRL_CTS_RTS  3
+
+typedef enum {
+  UART_NO_ERROR,
+  UART_BREAK_ERROR,
+  UART_BUFFER_FULL_ERROR,
+  UART_FIFO_OVF_ERROR,
+  UART_FRAME_ERROR,
+  UART_PARITY_ERROR,
+} hardwareSerial_error_t;
+
+typedef void (*OnReceiveErrorCb)(hardwareSerial_error_t);
+
+// Console and sensor link alike: what the firmware writes collects in out, what it reads comes from in
+class HardwareSerial {
+ public:
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char    buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    out += buf;
+    return n > 0 ? (size_t)n : 0;
+  }
+  size_t println() { return write("\n"); }
+  size_t println(const char* s) { return write(s) + write("\n"); }
+  size_t println(const String& s) { return println(s.c_str()); }
+  size_t println(int v) { return printf("%d\n", v); }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const uint8_t* data, size_t length) {
+    out.append((const char*)data, length);
+    return length;
+  }
+
+  int available() { return (int)in.size(); }
+  int read() {
+    if (in.empty())
+      return -1;
+    uint8_t c = in[0];
+    in.erase(0, 1);
+    return c;
+  }
+  int availableForWrite() { return (int)write_room; }
+
+  void begin(unsigned long rate, uint32_t config = SERIAL_8N1, int8_t rx = -1, int8_t tx = -1) { baud = rate; }
+  void updateBaudRate(unsigned long rate) { baud = rate; }
+  // Waits for what was written to leave: a test's wire takes it at the current rate
+  void flush() {
+    if (flush_cb != nullptr)
+      flush_cb();
+  }
+  size_t setRxBufferSize(size_t size) { return size; }
+  size_t setTxBufferSize(size_t size) { return size; }
+  bool setPins(int8_t rx, int8_t tx, int8_t cts = -1, int8_t rts = -1) { return true; }
+  bool setHwFlowCtrlMode(uint8_t mode = UART_HW_FLOWCTRL_CTS_RTS, uint8_t threshold = 64) { return true; }
+  void onReceiveError(OnReceiveErrorCb cb) { error_cb = cb; }
+
+  std::string       out;
+  std::string       in;
+  unsigned long     baud = 0;
+  size_t            write_room = 4096;
+  OnReceiveErrorCb  error_cb = nullptr;
+  void              (*flush_cb)() = nullptr;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+#endif // HOST_ARDUINO_H
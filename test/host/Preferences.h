@@ -0,0 +1,67 @@
+/* NVS for the host tests: kept in memory for the run, Host_Prefs_Clear() forgets it
+ */
+
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>>  Host_Prefs_Namespace;
+
+extern std::map<std::string, Host_Prefs_Namespace>  Host_Prefs;
+
+void    Host_Prefs_Clear();
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool read_only = false) {
+    ns_ = &Host_Prefs[name];
+    read_only_ = read_only;
+    return true;
+  }
+  void end() { ns_ = nullptr; }
+
+  bool isKey(const char* key) { return ns_ != nullptr && ns_->count(key) > 0; }
+  bool remove(const char* key) { return ns_ != nullptr && !read_only_ && ns_->erase(key) > 0; }
+  bool clear() {
+    if (ns_ == nullptr || read_only_)
+      return false;
+    ns_->clear();
+    return true;
+  }
+
+  size_t putBytes(const char* key, const void* value, size_t length) {
+    if (ns_ == nullptr || read_only_)
+      return 0;
+    (*ns_)[key].assign((const uint8_t*)value, (const uint8_t*)value + length);
+    return length;
+  }
+  size_t getBytesLength(const char* key) { return isKey(key) ? (*ns_)[key].size() : 0; }
+  size_t getBytes(const char* key, void* buf, size_t length) {
+    size_t n = getBytesLength(key);
+    if (n == 0 || n > length)
+      return 0;
+    memcpy(buf, (*ns_)[key].data(), n);
+    return n;
+  }
+
+  size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  int32_t getInt(const char* key, int32_t default_value = 0) {
+    int32_t value;
+    return getBytesLength(key) == sizeof(value) && getBytes(key, &value, sizeof(value)) ? value : default_value;
+  }
+  size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint32_t getUInt(const char* key, uint32_t default_value = 0) {
+    uint32_t value;
+    return getBytesLength(key) == sizeof(value) && getBytes(key, &value, sizeof(value)) ? value : default_value;
+  }
+
+ private:
+  Host_Prefs_Namespace* ns_ = nullptr;
+  bool                  read_only_ = false;
+};
+
+#endif // HOST_PREFERENCES_H
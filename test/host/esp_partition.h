@@ -0,0 +1,45 @@
+/* The staging partition for the host tests: HOST_PARTITION_SIZE bytes of NOR flash in Host_Partition_Data,
+ * writes only clear bits like the real thing, so a missing erase shows.
+ */
+
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOST_PARTITION_SIZE   65536
+
+typedef int esp_err_t;
+
+#define ESP_OK                0
+#define ESP_FAIL              -1
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP  = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+  ESP_PARTITION_SUBTYPE_ANY         = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+  esp_partition_type_t    type;
+  esp_partition_subtype_t subtype;
+  uint32_t                address;
+  uint32_t                size;
+  char                    label[17];
+  bool                    encrypted;
+} esp_partition_t;
+
+extern uint8_t  Host_Partition_Data[HOST_PARTITION_SIZE];
+
+const esp_partition_t*  esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                 const char* label);
+esp_err_t   esp_partition_read(const esp_partition_t* part, size_t offset, void* dst, size_t size);
+esp_err_t   esp_partition_write(const esp_partition_t* part, size_t offset, const void* src, size_t size);
+esp_err_t   esp_partition_erase_range(const esp_partition_t* part, size_t offset, size_t size);
+
+#endif // HOST_ESP_PARTITION_H
@@ -0,0 +1,27 @@
+/* Reset reason for the host tests, esp_reset_reason() returns Host_Reset_Reason
+ */
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+extern esp_reset_reason_t Host_Reset_Reason;
+
+static inline esp_reset_reason_t esp_reset_reason() {
+  return Host_Reset_Reason;
+}
+
+#endif // HOST_ESP_SYSTEM_H
@@ -0,0 +1,80 @@
+/* The host side of the stubs in test/host
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <rom/crc.h>
+
+unsigned long       Host_Millis         = 0;
+uint8_t             Host_Pin_Level[HOST_PINS];
+HardwareSerial      Serial;
+HardwareSerial      Serial2;
+esp_reset_reason_t  Host_Reset_Reason   = ESP_RST_POWERON;
+
+// Bitwise, reflected polynomial; crc is the previous result, 0 to start
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  while (len-- > 0) {
+    crc ^= *buf++;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//NVS
+/////////////////////////////////////////////////////////////////////////
+
+std::map<std::string, Host_Prefs_Namespace>  Host_Prefs;
+
+void Host_Prefs_Clear() {
+  Host_Prefs.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Flash partition
+/////////////////////////////////////////////////////////////////////////
+
+#define HOST_SECTOR_SIZE  4096
+
+uint8_t Host_Partition_Data[HOST_PARTITION_SIZE];
+
+static const esp_partition_t Host_Partition = {
+  ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, HOST_PARTITION_SIZE, "spiffs", false,
+};
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  if (type != Host_Partition.type || (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != Host_Partition.subtype))
+    return nullptr;
+  return label == nullptr || strcmp(label, Host_Partition.label) == 0 ? &Host_Partition : nullptr;
+}
+
+static bool Host_Partition_Range(const esp_partition_t* part, size_t offset, size_t size) {
+  return part == &Host_Partition && offset <= HOST_PARTITION_SIZE && size <= HOST_PARTITION_SIZE - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* part, size_t offset, void* dst, size_t size) {
+  if (!Host_Partition_Range(part, offset, size))
+    return ESP_FAIL;
+  memcpy(dst, Host_Partition_Data + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* part, size_t offset, const void* src, size_t size) {
+  if (!Host_Partition_Range(part, offset, size))
+    return ESP_FAIL;
+  for (size_t i = 0; i < size; i++)
+    Host_Partition_Data[offset + i] &= ((const uint8_t*)src)[i];
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* part, size_t offset, size_t size) {
+  if (!Host_Partition_Range(part, offset, size) || offset % HOST_SECTOR_SIZE != 0 || size % HOST_SECTOR_SIZE != 0)
+    return ESP_FAIL;
+  memset(Host_Partition_Data + offset, 0xFF, size);
+  return ESP_OK;
+}
@@ -0,0 +1,11 @@
+/* The ROM's CRC-32 (IEEE 802.3, as zlib), host/host.cpp
+ */
+
+#ifndef HOST_ROM_CRC_H
+#define HOST_ROM_CRC_H
+
+#include <stdint.h>
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif // HOST_ROM_CRC_H
@@ -0,0 +1,61 @@
+/* Checks for the host tests
+ *
+ * A failed CHECK prints where and what and the test goes on, so one run shows every failure. main() ends with
+ * "return Test_Done(name);", which prints the summary and returns the exit code for make.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static int Test_Checks = 0;
+static int Test_Failed = 0;
+
+static inline bool Test_Check(bool ok, const char* file, int line, const char* what) {
+  Test_Checks++;
+  if (!ok) {
+    Test_Failed++;
+    printf("%s:%d: check failed: %s\n", file, line, what);
+  }
+  return ok;
+}
+
+static inline bool Test_Check_Eq(long long a, long long b, const char* file, int line, const char* what) {
+  if (!Test_Check(a == b, file, line, what)) {
+    printf("    %lld != %lld\n", a, b);
+    return false;
+  }
+  return true;
+}
+
+static inline bool Test_Check_Str(const char* a, const char* b, const char* file, int line, const char* what) {
+  if (!Test_Check(a != nullptr && b != nullptr && strcmp(a, b) == 0, file, line, what)) {
+    printf("    \"%s\" != \"%s\"\n", a != nullptr ? a : "(null)", b != nullptr ? b : "(null)");
+    return false;
+  }
+  return true;
+}
+
+static inline bool Test_Check_Near(double a, double b, double tolerance, const char* file, int line,
+                                   const char* what) {
+  if (!Test_Check(fabs(a - b) <= tolerance, file, line, what)) {
+    printf("    %g is not within %g of %g\n", a, tolerance, b);
+    return false;
+  }
+  return true;
+}
+
+#define CHECK(cond)               Test_Check((cond), __FILE__, __LINE__, #cond)
+#define CHECK_EQ(a, b)            Test_Check_Eq((long long)(a), (long long)(b), __FILE__, __LINE__, #a " == " #b)
+#define CHECK_STR(a, b)           Test_Check_Str((a), (b), __FILE__, __LINE__, #a " == " #b)
+#define CHECK_NEAR(a, b, tol)     Test_Check_Near((a), (b), (tol), __FILE__, __LINE__, #a " ~ " #b)
+
+static inline int Test_Done(const char* name) {
+  printf("%s: %d checks, %d failed\n", name, Test_Checks, Test_Failed);
+  return Test_Failed == 0 ? 0 : 1;
+}
+
+#endif // TEST_H
@@ -0,0 +1,212 @@
+/* Detection conditioning, src/detect_filter.cpp
+ */
+
+#include <Arduino.h>
+#include <vector>
+#include "controller.h"
+#include "detect_filter.h"
+#include "test.h"
+
+struct Applied {
+  uint8_t         lane;
+  uint8_t         detect;
+  unsigned long   ms;
+};
+
+struct Counters {
+  unsigned long   applied;
+  unsigned long   duplicate;
+  unsigned long   chatter;
+  unsigned long   refractory;
+};
+
+static std::vector<Applied> Applied_Log;
+
+void Detect_Apply(uint8_t lane, uint8_t detect, unsigned long ms) {
+  Applied_Log.push_back({lane, detect, ms});
+}
+
+// Starts a case: filter times, no lane state, t = 0
+static void Start(int on_ms, int off_ms, int refractory_ms) {
+  Filter_Min_On_Ms = on_ms;
+  Filter_Min_Off_Ms = off_ms;
+  Filter_Refractory_Ms = refractory_ms;
+  Host_Millis = 0;
+  Detect_Filter_Reset();
+  Applied_Log.clear();
+}
+
+// A frame from the sensor at now, its detection time is the sensor's clock
+static void Frame(unsigned long now, uint8_t lane, uint8_t detect) {
+  Host_Millis = now;
+  Detect_Filter_Input(lane, detect, 100000 + now);
+}
+
+static void Poll(unsigned long now) {
+  Host_Millis = now;
+  Detect_Filter_Poll();
+}
+
+static Counters Read_Counters(uint8_t lane) {
+  Counters c = {};
+
+  Serial.out.clear();
+  Detect_Filter_Print();
+  size_t at = Serial.out.find("@FLT," + std::to_string(lane) + ",");
+  if (CHECK(at != std::string::npos))
+    sscanf(Serial.out.c_str() + at, "@FLT,%*u,%lu,%lu,%lu,%lu", &c.applied, &c.duplicate, &c.chatter, &c.refractory);
+  return c;
+}
+
+static bool Applied_Is(size_t i, uint8_t lane, uint8_t detect, unsigned long ms) {
+  return i < Applied_Log.size() && Applied_Log[i].lane == lane && Applied_Log[i].detect == detect &&
+         Applied_Log[i].ms == ms;
+}
+
+// As shipped: every change goes through at once, repeats are dropped
+static void Test_Off() {
+  Start(0, 0, 0);
+  Counters before = Read_Counters(0);
+
+  // After a reset the first frame is applied, even a 00:00
+  Frame(0, 0, 0);
+  Frame(10, 0, 0);
+  Frame(20, 0, 1);
+  Frame(30, 0, 1);
+  Frame(40, 0, 0);
+  CHECK_EQ(Applied_Log.size(), 3);
+  CHECK(Applied_Is(0, 0, 0, 100000));
+  CHECK(Applied_Is(1, 0, 1, 100020));
+  CHECK(Applied_Is(2, 0, 0, 100040));
+
+  Counters after = Read_Counters(0);
+  CHECK_EQ(after.applied - before.applied, 3);
+  CHECK_EQ(after.duplicate - before.duplicate, 2);
+  CHECK_EQ(after.chatter - before.chatter, 0);
+}
+
+// A transition is applied once it held, with the time of the frame that started it
+static void Test_Min_On() {
+  Start(100, 0, 0);
+
+  Frame(1000, 0, 1);
+  CHECK_EQ(Applied_Log.size(), 0);
+  Poll(1099);
+  CHECK_EQ(Applied_Log.size(), 0);
+  // A repeat of the pending state neither applies it early nor restarts the wait
+  Frame(1050, 0, 1);
+  Poll(1100);
+  CHECK_EQ(Applied_Log.size(), 1);
+  CHECK(Applied_Is(0, 0, 1, 101000));
+  Poll(1500);
+  CHECK_EQ(Applied_Log.size(), 1);
+
+  // No minimum for 00:00
+  Frame(2000, 0, 0);
+  CHECK_EQ(Applied_Log.size(), 2);
+  CHECK(Applied_Is(1, 0, 0, 102000));
+}
+
+static void Test_Min_Off() {
+  Start(0, 300, 0);
+
+  Frame(0, 0, 1);
+  CHECK_EQ(Applied_Log.size(), 1);
+  Frame(100, 0, 0);
+  Poll(399);
+  CHECK_EQ(Applied_Log.size(), 1);
+  Poll(400);
+  CHECK_EQ(Applied_Log.size(), 2);
+  CHECK(Applied_Is(1, 0, 0, 100100));
+}
+
+// A transition taken back before it held drops both frames
+static void Test_Chatter() {
+  Start(100, 0, 0);
+  Counters before = Read_Counters(0);
+
+  Frame(0, 0, 0);
+  Frame(10, 0, 1);
+  Frame(50, 0, 0);
+  Poll(500);
+  CHECK_EQ(Applied_Log.size(), 1);
+  CHECK(Applied_Is(0, 0, 0, 100000));
+
+  // The lane is still "no vehicle": a 00:00 is a repeat, a 00:01 starts over
+  Frame(600, 0, 0);
+  Frame(700, 0, 1);
+  Poll(800);
+  CHECK_EQ(Applied_Log.size(), 2);
+  CHECK(Applied_Is(1, 0, 1, 100700));
+
+  Counters after = Read_Counters(0);
+  CHECK_EQ(after.chatter - before.chatter, 2);
+  CHECK_EQ(after.duplicate - before.duplicate, 1);
+}
+
+static void Test_Refractory() {
+  Start(0, 0, 500);
+  Counters before = Read_Counters(0);
+
+  Frame(0, 0, 1);
+  Frame(50, 0, 0);
+  Frame(200, 0, 1);     // too soon after the last applied 00:01
+  Frame(250, 0, 0);     // repeats the current state
+  Frame(500, 0, 1);
+  CHECK_EQ(Applied_Log.size(), 3);
+  CHECK(Applied_Is(0, 0, 1, 100000));
+  CHECK(Applied_Is(1, 0, 0, 100050));
+  CHECK(Applied_Is(2, 0, 1, 100500));
+
+  Counters after = Read_Counters(0);
+  CHECK_EQ(after.refractory - before.refractory, 1);
+  CHECK_EQ(after.duplicate - before.duplicate, 1);
+}
+
+// The lanes are filtered on their own
+static void Test_Lanes() {
+  Start(100, 0, 0);
+
+  Frame(0, 0, 1);
+  Frame(40, 1, 1);
+  Poll(100);
+  CHECK_EQ(Applied_Log.size(), 1);
+  CHECK(Applied_Is(0, 0, 1, 100000));
+  Frame(120, 1, 0);     // takes lane 1 back, lane 0 stays
+  Poll(300);
+  CHECK_EQ(Applied_Log.size(), 1);
+
+  Frame(400, FILTER_LANES, 1);
+  Poll(600);
+  CHECK_EQ(Applied_Log.size(), 1);
+}
+
+// A reset drops what is pending and forgets the lane state
+static void Test_Reset() {
+  Start(100, 0, 0);
+
+  Frame(0, 0, 1);
+  Poll(100);
+  Frame(200, 0, 0);
+  Frame(300, 0, 1);
+  Detect_Filter_Reset();
+  Poll(1000);
+  CHECK_EQ(Applied_Log.size(), 2);
+
+  // A 00:01 that was the applied state before is no repeat now
+  Frame(1100, 0, 1);
+  Poll(1200);
+  CHECK_EQ(Applied_Log.size(), 3);
+  CHECK(Applied_Is(2, 0, 1, 101100));
+}
+
+int main() {
+  Test_Off();
+  Test_Min_On();
+  Test_Min_Off();
+  Test_Chatter();
+  Test_Refractory();
+  Test_Lanes();
+  Test_Reset();
+  return Test_Done("detect_filter");
+}
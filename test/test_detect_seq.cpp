@@ -0,0 +1,139 @@
+/* Detection sequencing, src/detect_seq.cpp
+ */
+
+#include <Arduino.h>
+#include <string>
+#include "detect_seq.h"
+#include "test.h"
+
+// A frame with this sequence number: 1 if it is applied, else 0; ack is what the controller answers
+static int Frame(uint16_t seq, int32_t& ack) {
+  ack = -1;
+  return Detect_Sequence(seq, ack) ? 1 : 0;
+}
+
+static std::string Print() {
+  Serial.out.clear();
+  Detect_Seq_Print();
+  return Serial.out;
+}
+
+// After a controller boot the first frame is the next one, whatever its number
+static void Test_In_Order() {
+  int32_t ack;
+
+  CHECK(!Detect_Seq_Synced());
+  CHECK_EQ(Frame(7, ack), 1);
+  CHECK_EQ(ack, 7);
+  CHECK(Detect_Seq_Synced());
+  for (uint16_t seq = 8; seq <= 10; seq++) {
+    CHECK_EQ(Frame(seq, ack), 1);
+    CHECK_EQ(ack, seq);
+  }
+  CHECK_EQ(Detect_Seq_Next(), 11);
+  CHECK_STR(Print().c_str(), "@SEQ,1,11,4,0,0\n");
+}
+
+// Retransmissions of applied frames are dropped and answered with the last applied one
+static void Test_Duplicates() {
+  int32_t ack;
+
+  CHECK_EQ(Frame(9, ack), 0);
+  CHECK_EQ(ack, 10);
+  CHECK_EQ(Frame(10, ack), 0);
+  CHECK_EQ(ack, 10);
+  CHECK_EQ(Frame(11, ack), 1);
+  CHECK_EQ(ack, 11);
+  CHECK_STR(Print().c_str(), "@SEQ,1,12,5,0,2\n");
+}
+
+// A hole counts once until it is filled; what comes after it is dropped until then
+static void Test_Gaps() {
+  int32_t ack;
+
+  CHECK_EQ(Frame(14, ack), 0);
+  CHECK_EQ(ack, 11);
+  CHECK_EQ(Frame(15, ack), 0);
+  CHECK_EQ(ack, 11);
+  CHECK_STR(Print().c_str(), "@SEQ,1,12,5,1,2\n");
+
+  // The sensor goes back to the first missing one
+  for (uint16_t seq = 12; seq <= 15; seq++)
+    CHECK_EQ(Frame(seq, ack), 1);
+  CHECK_EQ(ack, 15);
+
+  CHECK_EQ(Frame(17, ack), 0);
+  CHECK_EQ(Frame(16, ack), 1);
+  CHECK_STR(Print().c_str(), "@SEQ,1,17,10,2,2\n");
+}
+
+// The numbers wrap at 16 bits
+static void Test_Wraparound() {
+  int32_t ack;
+
+  Detect_Seq_Restore(true, 65534);
+  CHECK_EQ(Frame(65534, ack), 1);
+  CHECK_EQ(Frame(65535, ack), 1);
+  CHECK_EQ(ack, 65535);
+  CHECK_EQ(Frame(0, ack), 1);
+  CHECK_EQ(ack, 0);
+  CHECK_EQ(Frame(1, ack), 1);
+  CHECK_EQ(Detect_Seq_Next(), 2);
+
+  // Behind across the wrap is a duplicate, answered with the last one
+  CHECK_EQ(Frame(65535, ack), 0);
+  CHECK_EQ(ack, 1);
+  // A hole across the wrap
+  Detect_Seq_Restore(true, 65535);
+  CHECK_EQ(Frame(1, ack), 0);
+  CHECK_EQ(ack, 65534);
+  CHECK_EQ(Frame(65535, ack), 1);
+  CHECK_EQ(Frame(0, ack), 1);
+  CHECK_EQ(Frame(1, ack), 1);
+  CHECK_EQ(Detect_Seq_Next(), 2);
+}
+
+// The sensor restarted: it numbers from 1, and that is expected, not taken as the first of a new sync
+static void Test_Reset() {
+  int32_t ack;
+
+  Detect_Seq_Reset();
+  CHECK_EQ(Frame(2, ack), 0);
+  CHECK_EQ(ack, 0);
+  CHECK_EQ(Frame(1, ack), 1);
+  CHECK_EQ(ack, 1);
+}
+
+// Drops are logged as one summary line per DETECT_SEQ_REPORT_MS, nothing when there were none
+static void Test_Report() {
+  int32_t ack;
+
+  Host_Millis = 100000;
+  Serial.out.clear();
+  Detect_Seq_Poll();
+  Serial.out.clear();
+
+  for (int i = 0; i < 50; i++)
+    Frame(1, ack);
+  Host_Millis += DETECT_SEQ_REPORT_MS - 1;
+  Detect_Seq_Poll();
+  CHECK_STR(Serial.out.c_str(), "");
+  Host_Millis += 1;
+  Detect_Seq_Poll();
+  CHECK_STR(Serial.out.c_str(), "Detect sequence: 0 gaps, 50 duplicates (next 2, 4 gaps, 53 duplicates in all)\n");
+
+  Serial.out.clear();
+  Host_Millis += DETECT_SEQ_REPORT_MS;
+  Detect_Seq_Poll();
+  CHECK_STR(Serial.out.c_str(), "");
+}
+
+int main() {
+  Test_In_Order();
+  Test_Duplicates();
+  Test_Gaps();
+  Test_Wraparound();
+  Test_Reset();
+  Test_Report();
+  return Test_Done("detect_seq");
+}
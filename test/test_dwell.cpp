@@ -0,0 +1,66 @@
+/* Vehicle dwell and the adaptive relay hold, src/dwell.cpp
+ */
+
+#include <Arduino.h>
+#include "config.h"
+#include "dwell.h"
+#include "test.h"
+
+#define POT_TICKS     100     // 10 s on the pot
+
+// Passes on a lane, each dwell_ms long, detection times from at on
+static unsigned long Passes(uint8_t lane, int n, unsigned long dwell_ms, unsigned long at) {
+  for (int i = 0; i < n; i++) {
+    Dwell_Track(lane, 1, at);
+    Dwell_Track(lane, 0, at + dwell_ms);
+    at += dwell_ms + 1000;
+  }
+  return at;
+}
+
+// The pot setting until ADAPTIVE_MIN_SAMPLES passes were seen, then the percentile plus the margin
+static void Test_Min_Samples() {
+  unsigned long at = Passes(0, ADAPTIVE_MIN_SAMPLES - 1, 2000, 0);
+
+  CHECK_EQ(Dwell_Hold_Ticks(0, POT_TICKS, 0), POT_TICKS);
+  Passes(0, 1, 2000, at);
+  CHECK_EQ(Dwell_Hold_Ticks(0, POT_TICKS, 0), (2000 + ADAPTIVE_MARGIN_MS) / 100);
+  // Lanes are kept apart
+  CHECK_EQ(Dwell_Hold_Ticks(1, POT_TICKS, 0), POT_TICKS);
+}
+
+// Relaytiming "out", a pot at 0 and a pot shorter than the estimate all keep the pot setting
+static void Test_Pot_Wins() {
+  CHECK_EQ(Dwell_Hold_Ticks(0, POT_TICKS, 1), POT_TICKS);
+  CHECK_EQ(Dwell_Hold_Ticks(0, 0, 0), 0);
+  CHECK_EQ(Dwell_Hold_Ticks(0, 10, 0), 10);
+}
+
+// Chatter and stuck detections are not fed to the estimate, a hold never goes below ADAPTIVE_MIN_HOLD_MS
+static void Test_Limits() {
+  unsigned long at = 0;
+
+  at = Passes(1, 50, DWELL_MIN_MS - 1, at);
+  at = Passes(1, 50, DWELL_MAX_MS + 1, at);
+  CHECK_EQ(Dwell_Hold_Ticks(1, POT_TICKS, 0), POT_TICKS);
+
+  Passes(1, ADAPTIVE_MIN_SAMPLES, 200, at);
+  CHECK_EQ(Dwell_Hold_Ticks(1, POT_TICKS, 0), ADAPTIVE_MIN_HOLD_MS / 100);
+}
+
+// Passes across the sensor clock's 32-bit wrap count like any other
+static void Test_Clock_Wrap() {
+  for (int i = 0; i < 200; i++) {
+    Dwell_Track(1, 1, 0xFFFFFFFFUL - 999);
+    Dwell_Track(1, 0, 2000);
+  }
+  CHECK_EQ(Dwell_Hold_Ticks(1, POT_TICKS, 0), (3000 + ADAPTIVE_MARGIN_MS) / 100);
+}
+
+int main() {
+  Test_Min_Samples();
+  Test_Pot_Wins();
+  Test_Limits();
+  Test_Clock_Wrap();
+  return Test_Done("dwell");
+}
@@ -0,0 +1,319 @@
+/* Sensor firmware update, src/fw_update.cpp: staging with its CRC check, and the block lines on the link
+ *
+ * The link is the UART transport (the default build), faked here: it takes whatever it is given, in lines.
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include <rom/crc.h>
+#include "console.h"
+#include "fw_update.h"
+#include "transport.h"
+#include "test.h"
+
+static std::vector<std::string>  Link_Lines;
+static size_t                    Link_Max_Write = 512;
+static bool                      Link_Ready = true;
+static int                       Link_Credits = -1;     // writes the link has room for like BLE, -1: any
+
+bool UartTransport::ready() {
+  return Link_Ready;
+}
+
+size_t UartTransport::write(const char* data, size_t length) {
+  Link_Lines.push_back(std::string(data, length));
+  if (Link_Credits > 0)
+    Link_Credits--;
+  return length;
+}
+
+size_t UartTransport::writeRoom() {
+  return Link_Credits != 0 ? 4096 : 0;
+}
+
+size_t UartTransport::maxWrite() {
+  return Link_Max_Write;
+}
+
+static size_t   Take_Left = 0;
+static void     (*Take_Sink)(const uint8_t* data, size_t length) = nullptr;
+
+void Console_Take(size_t length, void (*sink)(const uint8_t* data, size_t length)) {
+  Take_Left = sink != nullptr ? length : 0;
+  Take_Sink = sink;
+}
+
+// "fw <args>" on the console, returns the reply
+static std::string Command(const char* args) {
+  char line[CONSOLE_LINE_SIZE];
+
+  snprintf(line, sizeof(line), "%s", args);
+  Serial.out.clear();
+  Fw_Command(line);
+  return Serial.out;
+}
+
+// The raw bytes after "fw stage", in console chunks
+static std::string Stage_Data(const std::vector<uint8_t>& image) {
+  Serial.out.clear();
+  for (size_t at = 0; at < image.size() && Take_Left > 0;) {
+    size_t n = min(min((size_t)CONSOLE_RAW_CHUNK, Take_Left), image.size() - at);
+    Take_Left -= n;
+    Take_Sink(image.data() + at, n);
+    at += n;
+  }
+  return Serial.out;
+}
+
+static uint32_t Crc(const std::vector<uint8_t>& data) {
+  return crc32_le(0, data.data(), data.size());
+}
+
+static std::string Stage(const std::vector<uint8_t>& image, uint32_t crc) {
+  char args[48];
+
+  snprintf(args, sizeof(args), "stage %u %08lx", (unsigned)image.size(), (unsigned long)crc);
+  std::string reply = Command(args);
+  if (reply.rfind("@OK", 0) != 0)
+    return reply;
+  return Stage_Data(image);
+}
+
+static void Poll(unsigned long now) {
+  Host_Millis = now;
+  Fw_Poll();
+}
+
+static int Base64_Value(char c) {
+  const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const char* at = c != '\0' ? strchr(chars, c) : nullptr;
+  return at != nullptr ? (int)(at - chars) : -1;
+}
+
+// Strict decoder: whole groups of four, '=' only at the end
+static bool Base64_Decode(const std::string& text, std::vector<uint8_t>& out) {
+  out.clear();
+  if (text.size() % 4 != 0)
+    return false;
+  for (size_t i = 0; i < text.size(); i += 4) {
+    bool last = i + 4 == text.size();
+    int  pad = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+    int  v[4];
+    for (int k = 0; k < 4 - pad; k++) {
+      if ((v[k] = Base64_Value(text[i + k])) < 0)
+        return false;
+    }
+    if (pad == 1 && text[i + 2] == '=')
+      return false;
+    uint32_t bits = (uint32_t)v[0] << 18 | (uint32_t)v[1] << 12 | (pad < 2 ? (uint32_t)v[2] << 6 : 0) |
+                    (pad < 1 ? (uint32_t)v[3] : 0);
+    out.push_back(bits >> 16);
+    if (pad < 2)
+      out.push_back((bits >> 8) & 0xFF);
+    if (pad < 1)
+      out.push_back(bits & 0xFF);
+  }
+  return true;
+}
+
+struct Block_Line {
+  unsigned          block;
+  unsigned long     crc;
+  std::vector<uint8_t> data;
+};
+
+// 13:<block>,<crc32>,<base64>\n
+static bool Parse_Block(const std::string& line, Block_Line& b) {
+  int consumed = 0;
+
+  if (line.size() < 2 || line.back() != '\n')
+    return false;
+  if (sscanf(line.c_str(), "13:%u,%8lx,%n", &b.block, &b.crc, &consumed) != 2 || consumed == 0)
+    return false;
+  return Base64_Decode(line.substr(consumed, line.size() - consumed - 1), b.data);
+}
+
+static std::vector<uint8_t> Bytes(const char* s) {
+  return std::vector<uint8_t>(s, s + strlen(s));
+}
+
+// The ROM's CRC-32 is the one the sensor checks, zlib's
+static void Test_Crc() {
+  std::vector<uint8_t> check = Bytes("123456789");
+
+  CHECK_EQ(Crc(check), 0xCBF43926UL);
+  CHECK_EQ(crc32_le(0, nullptr, 0), 0);
+  uint32_t part = crc32_le(0, check.data(), 4);
+  CHECK_EQ(crc32_le(part, check.data() + 4, 5), 0xCBF43926UL);
+}
+
+static void Test_Stage_Usage() {
+  CHECK(Command("stage").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("stage 0 12345678").rfind("@ERR,usage", 0) == 0);
+  // A missing CRC is not CRC 0
+  CHECK(Command("stage 1000").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("stage 1000 ").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("stage 1000 xyz").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("stage 1000 1234 5").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("stage 1000000 12345678").rfind("@ERR,image larger", 0) == 0);
+  CHECK(Command("send").rfind("@ERR,no staged image", 0) == 0);
+}
+
+static void Test_Stage_Crc() {
+  std::vector<uint8_t> image = Bytes("hello");
+
+  CHECK_STR(Stage(image, Crc(image) ^ 1).c_str(), "@ERR,crc 3610a686, expected 3610a687\n");
+  CHECK(Command("send").rfind("@ERR,no staged image", 0) == 0);
+  CHECK_STR(Stage(image, Crc(image)).c_str(), "@OK,staged 5 bytes\n");
+}
+
+// Runs a transfer of what is staged to the end, returns the block lines
+static std::vector<Block_Line> Transfer(unsigned long& now, size_t size, uint32_t crc, unsigned block_size) {
+  std::vector<Block_Line> blocks;
+  char                    offer[48];
+  unsigned                count = (size + block_size - 1) / block_size;
+
+  Link_Lines.clear();
+  CHECK_STR(Command("send").c_str(), "@OK\n");
+  snprintf(offer, sizeof(offer), "12:%u,%08lx,%u\n", (unsigned)size, (unsigned long)crc, block_size);
+  if (!CHECK_EQ(Link_Lines.size(), 1))
+    return blocks;
+  CHECK_STR(Link_Lines[0].c_str(), offer);
+
+  Fw_Ack(0);
+  while (blocks.size() < count) {
+    size_t seen = Link_Lines.size();
+    Poll(now += 10);
+    if (!CHECK(Link_Lines.size() > seen))
+      break;
+    for (size_t i = seen; i < Link_Lines.size(); i++) {
+      Block_Line b;
+      if (CHECK(Parse_Block(Link_Lines[i], b)))
+        blocks.push_back(b);
+    }
+    if (!blocks.empty())
+      Fw_Ack(blocks.back().block + 1);
+  }
+  Poll(now += 10);
+  Fw_Result(0);
+  Serial.out.clear();
+  Poll(now += 10);
+  CHECK(Serial.out.find("@FW,done,") != std::string::npos);
+  return blocks;
+}
+
+// Exact lines for the padding cases
+static void Test_Block_Line() {
+  const char* const images[] = {"hello", "f", "fo", "123456789"};
+  const char* const lines[] = {"13:0,3610a686,aGVsbG8=\n", "13:0,76d32be0,Zg==\n", "13:0,af73a217,Zm8=\n",
+                               "13:0,cbf43926,MTIzNDU2Nzg5\n"};
+  unsigned long     now = 1000;
+
+  for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++) {
+    std::vector<uint8_t> image = Bytes(images[i]);
+    CHECK(Stage(image, Crc(image)).rfind("@OK,staged", 0) == 0);
+    Link_Lines.clear();
+    CHECK_STR(Command("send").c_str(), "@OK\n");
+    Fw_Ack(0);
+    Poll(now += 10);
+    CHECK_EQ(Link_Lines.size(), 2);
+    if (Link_Lines.size() >= 2)
+      CHECK_STR(Link_Lines[1].c_str(), lines[i]);
+    CHECK(Command("abort").find("@OK\n") != std::string::npos);
+  }
+}
+
+// Every block of a larger image decodes to its part of the image and matches its CRC
+static void Test_Blocks(size_t size, size_t max_write, unsigned block_size) {
+  std::vector<uint8_t>  image(size);
+  unsigned long         now = 100000;
+  uint32_t              seed = (uint32_t)size;
+
+  for (uint8_t& b : image) {
+    seed = seed * 1103515245u + 12345u;
+    b = (uint8_t)(seed >> 16);
+  }
+  CHECK(Stage(image, Crc(image)).rfind("@OK,staged", 0) == 0);
+
+  Link_Max_Write = max_write;
+  std::vector<Block_Line> blocks = Transfer(now, size, Crc(image), block_size);
+  Link_Max_Write = 512;
+
+  std::vector<uint8_t> received;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    CHECK_EQ(blocks[i].block, i);
+    CHECK_EQ(blocks[i].crc, crc32_le(0, blocks[i].data.data(), blocks[i].data.size()));
+    CHECK(blocks[i].data.size() == block_size || i + 1 == blocks.size());
+    CHECK(Link_Lines.size() > i + 1 && Link_Lines[i + 1].size() <= max_write);
+    received.insert(received.end(), blocks[i].data.begin(), blocks[i].data.end());
+  }
+  CHECK(received == image);
+}
+
+static void Test_Short_Writes() {
+  std::vector<uint8_t> image = Bytes("hello");
+
+  CHECK(Stage(image, Crc(image)).rfind("@OK,staged", 0) == 0);
+  Link_Max_Write = 30;
+  Link_Lines.clear();
+  Serial.out.clear();
+  CHECK_STR(Command("send").c_str(), "Sensor firmware update failed: link writes too short for a block\n@OK\n");
+  CHECK_EQ(Link_Lines.size(), 0);
+  Link_Max_Write = 512;
+}
+
+// Answers after the transfer ended do not start anything
+static void Test_Stray_Acks() {
+  size_t seen = Link_Lines.size();
+
+  Fw_Ack(0);
+  Fw_Result(0);
+  Poll(Host_Millis + 5000);
+  CHECK_EQ(Link_Lines.size(), seen);
+}
+
+// A link with room for one write at a time: the loop's idle time goes to sending blocks as room comes back
+static void Test_Paced_Link() {
+  std::vector<uint8_t> image(FW_WINDOW * FW_BLOCK_SIZE);
+  unsigned long        now = Host_Millis + 1000;
+
+  CHECK(Stage(image, Crc(image)).rfind("@OK,staged", 0) == 0);
+  Link_Lines.clear();
+  CHECK_STR(Command("send").c_str(), "@OK\n");
+  Fw_Ack(0);
+  Link_Credits = 1;
+  Poll(now);
+  CHECK_EQ(Link_Lines.size(), 2);
+
+  // One write comes back every FW_PACE_MS
+  for (int slice = 0; slice < 10; slice++) {
+    Link_Credits = 1;
+    Fw_Delay(FW_PACE_MS);
+  }
+  CHECK_EQ(Link_Lines.size(), 12);
+  CHECK_EQ(Host_Millis, now + 10 * FW_PACE_MS);
+
+  // Not past the window without acks
+  Link_Credits = -1;
+  Fw_Delay(100);
+  CHECK_EQ(Link_Lines.size(), 1 + FW_WINDOW);
+  CHECK_EQ(Host_Millis, now + 10 * FW_PACE_MS + 100);
+
+  CHECK_STR(Command("abort").c_str(), "Sensor firmware update failed: aborted\n@OK\n");
+  Fw_Delay(100);
+  CHECK_EQ(Host_Millis, now + 10 * FW_PACE_MS + 200);
+}
+
+int main() {
+  Test_Crc();
+  Test_Stage_Usage();
+  Test_Stage_Crc();
+  Test_Block_Line();
+  Test_Blocks(1000, 512, FW_BLOCK_SIZE);
+  Test_Blocks(3000, 100, 32);
+  Test_Short_Writes();
+  Test_Stray_Acks();
+  Test_Paced_Link();
+  return Test_Done("fw_update");
+}
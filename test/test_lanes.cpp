@@ -0,0 +1,201 @@
+/* Two-channel lane model, src/lanes.cpp: lanes to outputs, holds, barrier and counter mode, relay time per lane
+ */
+
+#include <Arduino.h>
+#include <string>
+#include "controller.h"
+#include "indicator.h"
+#include "lanes.h"
+#include "rollup.h"
+#include "rules.h"
+#include "test.h"
+
+uint8_t   OPERATIONMODE_PARAM     = 0;
+uint8_t   RELAYTIMING_PARAM       = 0;
+int       RELAYTIMER_PARAM        = 3;
+uint8_t   TWOCHANNLEMODE_PARAM    = 1;
+uint8_t   TWOINONEMODE_PARAM      = 0;
+uint8_t   RELAYTIMING_PARAM1      = 0;
+int       RELAYTIMER_PARAM1       = 5;
+int       Frame_Log               = 0;
+
+const int Relay_Pins[OUTPUT_COUNT] = {21, 25};
+
+// What the outputs told the rest of the controller
+static std::string  Events;               // R values in order
+static int          Lane_Relay[LANE_COUNT];   // Rollup_Relay: 1 on, 0 off, -1 not called
+static int          Relay_Lamp = -1;
+static int          Mirrors = 0;
+
+void Report_Event(char kind, int value) {
+  Events += kind;
+  Events += std::to_string(value);
+  Events += ' ';
+}
+
+void Indicator_Set(uint8_t led, bool on) {
+  if (led == IND_RELAY)
+    Relay_Lamp = on;
+}
+
+void Rollup_Relay(uint8_t lane, bool on) {
+  Lane_Relay[lane] = on;
+}
+
+void Warm_Mirror() {
+  Mirrors++;
+}
+
+static void Setup(uint8_t mode, uint8_t twochannel, uint8_t twoinone) {
+  OPERATIONMODE_PARAM = mode;
+  TWOCHANNLEMODE_PARAM = twochannel;
+  TWOINONEMODE_PARAM = twoinone;
+  Rules_Compile();
+  for (uint8_t i = 0; i < OUTPUT_COUNT; i++)
+    Relay_Channels[i] = {0, false, false, 0, 0, i};
+  Events.clear();
+  Lane_Relay[0] = Lane_Relay[1] = -1;
+}
+
+static void Ticks(int n) {
+  while (n-- > 0)
+    Relay_Tick();
+}
+
+static void Test_Routing() {
+  Setup(0, 0, 0);
+  CHECK(Lane_Enabled(0));
+  CHECK(!Lane_Enabled(1));
+  TWOCHANNLEMODE_PARAM = 1;
+  CHECK(Lane_Enabled(1));
+
+  CHECK_EQ(Lane_Output(0), 0);
+  CHECK_EQ(Lane_Output(1), 1);
+  TWOINONEMODE_PARAM = 1;
+  CHECK_EQ(Lane_Output(0), 0);
+  CHECK_EQ(Lane_Output(1), 0);
+
+  CHECK_EQ(Relay_Hold_Ticks(0), 30);
+  CHECK_EQ(Relay_Hold_Ticks(1), 50);
+}
+
+// Warning light: each lane holds its own output for its own relay timer
+static void Test_Hold() {
+  Setup(0, 1, 0);
+  Lane_Detect(1, 1);
+  CHECK(Relay_Channels[1].out);
+  CHECK(!Relay_Channels[0].out);
+  CHECK_EQ(Host_Pin_Level[25], HIGH);
+  CHECK_EQ(Relay_Lamp, 1);
+  CHECK_EQ(Lane_Relay[1], 1);
+  CHECK(Relay_Busy());
+
+  Lane_Detect(0, 1);
+  CHECK_EQ(Host_Pin_Level[21], HIGH);
+  CHECK_STR(Events.c_str(), "R3 R1 ");
+
+  // Leaving does nothing with relaytiming "in"
+  Lane_Detect(0, 0);
+  CHECK(Relay_Channels[0].out);
+
+  Ticks(31);
+  CHECK(!Relay_Channels[0].out);
+  CHECK_EQ(Host_Pin_Level[21], LOW);
+  CHECK(Relay_Channels[1].out);
+  CHECK_EQ(Relay_Lamp, 1);
+  Ticks(20);
+  CHECK(!Relay_Channels[1].out);
+  CHECK_EQ(Lane_Relay[1], 0);
+  CHECK_EQ(Relay_Lamp, 0);
+  CHECK(!Relay_Busy());
+  CHECK_STR(Events.c_str(), "R3 R1 R0 R2 ");
+
+  // Relay timer 0: no hold at all
+  RELAYTIMER_PARAM1 = 0;
+  Events.clear();
+  Lane_Detect(1, 1);
+  CHECK(!Relay_Channels[1].on);
+  CHECK_STR(Events.c_str(), "");
+  RELAYTIMER_PARAM1 = 5;
+}
+
+// Two-in-one: lane 1 takes over output 0, its relay time is booked to lane 1 from then on
+static void Test_Two_In_One() {
+  Setup(1, 1, 1);
+  Lane_Detect(0, 1);
+  CHECK(Relay_Channels[0].out);
+  CHECK_EQ(Lane_Relay[0], 1);
+
+  Lane_Detect(1, 1);
+  CHECK_EQ(Relay_Channels[0].lane, 1);
+  CHECK_EQ(Lane_Relay[0], 0);
+  CHECK_EQ(Lane_Relay[1], 1);
+  CHECK(!Relay_Channels[1].out);
+
+  Lane_Detect(1, 0);
+  CHECK(!Relay_Channels[0].out);
+  CHECK_EQ(Lane_Relay[1], 0);
+  CHECK_EQ(Host_Pin_Level[21], LOW);
+  CHECK_STR(Events.c_str(), "R1 R1 R0 ");
+}
+
+// Counter: passes from both lanes on one output, lane 0's first, each pulse booked to its lane
+static void Test_Counter() {
+  Setup(2, 1, 1);
+  Lane_Detect(1, 1);
+  Lane_Detect(0, 1);
+  Lane_Detect(0, 1);
+  CHECK_EQ(Relay_Channels[0].queued, 3);
+  CHECK_EQ(Relay_Channels[0].queued1, 1);
+  CHECK_STR(Events.c_str(), "");
+
+  int pulses[LANE_COUNT] = {0, 0};
+  for (int tick = 0; tick < 3 * (RELAY_PULSE_TICKS + 2); tick++) {
+    bool was = Relay_Channels[0].out;
+    Relay_Tick();
+    if (!was && Relay_Channels[0].out)
+      pulses[Relay_Channels[0].lane]++;
+  }
+  CHECK_EQ(pulses[0], 2);
+  CHECK_EQ(pulses[1], 1);
+  CHECK_EQ(Relay_Channels[0].queued, 0);
+  CHECK_EQ(Relay_Channels[0].queued1, 0);
+  CHECK_EQ(Lane_Relay[1], 0);
+  CHECK_STR(Events.c_str(), "R1 R0 R1 R0 R1 R0 ");
+  CHECK(!Relay_Busy());
+
+  // Separate outputs count separately
+  Setup(2, 1, 0);
+  Lane_Detect(1, 1);
+  Ticks(1);
+  CHECK(Relay_Channels[1].out);
+  CHECK(!Relay_Channels[0].out);
+  CHECK_EQ(Host_Pin_Level[25], HIGH);
+  Ticks(RELAY_PULSE_TICKS + 1);
+  CHECK(!Relay_Channels[1].out);
+  CHECK_STR(Events.c_str(), "R3 R2 ");
+}
+
+// relaytiming per lane: lane 1 triggers as the vehicle leaves
+static void Test_Timing() {
+  RELAYTIMING_PARAM1 = 1;
+  Setup(0, 1, 0);
+  Lane_Detect(1, 1);
+  CHECK(!Relay_Channels[1].out);
+  Lane_Detect(0, 0);
+  CHECK(!Relay_Channels[0].out);
+  Lane_Detect(1, 0);
+  CHECK(Relay_Channels[1].out);
+  RELAYTIMING_PARAM1 = 0;
+}
+
+int main() {
+  Rules_Begin();
+  Test_Routing();
+  Test_Hold();
+  Test_Two_In_One();
+  Test_Counter();
+  Test_Timing();
+  CHECK(Mirrors > 0);
+  return Test_Done("lanes");
+}
@@ -0,0 +1,114 @@
+/* Event line format and parser, include/mobi_event.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mobi_event.h"
+#include "test.h"
+
+static int Parse(const char* line, mobi_event_t* ev) {
+  return mobi_event_parse(line, strlen(line), ev);
+}
+
+static void Test_Parse_Valid() {
+  mobi_event_t ev;
+
+  CHECK(Parse("@EV,12,34567,D,3", &ev));
+  CHECK_EQ(ev.seq, 12);
+  CHECK_EQ(ev.ms, 34567);
+  CHECK_EQ(ev.kind, MOBI_EV_DETECT);
+  CHECK_EQ(ev.value, 3);
+
+  // A CR from a terminal ends the line as well
+  CHECK(Parse("@EV,1,2,R,0\r", &ev));
+  CHECK_EQ(ev.kind, MOBI_EV_RELAY);
+  CHECK_EQ(ev.value, 0);
+
+  CHECK(Parse("@EV,4294967295,4294967295,E,-1", &ev));
+  CHECK_EQ(ev.seq, 4294967295UL);
+  CHECK_EQ(ev.ms, 4294967295UL);
+  CHECK_EQ(ev.value, -1);
+
+  for (const char* kinds = "DRELF"; *kinds != '\0'; kinds++) {
+    char line[MOBI_EVENT_MAX_LINE];
+    snprintf(line, sizeof(line), "@EV,1,1,%c,1", *kinds);
+    CHECK(Parse(line, &ev));
+    CHECK_EQ(ev.kind, *kinds);
+  }
+}
+
+static void Test_Parse_Invalid() {
+  mobi_event_t ev;
+
+  CHECK(!Parse("", &ev));
+  CHECK(!Parse("@EV", &ev));
+  CHECK(!Parse("@EV,", &ev));
+  CHECK(!Parse("EV,1,2,D,1", &ev));
+  CHECK(!Parse("@EX,1,2,D,1", &ev));
+  CHECK(!Parse("Relay_Count : 30", &ev));
+  CHECK(!Parse("@EV,,2,D,1", &ev));
+  CHECK(!Parse("@EV,1,,D,1", &ev));
+  CHECK(!Parse("@EV,1,2,,1", &ev));
+  CHECK(!Parse("@EV,1,2,D,", &ev));
+  CHECK(!Parse("@EV,1,2,X,1", &ev));
+  CHECK(!Parse("@EV,1,2,DD,1", &ev));
+  CHECK(!Parse("@EV,1,2,D,1x", &ev));
+  CHECK(!Parse("@EV,1;2,D,1", &ev));
+
+  // Too long for the line buffer, even though the fields are fine
+  char line[MOBI_EVENT_MAX_LINE + 8];
+  memset(line, '0', sizeof(line));
+  memcpy(line, "@EV,", 4);
+  memcpy(line + sizeof(line) - 8, ",1,D,1", 7);
+  CHECK(!Parse(line, &ev));
+
+  // Only length bytes count, the rest of the buffer is not read
+  CHECK(!mobi_event_parse("@EV,1,2,D,1", 9, &ev));
+  CHECK(mobi_event_parse("@EV,1,2,D,1garbage", 11, &ev));
+  CHECK_EQ(ev.value, 1);
+}
+
+// What the controller writes parses back to the same event
+static void Test_Format_Round_Trip() {
+  char          line[MOBI_EVENT_MAX_LINE];
+  mobi_event_t  ev;
+  int           length = snprintf(line, sizeof(line), MOBI_EVENT_FMT, 4294967295UL, 4294967295UL, MOBI_EV_ERROR,
+                                  MOBI_EV_ERROR_VALUE(1, 99));
+
+  CHECK(length > 0 && (size_t)length < sizeof(line));
+  CHECK_EQ(line[length - 1], '\n');
+  CHECK(mobi_event_parse(line, length - 1, &ev));
+  CHECK_EQ(ev.seq, 4294967295UL);
+  CHECK_EQ(ev.kind, MOBI_EV_ERROR);
+  CHECK_EQ(ev.value, 199);
+}
+
+static void Test_Values() {
+  CHECK_EQ(MOBI_EV_VALUE(0, 1), 1);
+  CHECK_EQ(MOBI_EV_VALUE(1, 0), 2);
+  CHECK_EQ(MOBI_EV_VALUE(1, 1), 3);
+  for (int channel = 0; channel < 2; channel++) {
+    for (int on = 0; on < 2; on++) {
+      CHECK_EQ(MOBI_EV_CHANNEL(MOBI_EV_VALUE(channel, on)), channel);
+      CHECK_EQ(MOBI_EV_ON(MOBI_EV_VALUE(channel, on)), on);
+    }
+  }
+
+  // A clear on lane 1 is told apart from one on lane 0
+  CHECK_EQ(MOBI_EV_ERROR_VALUE(0, 0), 0);
+  CHECK_EQ(MOBI_EV_ERROR_VALUE(1, 0), 100);
+  CHECK_EQ(MOBI_EV_ERROR_OF(MOBI_EV_ERROR_VALUE(1, 0)), 1);
+  CHECK_EQ(MOBI_EV_ERROR_CODE(MOBI_EV_ERROR_VALUE(1, 0)), 0);
+  CHECK_EQ(MOBI_EV_ERROR_OF(MOBI_EV_ERROR_VALUE(1, 99)), 1);
+  CHECK_EQ(MOBI_EV_ERROR_CODE(MOBI_EV_ERROR_VALUE(1, 99)), 99);
+  CHECK_EQ(MOBI_EV_ERROR_OF(MOBI_EV_ERROR_VALUE(0, 42)), 0);
+  CHECK_EQ(MOBI_EV_ERROR_CODE(MOBI_EV_ERROR_VALUE(0, 42)), 42);
+}
+
+int main() {
+  Test_Parse_Valid();
+  Test_Parse_Invalid();
+  Test_Format_Round_Trip();
+  Test_Values();
+  return Test_Done("mobi_event");
+}
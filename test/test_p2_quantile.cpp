@@ -0,0 +1,130 @@
+/* Streaming quantile estimate, src/p2_quantile.cpp
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "p2_quantile.h"
+#include "test.h"
+
+// Fixed-seed generator, the same stream on every run
+static uint32_t Random_State = 12345;
+
+static float Random_Uniform() {
+  Random_State = Random_State * 1664525u + 1013904223u;
+  return (float)((Random_State >> 8) + 0.5) / 16777216.0f;
+}
+
+// The exact quantile of the samples, nearest rank
+static float Exact(std::vector<float> samples, float p) {
+  std::sort(samples.begin(), samples.end());
+  return samples[(size_t)(p * (samples.size() - 1) + 0.5f)];
+}
+
+static void Test_Few_Samples() {
+  P2Quantile q(0.5f);
+
+  CHECK_EQ(q.count(), 0);
+  CHECK_NEAR(q.value(), 0, 0);
+
+  // Up to five samples the markers hold them sorted and the value is the nearest rank
+  q.add(30);
+  CHECK_NEAR(q.value(), 30, 0);
+  q.add(10);
+  q.add(20);
+  CHECK_EQ(q.count(), 3);
+  CHECK_NEAR(q.value(), 20, 0);
+
+  P2Quantile q90(0.9f);
+  for (float x : {5.0f, 1.0f, 4.0f, 2.0f, 3.0f})
+    q90.add(x);
+  CHECK_NEAR(q90.value(), 3, 0);
+  CHECK_NEAR(q90.quantile(), 0.9, 1e-6);
+
+  q.reset();
+  CHECK_EQ(q.count(), 0);
+  CHECK_NEAR(q.value(), 0, 0);
+  q.add(7);
+  CHECK_NEAR(q.value(), 7, 0);
+}
+
+static void Test_Constant() {
+  P2Quantile q(0.9f);
+
+  for (int i = 0; i < 1000; i++)
+    q.add(4200);
+  CHECK_EQ(q.count(), 1000);
+  CHECK_NEAR(q.value(), 4200, 0);
+}
+
+static void Test_Uniform() {
+  const float         ps[] = {0.5f, 0.9f};
+  std::vector<float>  samples;
+
+  for (int i = 0; i < 10000; i++)
+    samples.push_back(1000 + 9000 * Random_Uniform());
+  for (float p : ps) {
+    P2Quantile q(p);
+    for (float x : samples)
+      q.add(x);
+    CHECK_NEAR(q.value(), Exact(samples, p), 0.01 * 9000);
+  }
+}
+
+// Dwell times are skewed: most vehicles pass quickly, a few stop
+static void Test_Skewed() {
+  std::vector<float>  samples;
+  P2Quantile          q(0.9f);
+
+  for (int i = 0; i < 5000; i++) {
+    float dwell = 800 - 2000 * logf(Random_Uniform());
+    samples.push_back(dwell);
+    q.add(dwell);
+  }
+  float exact = Exact(samples, 0.9f);
+  CHECK_NEAR(q.value(), exact, 0.05 * exact);
+}
+
+// Sorted input is the worst case for the marker adjustment
+static void Test_Sorted() {
+  P2Quantile q(0.5f);
+
+  for (int i = 1; i <= 1001; i++)
+    q.add((float)i);
+  CHECK_NEAR(q.value(), 501, 0.05 * 1001);
+}
+
+// The estimate closes in on the exact quantile as samples come in, and follows a stream that shifts
+static void Test_Convergence() {
+  const size_t        checkpoints[] = {100, 1000, 10000};
+  const double        tolerance[] = {0.10, 0.03, 0.01};
+  std::vector<float>  samples;
+  P2Quantile          q(0.9f);
+  size_t              next = 0;
+
+  while (next < 3) {
+    float x = 1000 + 9000 * Random_Uniform();
+    samples.push_back(x);
+    q.add(x);
+    if (samples.size() == checkpoints[next]) {
+      CHECK_NEAR(q.value(), Exact(samples, 0.9f), tolerance[next] * 9000);
+      next++;
+    }
+  }
+
+  // Every vehicle now takes 20 s: the markers move up with the stream, they do not stay with the old samples
+  for (int i = 0; i < 20000; i++)
+    q.add(20000 + 100 * Random_Uniform());
+  CHECK_NEAR(q.value(), 20090, 0.01 * 20000);
+}
+
+int main() {
+  Test_Few_Samples();
+  Test_Constant();
+  Test_Uniform();
+  Test_Skewed();
+  Test_Sorted();
+  Test_Convergence();
+  return Test_Done("p2_quantile");
+}
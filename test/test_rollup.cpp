@@ -0,0 +1,183 @@
+/* Traffic rollups, src/rollup.cpp: accounting per lane and the NVS checkpoints
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "rollup.h"
+#include "test.h"
+
+#define MINUTE_MS   60000UL
+
+// The lines of Rollup_Print() that start with prefix
+static std::string Print_Lines(const char* prefix) {
+  std::string lines;
+
+  Serial.out.clear();
+  Rollup_Print();
+  for (size_t at = 0; at < Serial.out.size();) {
+    size_t end = Serial.out.find('\n', at);
+    if (Serial.out.compare(at, strlen(prefix), prefix) == 0)
+      lines += Serial.out.substr(at, end + 1 - at);
+    at = end + 1;
+  }
+  return lines;
+}
+
+static void Boot() {
+  Host_Millis = 0;
+  Serial.out.clear();
+  Rollup_Begin();
+}
+
+static void Test_Accounting() {
+  Host_Prefs_Clear();
+  Boot();
+  CHECK(Serial.out.find("no checkpoint") != std::string::npos);
+
+  Rollup_Detect(0, 1);
+  Rollup_Detect(0, 0);
+  Rollup_Detect(0, 1);
+  Rollup_Detect(1, 1);
+  Host_Millis = 1000;
+  Rollup_Relay(1, true);
+  Rollup_Error(0, true);
+  Host_Millis = 6000;
+  Rollup_Relay(1, false);
+  Host_Millis = 9000;
+  Rollup_Error(0, false);
+  Rollup_Error(0, true);
+  Host_Millis = 10000;
+  Rollup_Error(0, false);
+
+  // Relay time goes to the lane it was booked for
+  CHECK_STR(Print_Lines("@RU,0,t").c_str(), "@RU,0,t,2/1/2/0/9/2\n");
+  CHECK_STR(Print_Lines("@RU,1,t").c_str(), "@RU,1,t,1/0/1/5/0/0\n");
+  CHECK_STR(Print_Lines("@RU,1,m").c_str(), "@RU,1,m,1/0/1/5/0\n");
+
+  // The next minute starts a bucket, the hour keeps counting
+  Host_Millis = MINUTE_MS;
+  Rollup_Poll();
+  Rollup_Detect(1, 1);
+  CHECK_STR(Print_Lines("@RU,1,m").c_str(), "@RU,1,m,1/0/1/0/0;1/0/1/5/0\n");
+  CHECK_STR(Print_Lines("@RU,1,h").c_str(), "@RU,1,h,2/0/1/5/0\n");
+}
+
+// A checkpoint writes what changed, a reboot continues from it
+static void Test_Checkpoint() {
+  Host_Prefs_Clear();
+  Boot();
+  Rollup_Checkpoint_Min = ROLLUP_CHECKPOINT_MIN;
+
+  Rollup_Detect(0, 1);
+  Rollup_Detect(1, 1);
+  Rollup_Detect(1, 0);
+  Host_Millis = ROLLUP_CHECKPOINT_MIN * MINUTE_MS - 1;
+  Rollup_Poll();
+  CHECK(Host_Prefs["rollup"].empty());
+  Host_Millis = ROLLUP_CHECKPOINT_MIN * MINUTE_MS;
+  Rollup_Poll();
+
+  // Per lane the minute, hour and day chunk and the totals, the empty minutes passed since are no change
+  Host_Prefs_Namespace& ns = Host_Prefs["rollup"];
+  CHECK_EQ(ns.size(), 2 + 2 * 4);
+  CHECK(ns.count("magic") == 1 && ns.count("minute") == 1);
+  size_t bytes = 0;
+  for (const auto& key : ns)
+    bytes += key.second.size();
+  CHECK(bytes < 1024);
+
+  std::string before[ROLLUP_LANES];
+  for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++)
+    before[lane] = Print_Lines(("@RU," + std::to_string(lane) + ",").c_str());
+  Boot();
+  CHECK(Serial.out.find("restored checkpoint from minute 10") != std::string::npos);
+
+  // Same counts, the minute ring moved on by the minute the checkpoint was taken in
+  for (uint8_t lane = 0; lane < ROLLUP_LANES; lane++) {
+    std::string prefix = "@RU," + std::to_string(lane) + ",m,";
+    std::string expected = before[lane];
+    expected.insert(prefix.size(), "0/0/0/0/0;");
+    CHECK_STR(Print_Lines(("@RU," + std::to_string(lane) + ",").c_str()).c_str(), expected.c_str());
+  }
+  CHECK_STR(Print_Lines("@RU,END").c_str(), "@RU,END,11\n");
+
+  // A quiet interval only moves the minute on
+  Host_Prefs_Namespace saved = ns;
+  Host_Millis = ROLLUP_CHECKPOINT_MIN * MINUTE_MS;
+  Rollup_Poll();
+  CHECK_EQ(ns.size(), saved.size());
+  for (const auto& key : saved) {
+    if (key.first != "minute")
+      CHECK(ns[key.first] == key.second);
+  }
+  CHECK(ns["minute"] != saved["minute"]);
+}
+
+static void Test_Interval_Setting() {
+  Host_Prefs_Clear();
+  Boot();
+
+  Rollup_Checkpoint_Min = 1;
+  Rollup_Detect(0, 1);
+  Host_Millis = MINUTE_MS;
+  Rollup_Poll();
+  CHECK(!Host_Prefs["rollup"].empty());
+  Rollup_Checkpoint_Min = ROLLUP_CHECKPOINT_MIN;
+}
+
+// A checkpoint in the older single-blob layout is dropped, not misread
+static void Test_Old_Layout() {
+  Host_Prefs_Clear();
+  Preferences prefs;
+  uint8_t     old[3000];
+
+  memset(old, 0x5A, sizeof(old));
+  prefs.begin("rollup", false);
+  prefs.putBytes("store", old, sizeof(old));
+  prefs.end();
+
+  Boot();
+  CHECK(Serial.out.find("no checkpoint") != std::string::npos);
+  CHECK(Host_Prefs["rollup"].count("store") == 0);
+  CHECK_STR(Print_Lines("@RU,0,t").c_str(), "@RU,0,t,0/0/0/0/0/0\n");
+}
+
+// millis() wraps after 49.7 days: the minutes count on, nothing is cleared that should not be
+static void Test_Millis_Wrap() {
+  const unsigned long wrap = 0x100000000ULL;
+
+  Host_Prefs_Clear();
+  Host_Millis = wrap - 90 * 1000UL;
+  Serial.out.clear();
+  Rollup_Begin();
+  Rollup_Checkpoint_Min = 1440;
+
+  Rollup_Detect(0, 1);
+  Host_Millis = wrap - 30 * 1000UL;
+  Rollup_Poll();
+  Rollup_Relay(0, true);
+  // 30 s before and 40 s after the wrap
+  Host_Millis = 40 * 1000UL;
+  Rollup_Poll();
+  Rollup_Relay(0, false);
+  Rollup_Detect(0, 1);
+
+  CHECK_STR(Print_Lines("@RU,0,m").c_str(), "@RU,0,m,1/0/1/0/0;0/0/0/70/0;1/0/1/0/0\n");
+  CHECK_STR(Print_Lines("@RU,0,h").c_str(), "@RU,0,h,2/0/1/70/0\n");
+  CHECK_STR(Print_Lines("@RU,END").c_str(), "@RU,END,2\n");
+
+  Host_Millis = 40 * 1000UL + 2 * MINUTE_MS;
+  Rollup_Poll();
+  CHECK_STR(Print_Lines("@RU,END").c_str(), "@RU,END,4\n");
+  CHECK_STR(Print_Lines("@RU,0,t").c_str(), "@RU,0,t,2/0/1/70/0/0\n");
+  Rollup_Checkpoint_Min = ROLLUP_CHECKPOINT_MIN;
+}
+
+int main() {
+  Test_Accounting();
+  Test_Checkpoint();
+  Test_Interval_Setting();
+  Test_Old_Layout();
+  Test_Millis_Wrap();
+  return Test_Done("rollup");
+}
@@ -0,0 +1,172 @@
+/* Operation mode rules, src/rules.cpp
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "controller.h"
+#include "rules.h"
+#include "test.h"
+
+uint8_t   OPERATIONMODE_PARAM = 0;
+uint8_t   RELAYTIMING_PARAM   = 0;
+uint8_t   RELAYTIMING_PARAM1  = 0;
+
+// What Lane_Detect did for each mode before the rules table, as a RULE_* action
+static uint8_t Baseline(uint8_t mode, uint8_t detect, uint8_t timing) {
+  bool trigger = (detect == 1 && timing == 0) || (detect == 0 && timing == 1);
+
+  if (mode == 0)
+    return trigger ? RULE_HOLD : RULE_NONE;
+  if (mode == 1)
+    return detect == 1 ? RULE_ON : RULE_OFF;
+  if (mode == 2 || mode == 3)
+    return trigger ? RULE_PULSE : RULE_NONE;
+  return RULE_NONE;
+}
+
+static void Set(uint8_t mode, uint8_t timing, uint8_t timing1) {
+  OPERATIONMODE_PARAM = mode;
+  RELAYTIMING_PARAM = timing;
+  RELAYTIMING_PARAM1 = timing1;
+  Rules_Compile();
+}
+
+// "rule <args>" on the console, returns the reply
+static std::string Command(const char* args) {
+  char line[64];
+
+  snprintf(line, sizeof(line), "%s", args);
+  Serial.out.clear();
+  Rules_Command(line);
+  return Serial.out;
+}
+
+static bool Ends_Ok(const std::string& reply) {
+  return reply.size() >= 4 && reply.compare(reply.size() - 4, 4, "@OK\n") == 0;
+}
+
+// The built-in table gives the modes as they were, for every relaytiming on either lane
+static void Test_Builtin() {
+  Host_Prefs_Clear();
+  Rules_Begin();
+
+  for (uint8_t mode = 0; mode < RULE_MODES + 1; mode++) {
+    for (uint8_t timing = 0; timing < 2; timing++) {
+      for (uint8_t timing1 = 0; timing1 < 2; timing1++) {
+        Set(mode, timing, timing1);
+        for (uint8_t detect = 0; detect < 2; detect++) {
+          if (!CHECK_EQ(Rule_Action(0, detect), Baseline(mode, detect, timing)) ||
+              !CHECK_EQ(Rule_Action(1, detect), Baseline(mode, detect, timing1)))
+            printf("    mode %u, relaytiming %u/%u, detect %u\n", mode, timing, timing1, detect);
+        }
+      }
+    }
+  }
+}
+
+static void Test_List() {
+  Host_Prefs_Clear();
+  Rules_Begin();
+
+  CHECK_STR(Command("list").c_str(),
+            "@RULE,0,0,trigger,hold\n"
+            "@RULE,1,1,in,on\n"
+            "@RULE,2,1,out,off\n"
+            "@RULE,3,2,trigger,pulse\n"
+            "@RULE,4,3,trigger,pulse\n"
+            "@OK\n");
+  CHECK_STR(Command("").c_str(), Command("list").c_str());
+}
+
+// Later rules win, and the table is compiled again right away
+static void Test_Edit() {
+  Host_Prefs_Clear();
+  Rules_Begin();
+  Set(0, 0, 1);
+
+  // Warning light that also lights on the release edge
+  CHECK(Ends_Ok(Command("add 0 release hold")));
+  CHECK_EQ(Rule_Action(0, 0), RULE_HOLD);
+  CHECK_EQ(Rule_Action(0, 1), RULE_HOLD);
+  CHECK_EQ(Rule_Action(1, 0), RULE_HOLD);
+  CHECK_EQ(Rule_Action(1, 1), RULE_HOLD);
+
+  // Barrier that ignores the vehicle leaving
+  Set(1, 0, 0);
+  CHECK(Ends_Ok(Command("add 1 out none")));
+  CHECK_EQ(Rule_Action(0, 1), RULE_ON);
+  CHECK_EQ(Rule_Action(0, 0), RULE_NONE);
+
+  CHECK(Ends_Ok(Command("del 6")));
+  CHECK_EQ(Rule_Action(0, 0), RULE_OFF);
+  CHECK(Ends_Ok(Command("del 0")));
+  Set(0, 0, 0);
+  CHECK_EQ(Rule_Action(0, 0), RULE_HOLD);
+  CHECK_EQ(Rule_Action(0, 1), RULE_NONE);
+
+  CHECK(Ends_Ok(Command("reset")));
+  CHECK_EQ(Rule_Action(0, 0), RULE_NONE);
+  CHECK_EQ(Rule_Action(0, 1), RULE_HOLD);
+}
+
+static void Test_Bad_Commands() {
+  Host_Prefs_Clear();
+  Rules_Begin();
+  std::string before = Command("list");
+
+  CHECK(Command("add").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("add 4 in on").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("add 01 in on").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("add 0 up on").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("add 0 in blink").rfind("@ERR,usage", 0) == 0);
+  CHECK(Command("del").rfind("@ERR,index", 0) == 0);
+  CHECK(Command("del 5").rfind("@ERR,index", 0) == 0);
+  CHECK(Command("del -1").rfind("@ERR,index", 0) == 0);
+  CHECK(Command("del 1x").rfind("@ERR,index", 0) == 0);
+  CHECK(Command("frobnicate").rfind("@ERR,unknown", 0) == 0);
+  CHECK_STR(Command("list").c_str(), before.c_str());
+
+  for (int i = 5; i < RULES_MAX; i++)
+    CHECK(Ends_Ok(Command("add 3 in none")));
+  CHECK_STR(Command("add 3 in none").c_str(), "@ERR,rule table full\n");
+}
+
+// A saved table replaces the built-in one at boot until "rule reset"
+static void Test_Saved() {
+  Host_Prefs_Clear();
+  Rules_Begin();
+  Set(2, 0, 0);
+
+  CHECK(Ends_Ok(Command("add 2 release pulse")));
+  CHECK_STR(Command("save").c_str(), "@OK\n");
+
+  // Next boot
+  Rules_Begin();
+  Set(2, 0, 0);
+  CHECK_EQ(Rule_Action(0, 0), RULE_PULSE);
+  CHECK_EQ(Rule_Action(0, 1), RULE_PULSE);
+
+  CHECK(Ends_Ok(Command("reset")));
+  Rules_Begin();
+  Set(2, 0, 0);
+  CHECK_EQ(Rule_Action(0, 0), RULE_NONE);
+  CHECK_EQ(Rule_Action(0, 1), RULE_PULSE);
+
+  // A damaged table in NVS is not used
+  Preferences prefs;
+  const uint8_t bad[] = {7, RULE_EDGE_IN, RULE_ON};
+  prefs.begin("rules", false);
+  prefs.putBytes("table", bad, sizeof(bad));
+  prefs.end();
+  Rules_Begin();
+  CHECK(Command("list").rfind("@RULE,0,0,trigger,hold\n", 0) == 0);
+}
+
+int main() {
+  Test_Builtin();
+  Test_List();
+  Test_Edit();
+  Test_Bad_Commands();
+  Test_Saved();
+  return Test_Done("rules");
+}
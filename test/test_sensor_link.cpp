@@ -0,0 +1,197 @@
+/* Controller side of the sensor link, src/sensor_link.cpp: batched notifications split into frames with one ack,
+ * the paced parameter push and which sensors get the batch window
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "controller.h"
+#include "transport.h"
+#include "test.h"
+
+String    OPERATIONMODE_CMD       = "06";
+String    DIRECTION_CMD           = "01";
+String    RELAYTIMER_CMD          = "02";
+String    SENSITIVITY_CMD         = "04";
+String    DIRECTION_CAT_CMD       = "08";
+String    BAUDRATE_CMD            = "09";
+String    FWACK_CMD               = "14";
+String    DIRECTION1_CMD          = "21";
+String    RELAYTIMER1_CMD         = "22";
+String    BATCHWINDOW_CMD         = "23";
+
+uint8_t   OPERATIONMODE_PARAM     = 0;
+uint8_t   DIRECTION_PARAM         = 1;
+int       RELAYTIMER_PARAM        = 5;
+uint8_t   TWOCHANNLEMODE_PARAM    = 0;
+uint8_t   DIRECTION_PARAM1        = 0;
+int       RELAYTIMER_PARAM1       = 7;
+int       SENSITIVITY_LEVEL_VALUE = 2;
+int       DIRECTION_VALUE         = 3;
+int       BATCHWINDOW_PARAM       = BATCH_WINDOW_MS;
+
+static std::vector<std::string> Frames;
+static std::vector<int>         Acks;
+static std::string              Uart_Out;
+static std::string              Ble_Out;
+
+String converter(uint8_t val) {
+  char c_str[4];
+  snprintf(c_str, sizeof(c_str), "%2d", val);
+  return String(c_str);
+}
+
+// Sequenced detections ("00:0V,<seq>") ask for an ack, like main.cpp's
+void Sensor_Frame(uint8_t link, const uint8_t* pData, size_t length, int32_t& ack) {
+  std::string frame((const char*)pData, length);
+
+  Frames.push_back(frame);
+  size_t comma = frame.find(',');
+  if (frame.compare(0, 3, "00:") == 0 && comma != std::string::npos)
+    ack = atoi(frame.c_str() + comma + 1);
+}
+
+void Detect_Ack(uint16_t seq) {
+  Acks.push_back(seq);
+}
+
+static size_t Uart_Write(const char* data, size_t length) {
+  Uart_Out.append(data, length);
+  return length;
+}
+
+static size_t Ble_Write(const char* data, size_t length) {
+  Ble_Out.append(data, length);
+  return length;
+}
+
+static size_t Batch(const char* data, size_t length) {
+  Frames.clear();
+  Acks.clear();
+  return Sensor_Receive_Batch(LINK_BLE, (const uint8_t*)data, length);
+}
+
+static void Test_Batch() {
+  const char three[] = "00:01,7,1000\n00:00,8,1500\n99:00\n";
+  CHECK_EQ(Batch(three, sizeof(three) - 1), 3u);
+  CHECK_EQ(Frames.size(), 3u);
+  CHECK_STR(Frames[0].c_str(), "00:01,7,1000");
+  CHECK_STR(Frames[2].c_str(), "99:00");
+  // Acks are cumulative, one for the batch
+  CHECK_EQ(Acks.size(), 1u);
+  CHECK_EQ(Acks[0], 8);
+
+  // The last frame without its '\n', blank lines and CR LF
+  const char loose[] = "\r\n20:01\r\n\n00:00";
+  CHECK_EQ(Batch(loose, sizeof(loose) - 1), 2u);
+  CHECK_STR(Frames[0].c_str(), "20:01");
+  CHECK_STR(Frames[1].c_str(), "00:00");
+  CHECK_EQ(Acks.size(), 0u);
+
+  // Not a C string: only length bytes count, a NUL ends a frame
+  const char tail[] = "99:01\n00:01,9,2000XXXX";
+  CHECK_EQ(Batch(tail, 18), 2u);
+  CHECK_STR(Frames[1].c_str(), "00:01,9,2000");
+  CHECK_EQ(Acks[0], 9);
+  const char nul[] = {'9', '9', ':', '0', '1', '\0', '2', '0', ':', '0', '0'};
+  CHECK_EQ(Batch(nul, sizeof(nul)), 2u);
+  CHECK_STR(Frames[1].c_str(), "20:00");
+
+  CHECK_EQ(Batch("", 0), 0u);
+  CHECK_EQ(Batch("\n\n", 2), 0u);
+  CHECK_EQ(Frames.size(), 0u);
+
+  // One frame at a time (UART)
+  Frames.clear();
+  Acks.clear();
+  Sensor_Receive(LINK_UART, (const uint8_t*)"00:01,12,3000", 13);
+  CHECK_EQ(Frames.size(), 1u);
+  CHECK_EQ(Acks.size(), 1u);
+  CHECK_EQ(Acks[0], 12);
+}
+
+static void Test_Mask() {
+  Param_Push uart = {0, 0, false};
+  Param_Push ble = {0, 0, true};
+
+  TWOCHANNLEMODE_PARAM = 0;
+  CHECK_EQ(Sensor_Param_Mask(uart), SENSOR_PARAM_ALL);
+  CHECK_EQ(Sensor_Param_Mask(ble), SENSOR_PARAM_ALL | (1u << SENSOR_PARAM_BATCH));
+  TWOCHANNLEMODE_PARAM = 1;
+  CHECK_EQ(Sensor_Param_Mask(uart), SENSOR_PARAM_ALL | SENSOR_PARAM_CH2);
+  CHECK_EQ(Sensor_Param_Mask(ble), 0xFF);
+  TWOCHANNLEMODE_PARAM = 0;
+}
+
+// Runs both pushes until they are through
+static void Push_Run(Param_Push& uart, Param_Push& ble) {
+  for (int i = 0; i < 40; i++) {
+    Host_Millis += 100;
+    Param_Push_Step(uart, Uart_Write);
+    Param_Push_Step(ble, Ble_Write);
+  }
+}
+
+static void Test_Push() {
+  static Param_Push uart = {0, 0, false};
+  static Param_Push ble = {0, 0, true};
+
+  Host_Millis = 10000;
+  Param_Push_Start(uart);
+  Param_Push_Start(ble);
+
+  // Paced: nothing before PARAM_PUSH_INTERVAL_MS, then one at a time
+  Host_Millis += PARAM_PUSH_INTERVAL_MS - 1;
+  CHECK(!Param_Push_Step(uart, Uart_Write));
+  CHECK_STR(Uart_Out.c_str(), "");
+  Host_Millis += 1;
+  CHECK(!Param_Push_Step(uart, Uart_Write));
+  CHECK_STR(Uart_Out.c_str(), "06: 0\n");
+  CHECK(!Param_Push_Step(uart, Uart_Write));
+  CHECK_STR(Uart_Out.c_str(), "06: 0\n");
+
+  Push_Run(uart, ble);
+  CHECK(Param_Push_Step(uart, Uart_Write));
+  CHECK(Param_Push_Step(ble, Ble_Write));
+  CHECK_STR(Uart_Out.c_str(), "06: 0\n01: 1\n02: 5\n04: 2\n08: 3\n");
+  CHECK_STR(Ble_Out.c_str(), "06: 0\n01: 1\n02: 5\n04: 2\n08: 3\n23:40\n");
+
+  // A batch window change only goes to the sensor that batches
+  Uart_Out.clear();
+  Ble_Out.clear();
+  BATCHWINDOW_PARAM = 100;
+  Param_Push_Changed(1u << SENSOR_PARAM_BATCH);
+  CHECK_EQ(uart.pending, 0);
+  CHECK_EQ(ble.pending, 1u << SENSOR_PARAM_BATCH);
+  Push_Run(uart, ble);
+  CHECK_STR(Uart_Out.c_str(), "");
+  CHECK_STR(Ble_Out.c_str(), "23:100\n");
+
+  // The second channel's parameters only in two-channel mode
+  Ble_Out.clear();
+  Param_Push_Changed(SENSOR_PARAM_CH2);
+  CHECK_EQ(ble.pending, 0);
+  TWOCHANNLEMODE_PARAM = 1;
+  Param_Push_Changed(SENSOR_PARAM_CH2 | (1u << SENSOR_PARAM_RELAYTIMER));
+  Push_Run(uart, ble);
+  CHECK_STR(Uart_Out.c_str(), "02: 5\n21: 0\n22: 7\n");
+  CHECK_STR(Ble_Out.c_str(), "02: 5\n21: 0\n22: 7\n");
+  TWOCHANNLEMODE_PARAM = 0;
+}
+
+// Which BLE sensors get 23: from their advertising
+static void Test_Caps() {
+  CHECK_EQ(Ble_Sensor_Caps(std::string("\xFF\xFF\x01", 3)), BLE_CAP_BATCH);
+  CHECK_EQ(Ble_Sensor_Caps(std::string("\xFF\xFF\x00\x07", 4)), 0);
+  CHECK_EQ(Ble_Sensor_Caps(std::string("\x59\x00\x01", 3)), 0);
+  CHECK_EQ(Ble_Sensor_Caps(std::string("\xFF\xFF", 2)), 0);
+  CHECK_EQ(Ble_Sensor_Caps(std::string()), 0);
+}
+
+int main() {
+  Test_Batch();
+  Test_Mask();
+  Test_Push();
+  Test_Caps();
+  return Test_Done("sensor_link");
+}
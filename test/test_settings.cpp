@@ -0,0 +1,163 @@
+/* Operating parameters at runtime, src/settings.cpp: the get/set/list console commands, save/clear and load
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <algorithm>
+#include <string>
+#include "console.h"
+#include "controller.h"
+#include "detect_filter.h"
+#include "rollup.h"
+#include "settings.h"
+#include "test.h"
+
+// As the switches and the pot left them at boot
+uint8_t   OPERATIONMODE_PARAM     = 0;
+uint8_t   DIRECTION_PARAM         = 0;
+uint8_t   RELAYTIMING_PARAM       = 0;
+int       RELAYTIMER_PARAM        = 5;
+uint8_t   TWOCHANNLEMODE_PARAM    = 0;
+uint8_t   TWOINONEMODE_PARAM      = 0;
+uint8_t   DIRECTION_PARAM1        = 0;
+uint8_t   RELAYTIMING_PARAM1      = 0;
+int       RELAYTIMER_PARAM1       = 5;
+int       SENSITIVITY_LEVEL_VALUE = 2;
+int       DIRECTION_VALUE         = 0;
+int       BATCHWINDOW_PARAM       = BATCH_WINDOW_MS;
+int       Frame_Log               = 0;
+int       Filter_Min_On_Ms        = FILTER_MIN_ON_MS;
+int       Filter_Min_Off_Ms       = FILTER_MIN_OFF_MS;
+int       Filter_Refractory_Ms    = FILTER_REFRACTORY_MS;
+int       Rollup_Checkpoint_Min   = ROLLUP_CHECKPOINT_MIN;
+
+// What a set did to the running controller
+static int      Compiles = 0;
+static int      Mode_Changes = 0;
+static uint8_t  Pushed = 0;
+static int      Pushes = 0;
+
+void Rules_Compile() {
+  Compiles++;
+}
+
+void Operation_Mode_Changed() {
+  Mode_Changes++;
+}
+
+void Param_Push_Changed(uint8_t mask) {
+  Pushed |= mask;
+  Pushes++;
+}
+
+static void Forget() {
+  Compiles = Mode_Changes = Pushes = 0;
+  Pushed = 0;
+}
+
+// A console command, returns the reply
+static std::string Command(void (*run)(char* args), const char* args) {
+  char line[CONSOLE_LINE_SIZE];
+
+  snprintf(line, sizeof(line), "%s", args);
+  Serial.out.clear();
+  run(line);
+  return Serial.out;
+}
+
+static void Test_Get_List() {
+  CHECK_STR(Command(Settings_Get, "relaytimer").c_str(), "@PARAM,relaytimer,5,0,99\n");
+  CHECK_STR(Command(Settings_Get, "sensitivity").c_str(), "@PARAM,sensitivity,2,0,3\n");
+  CHECK_STR(Command(Settings_Get, "nope").c_str(), "@ERR,unknown parameter nope\n");
+
+  std::string list = Command(Settings_List, "");
+  CHECK_EQ(std::count(list.begin(), list.end(), '\n'), 17);
+  CHECK(list.rfind("@PARAM,operationmode,0,0,3\n", 0) == 0);
+  CHECK(list.find("@PARAM,batch_ms,40,0,250\n") != std::string::npos);
+}
+
+// Several values at once: all of them checked first, nothing applied if one is wrong
+static void Test_Set_Validation() {
+  Forget();
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 sensitivity 4").c_str(), "@ERR,sensitivity must be 0..3\n");
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 sensitivity x").c_str(), "@ERR,sensitivity must be 0..3\n");
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 sensitivity 1x").c_str(), "@ERR,sensitivity must be 0..3\n");
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 sensitivity").c_str(), "@ERR,no value for sensitivity\n");
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 bogus 1").c_str(), "@ERR,unknown parameter bogus\n");
+  CHECK_STR(Command(Settings_Set, "").c_str(), "@ERR,usage: set <name> <value> ...\n");
+  CHECK_STR(Command(Settings_Set, "direction 1 direction 0 direction 1 direction 0 direction 1 direction 0 "
+                                  "direction 1").c_str(), "@ERR,too many parameters\n");
+  CHECK_EQ(RELAYTIMER_PARAM, 5);
+  CHECK_EQ(SENSITIVITY_LEVEL_VALUE, 2);
+  CHECK_EQ(DIRECTION_PARAM, 0);
+  CHECK_EQ(Compiles, 0);
+  CHECK_EQ(Pushes, 0);
+}
+
+// Only what changed and what the sensor uses is pushed; a mode change restarts the relays
+static void Test_Set_Apply() {
+  Forget();
+  CHECK_STR(Command(Settings_Set, "relaytimer 30 sensitivity 2 relaytiming 1").c_str(),
+            "@PARAM,relaytimer,30,0,99\n@PARAM,sensitivity,2,0,3\n@PARAM,relaytiming,1,0,1\n@OK\n");
+  CHECK_EQ(RELAYTIMER_PARAM, 30);
+  CHECK_EQ(RELAYTIMING_PARAM, 1);
+  CHECK_EQ(Pushes, 1);
+  CHECK_EQ(Pushed, 1u << SENSOR_PARAM_RELAYTIMER);
+  CHECK_EQ(Mode_Changes, 0);
+  CHECK_EQ(Compiles, 1);
+
+  Forget();
+  CHECK_STR(Command(Settings_Set, "frame_log 1").c_str(), "@PARAM,frame_log,1,0,1\n@OK\n");
+  CHECK_EQ(Frame_Log, 1);
+  CHECK_EQ(Pushes, 0);
+
+  Forget();
+  Command(Settings_Set, "twochannel 1 operationmode 2");
+  CHECK_EQ(TWOCHANNLEMODE_PARAM, 1);
+  CHECK_EQ(OPERATIONMODE_PARAM, 2);
+  CHECK_EQ(Mode_Changes, 1);
+  CHECK_EQ(Pushed, SENSOR_PARAM_CH2 | (1u << SENSOR_PARAM_OPERATIONMODE));
+
+  // The same values again change nothing
+  Forget();
+  Command(Settings_Set, "twochannel 1 operationmode 2");
+  CHECK_EQ(Mode_Changes, 0);
+  CHECK_EQ(Pushes, 0);
+}
+
+// Saved values win over the switches at the next boot, until they are cleared
+static void Test_Save_Load() {
+  Host_Prefs_Clear();
+  CHECK(Settings_Save());
+
+  RELAYTIMER_PARAM = 5;
+  OPERATIONMODE_PARAM = 0;
+  Filter_Min_On_Ms = 0;
+  Serial.out.clear();
+  Settings_Load();
+  CHECK_EQ(RELAYTIMER_PARAM, 30);
+  CHECK_EQ(OPERATIONMODE_PARAM, 2);
+  CHECK(Serial.out.find("relaytimer = 30 (saved, overrides the switches)\n") != std::string::npos);
+
+  // A saved value out of range (an older firmware's) leaves the switch value alone
+  Preferences prefs;
+  prefs.begin("settings", false);
+  prefs.putInt("sensitivity", 9);
+  prefs.end();
+  SENSITIVITY_LEVEL_VALUE = 1;
+  Settings_Load();
+  CHECK_EQ(SENSITIVITY_LEVEL_VALUE, 1);
+
+  CHECK(Settings_Clear());
+  RELAYTIMER_PARAM = 5;
+  Settings_Load();
+  CHECK_EQ(RELAYTIMER_PARAM, 5);
+}
+
+int main() {
+  Test_Get_List();
+  Test_Set_Validation();
+  Test_Set_Apply();
+  Test_Save_Load();
+  return Test_Done("settings");
+}
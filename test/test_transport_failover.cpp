@@ -0,0 +1,194 @@
+/* Transport policy, include/transport.h: FailoverTransport between two simulated links
+ *
+ * The links are stand-ins with the transport interface; a test says whether each is up (handshake done,
+ * parameters pushed) and whether the sensor still answers on it, as UartTransport::alive() and
+ * BleTransport::alive() would.
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "transport.h"
+#include "test.h"
+
+template <uint8_t Link>
+struct Fake_Link {
+  enum { link = Link };
+
+  static void           begin() { begins++; }
+  static void           resume() { resumes++; }
+  static void           poll() { polls++; }
+  static bool           connected() { return up; }
+  static bool           ready() { return up; }
+  static bool           alive() { return up && answering; }
+  static unsigned long  lastRxMs() { return rx_ms; }
+  static size_t         write(const char* data, size_t length) {
+    written.append(data, length);
+    return length;
+  }
+  static size_t         writeRoom() { return Link == LINK_UART ? 8192 : 512; }
+  static size_t         maxWrite() { return Link == LINK_UART ? 8192 : 514; }
+  static bool           accepts(uint8_t) { return true; }
+  static const char*    name() { return Link == LINK_UART ? "UART" : "BLE"; }
+
+  static bool           up;
+  static bool           answering;
+  static unsigned long  rx_ms;
+  static int            begins;
+  static int            resumes;
+  static int            polls;
+  static std::string    written;
+};
+
+template <uint8_t L> bool           Fake_Link<L>::up        = false;
+template <uint8_t L> bool           Fake_Link<L>::answering = false;
+template <uint8_t L> unsigned long  Fake_Link<L>::rx_ms     = 0;
+template <uint8_t L> int            Fake_Link<L>::begins    = 0;
+template <uint8_t L> int            Fake_Link<L>::resumes   = 0;
+template <uint8_t L> int            Fake_Link<L>::polls     = 0;
+template <uint8_t L> std::string    Fake_Link<L>::written;
+
+typedef Fake_Link<LINK_UART>                    Wire_Link;
+typedef Fake_Link<LINK_BLE>                     Radio_Link;
+typedef FailoverTransport<Wire_Link, Radio_Link> Link;
+
+struct Event {
+  char  kind;
+  int   value;
+};
+
+static std::vector<Event> Events;
+
+void Report_Event(char kind, int value) {
+  Events.push_back({kind, value});
+}
+
+// loop() passes 100 ms apart; a link that is answering got a byte on this pass
+static void Run(unsigned long ms) {
+  for (unsigned long end = Host_Millis + ms; Host_Millis < end;) {
+    Host_Millis += 100;
+    if (Wire_Link::alive())
+      Wire_Link::rx_ms = Host_Millis;
+    if (Radio_Link::alive())
+      Radio_Link::rx_ms = Host_Millis;
+    Link::poll();
+  }
+}
+
+// Without both links there is nothing to switch: the policy is the link itself
+static void Test_Policy() {
+  CHECK((std::is_same<SensorTransport, UartTransport>::value) == (UART_COMM && !BLE_COMM));
+
+  Link::begin();
+  Link::resume();
+  CHECK_EQ(Wire_Link::begins, 1);
+  CHECK_EQ(Radio_Link::begins, 1);
+  CHECK_EQ(Wire_Link::resumes, 1);
+  CHECK_EQ(Radio_Link::resumes, 1);
+}
+
+// Both up: everything goes over the primary, frames from the standby are not acted on
+static void Test_Primary() {
+  Host_Millis = 10000;
+  Wire_Link::up = Wire_Link::answering = true;
+  Radio_Link::up = Radio_Link::answering = true;
+  Run(1000);
+
+  CHECK_EQ(Link::active, LINK_UART);
+  CHECK(Link::accepts(LINK_UART));
+  CHECK(!Link::accepts(LINK_BLE));
+  CHECK(Link::alive());
+  CHECK_STR(Link::name(), "UART");
+  CHECK_EQ(Link::maxWrite(), 8192);
+  Link::write("10:1\n", 5);
+  CHECK_STR(Wire_Link::written.c_str(), "10:1\n");
+  CHECK_STR(Radio_Link::written.c_str(), "");
+  CHECK(Wire_Link::polls > 0 && Wire_Link::polls == Radio_Link::polls);
+  CHECK_EQ(Events.size(), 0);
+}
+
+// The wire is cut: once the primary is no longer alive the standby takes over, well within a second of the
+// last byte from the sensor
+static void Test_Failover() {
+  unsigned long cut = Host_Millis;
+
+  Wire_Link::answering = false;
+  Run(100);
+  CHECK_EQ(Link::active, LINK_BLE);
+  CHECK(Link::accepts(LINK_BLE));
+  CHECK(!Link::accepts(LINK_UART));
+  CHECK_STR(Link::name(), "BLE");
+  CHECK_EQ(Link::maxWrite(), 514);
+  CHECK_EQ(Link::failovers, 1);
+  CHECK_EQ(Link::failover_ms_last, Host_Millis - cut);
+  CHECK(Link::failover_ms_max < 1000);
+  CHECK(Serial.out.find("Sensor link failover to BLE") != std::string::npos);
+  if (CHECK_EQ(Events.size(), 1)) {
+    CHECK_EQ(Events[0].kind, MOBI_EV_FAILOVER);
+    CHECK_EQ(Events[0].value, LINK_BLE);
+  }
+
+  Link::write("10:2\n", 5);
+  CHECK_STR(Radio_Link::written.c_str(), "10:2\n");
+}
+
+// The primary has to stay alive for FAILOVER_RETURN_MS before it is used again; a flap starts the wait over
+static void Test_Return() {
+  Events.clear();
+  Wire_Link::answering = true;
+  Run(FAILOVER_RETURN_MS - 200);
+  CHECK_EQ(Link::active, LINK_BLE);
+
+  Wire_Link::answering = false;
+  Run(100);
+  Wire_Link::answering = true;
+  Run(FAILOVER_RETURN_MS);
+  CHECK_EQ(Link::active, LINK_BLE);
+  Run(200);
+  CHECK_EQ(Link::active, LINK_UART);
+  CHECK_EQ(Link::failovers, 1);
+  if (CHECK_EQ(Events.size(), 1))
+    CHECK_EQ(Events[0].value, LINK_UART);
+}
+
+// The standby dies while the primary is back but still waiting out its time: back on the primary at once
+static void Test_Standby_Lost() {
+  Wire_Link::answering = false;
+  Run(100);
+  CHECK_EQ(Link::active, LINK_BLE);
+
+  Wire_Link::answering = true;
+  Run(200);
+  CHECK_EQ(Link::active, LINK_BLE);
+  Radio_Link::answering = false;
+  Run(100);
+  CHECK_EQ(Link::active, LINK_UART);
+  Radio_Link::answering = true;
+}
+
+// Nothing to fail over to: the policy stays on the primary and reports it as not alive
+static void Test_No_Standby() {
+  Radio_Link::up = false;
+  Wire_Link::answering = false;
+  Run(1000);
+  CHECK_EQ(Link::active, LINK_UART);
+  CHECK(!Link::alive());
+
+  // A standby that comes up later takes over; the time counts from the last byte on the primary all the same
+  Radio_Link::up = true;
+  Run(100);
+  CHECK_EQ(Link::active, LINK_BLE);
+  CHECK_EQ(Link::failover_ms_last, Host_Millis - Wire_Link::rx_ms);
+  CHECK_EQ(Link::failover_ms_max, Link::failover_ms_last);
+}
+
+int main() {
+  Test_Policy();
+  Test_Primary();
+  Test_Failover();
+  Test_Return();
+  Test_Standby_Lost();
+  Test_No_Standby();
+  return Test_Done("transport_failover");
+}
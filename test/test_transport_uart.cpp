@@ -0,0 +1,354 @@
+/* Sensor link over UART, src/transport_uart.cpp, against a simulated sensor on Serial2
+ *
+ * The sensor answers the handshake, takes parameters and switches rates like the real one (and the emulator in
+ * tools/sensor-emu). What is sent at a rate the other side is not on does not arrive.
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "controller.h"
+#include "transport.h"
+#include "test.h"
+
+// Controller state in transport_uart.cpp, set back to how a boot leaves it
+extern bool           Sensor_Started;
+extern bool           Uart_Connected;
+extern bool           Uart_Param_Sent;
+extern uint8_t        Uart_Baud_Index;
+extern uint8_t        Uart_Baud_State;
+extern bool           Uart_Baud_Failed;
+extern bool           Uart_Probe_Hunt;
+extern uint16_t       UART_RX_BUF_Index;
+extern unsigned long  Uart_Probe_Ms;
+extern uint32_t       Uart_Long_Lines;
+
+/////////////////////////////////////////////////////////////////////////
+//What the transport needs from the controller
+/////////////////////////////////////////////////////////////////////////
+
+String                    BAUDRATE_CMD = "09";
+String                    FWACK_CMD = "14";
+int                       Frame_Log = 0;
+static std::vector<int>   Link_Changes;       // 1 up, 0 down
+static std::vector<std::string> Frames;
+static int                Restarts = 0;
+
+String converter(uint8_t val) {
+  char c_str[4];
+  snprintf(c_str, sizeof(c_str), "%2d", val);
+  return String(c_str);
+}
+
+// One parameter, so a push takes one PARAM_PUSH_INTERVAL_MS
+void Param_Push_Start(Param_Push& push) {
+  push.pending = 1;
+  push.last_ms = millis();
+}
+
+bool Param_Push_Step(Param_Push& push, size_t (*write)(const char* data, size_t length)) {
+  if (millis() - push.last_ms < PARAM_PUSH_INTERVAL_MS)
+    return false;
+  if (push.pending == 0)
+    return true;
+  push.last_ms = millis();
+  push.pending = 0;
+  write("06: 1\n", 6);
+  return false;
+}
+
+void Sensor_Receive(uint8_t link, const uint8_t* pData, size_t length) {
+  Frames.push_back(std::string((const char*)pData, length));
+}
+
+void Sensor_Link_Changed(uint8_t link, bool up) {
+  Link_Changes.push_back(up ? 1 : 0);
+}
+
+void Sensor_Restarted(uint8_t link) {
+  Restarts++;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Simulated sensor
+/////////////////////////////////////////////////////////////////////////
+
+static const unsigned long Sensor_Rates[] = {115200, 230400, 460800, 921600};
+
+#define UART_ERRORS_TOLERATED   8       // UART_BAUD_ERR_LIMIT in transport_uart.cpp
+#define SENSOR_BAUD_REVERT_MS   1000    // back to 115200 without a valid line this long after a switch
+
+struct Fake_Sensor {
+  unsigned long             baud;
+  bool                      knows_baud;     // answers 09:NN
+  bool                      deaf_after_switch;  // hears nothing at the new rate, e.g. a marginal cable
+  bool                      connected;
+  bool                      heard_since_switch;
+  unsigned long             switch_ms;
+  std::string               line;
+  std::vector<std::string>  params;
+};
+
+static Fake_Sensor Sensor;
+
+static void Sensor_Send(const std::string& data) {
+  if (Serial2.baud == Sensor.baud)
+    Serial2.in += data;
+}
+
+static void Sensor_Line(const std::string& line) {
+  if (Sensor.baud != Sensor_Rates[0] && Sensor.deaf_after_switch)
+    return;
+  Sensor.heard_since_switch = true;
+  if (line == "_mobi-ramp") {
+    Sensor.connected = true;
+    Sensor_Send("sensor\n");
+  } else if (line.compare(0, 3, "09:") == 0) {
+    if (!Sensor.knows_baud)
+      return;
+    int index = atoi(line.c_str() + 3);
+    Sensor_Send(line + "\n");
+    Sensor.baud = Sensor_Rates[index];
+    Sensor.heard_since_switch = false;
+    Sensor.switch_ms = Host_Millis;
+  } else if (line.size() >= 4 && line[2] == ':') {
+    Sensor.params.push_back(line);
+  }
+}
+
+// Hands what the controller wrote to the sensor
+static void Wire() {
+  std::string sent;
+
+  sent.swap(Serial2.out);
+  if (Serial2.baud != Sensor.baud)
+    return;
+  for (char c : sent) {
+    if (c == '\n') {
+      Sensor_Line(Sensor.line);
+      Sensor.line.clear();
+    } else {
+      Sensor.line += c;
+    }
+  }
+}
+
+// ms of loop() passes, 10 ms apart
+static void Run(unsigned long ms) {
+  for (unsigned long end = Host_Millis + ms; Host_Millis < end;) {
+    Host_Millis += 10;
+    UartTransport::poll();
+    Wire();
+    if (Sensor.baud != Sensor_Rates[0] && !Sensor.heard_since_switch &&
+        Host_Millis - Sensor.switch_ms >= SENSOR_BAUD_REVERT_MS)
+      Sensor.baud = Sensor_Rates[0];
+  }
+}
+
+static void Sensor_Power_On(bool knows_baud) {
+  Sensor = {};
+  Sensor.baud = Sensor_Rates[0];
+  Sensor.knows_baud = knows_baud;
+  Sensor_Send("start\n");
+}
+
+// The controller resets: the globals are back to their initial values and begin() runs again
+static void Controller_Boot() {
+  Sensor_Started = false;
+  Uart_Connected = false;
+  Uart_Param_Sent = false;
+  Uart_Baud_Index = 0;
+  Uart_Baud_State = 0;
+  Uart_Baud_Failed = false;
+  Uart_Probe_Hunt = false;
+  UART_RX_BUF_Index = 0;
+  Uart_Probe_Ms = 0;
+  Serial2.in.clear();
+  Serial2.out.clear();
+  Link_Changes.clear();
+  Frames.clear();
+  UartTransport::begin();
+}
+
+// Both powered up together: the sensor announces itself, the link ends up at the fastest rate
+static void Test_Cold_Start() {
+  Controller_Boot();
+  Sensor_Power_On(true);
+  Run(3000);
+
+  CHECK(UartTransport::ready());
+  CHECK(Sensor.connected);
+  CHECK_EQ(Serial2.baud, 921600);
+  CHECK_EQ(Sensor.baud, 921600);
+  CHECK_EQ(Sensor.params.size(), 1);
+  CHECK_EQ(Link_Changes.size(), 1);
+}
+
+// The controller resets while the sensor stays up and connected at 921600: it says nothing until it is probed
+static void Test_Warm_Restart() {
+  Test_Cold_Start();
+
+  Controller_Boot();
+  Run(5000);
+  CHECK(!UartTransport::connected());
+
+  Controller_Boot();
+  UartTransport::resume();
+  Run(2000);
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 921600);
+  CHECK_EQ(Link_Changes.size(), 1);
+  CHECK_EQ(Restarts, 0);
+
+  Sensor_Send("00:01\n");
+  Run(10);
+  CHECK_EQ(Frames.size(), 1);
+  if (!Frames.empty())
+    CHECK_STR(Frames[0].c_str(), "00:01");
+}
+
+// A sensor that never negotiated is found at the default rate with the first probe
+static void Test_Warm_Restart_Default_Rate() {
+  Controller_Boot();
+  Sensor_Power_On(false);
+  Run(3000);
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 115200);
+
+  Controller_Boot();
+  UartTransport::resume();
+  Run(20);
+  CHECK(UartTransport::connected());
+  CHECK_EQ(Serial2.baud, 115200);
+}
+
+// The sensor reboots while the controller is looking for it: the hunt comes round to the default rate again
+static void Test_Warm_Restart_Sensor_Reboots() {
+  Controller_Boot();
+  Sensor_Power_On(true);
+  Run(3000);
+
+  Controller_Boot();
+  UartTransport::resume();
+  Run(300);
+  CHECK(!UartTransport::connected());
+  Sensor_Power_On(true);
+  Run(1000);
+  CHECK(UartTransport::connected());
+  Run(3000);
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 921600);
+  CHECK_EQ(Sensor.baud, 921600);
+}
+
+// A sensor that does not know 09 never acks: the link stays at 115200 and the request is not repeated
+static void Test_Baud_Unsupported() {
+  Controller_Boot();
+  Sensor_Power_On(false);
+  Run(3000);
+
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 115200);
+  CHECK(Uart_Baud_Failed);
+  CHECK_EQ(Sensor.params.size(), 1);
+  Serial.out.clear();
+  Run(5000);
+  CHECK(Serial.out.find("Requesting baud rate") == std::string::npos);
+  CHECK(UartTransport::ready());
+}
+
+// The sensor acks and switches but does not hear the verify probe: both sides end up back at 115200
+static void Test_Baud_Verify_Lost() {
+  Controller_Boot();
+  Sensor_Power_On(true);
+  Sensor.deaf_after_switch = true;
+  Run(3000);
+
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 115200);
+  CHECK_EQ(Sensor.baud, 115200);
+  CHECK(Uart_Baud_Failed);
+  CHECK_EQ(Link_Changes.size(), 1);
+
+  Sensor_Send("00:01\n");
+  Run(20);
+  CHECK_EQ(Frames.size(), 1);
+}
+
+// Line errors at the negotiated rate: a few per window are tolerated, more drop the link to 115200 where the
+// handshake is done again and the faster rate is not asked for a second time
+static void Test_Line_Errors() {
+  Test_Cold_Start();
+
+  for (int i = 0; i < UART_ERRORS_TOLERATED; i++)
+    Serial2.error_cb(UART_FRAME_ERROR);
+  Run(100);
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 921600);
+
+  // A new window forgets them
+  Run(10000);
+  for (int i = 0; i < UART_ERRORS_TOLERATED; i++)
+    Serial2.error_cb(UART_PARITY_ERROR);
+  Run(100);
+  CHECK(UartTransport::ready());
+
+  Serial2.error_cb(UART_FIFO_OVF_ERROR);
+  Run(10);
+  CHECK(!UartTransport::connected());
+  CHECK_EQ(Serial2.baud, 115200);
+  CHECK_EQ(Sensor.baud, 115200);
+  CHECK_EQ(Link_Changes.size(), 2);
+  CHECK(Serial.out.find("UART errors: fifo_ovf 1, buf_full 0, frame 8, parity 8") != std::string::npos);
+
+  Run(3000);
+  CHECK(UartTransport::ready());
+  CHECK_EQ(Serial2.baud, 115200);
+  CHECK_EQ(Link_Changes.size(), 3);
+}
+
+// Frames split across reads, CR LF endings, a frame without '\n' and a line too long for the buffer
+static void Test_Framing() {
+  Controller_Boot();
+  Sensor_Power_On(false);
+  Run(3000);
+  Frames.clear();
+
+  Serial2.in += "00:";
+  Run(10);
+  Serial2.in += "01\r\n00:00\n";
+  Run(10);
+  CHECK_EQ(Frames.size(), 2);
+
+  // Flushed once the line is quiet
+  Serial2.in += "99:03";
+  Run(10);
+  CHECK_EQ(Frames.size(), 2);
+  Run(30);
+  CHECK_EQ(Frames.size(), 3);
+
+  uint32_t long_lines = Uart_Long_Lines;
+  Serial2.in += std::string(300, 'x') + "\n00:01\n";
+  Run(10);
+  CHECK_EQ(Uart_Long_Lines, long_lines + 1);
+  CHECK_EQ(Frames.size(), 4);
+  if (Frames.size() == 4) {
+    CHECK_STR(Frames[0].c_str(), "00:01");
+    CHECK_STR(Frames[1].c_str(), "00:00");
+    CHECK_STR(Frames[2].c_str(), "99:03");
+    CHECK_STR(Frames[3].c_str(), "00:01");
+  }
+}
+
+int main() {
+  Serial2.flush_cb = Wire;
+  Test_Cold_Start();
+  Test_Warm_Restart();
+  Test_Warm_Restart_Default_Rate();
+  Test_Warm_Restart_Sensor_Reboots();
+  Test_Baud_Unsupported();
+  Test_Baud_Verify_Lost();
+  Test_Line_Errors();
+  Test_Framing();
+  return Test_Done("transport_uart");
+}
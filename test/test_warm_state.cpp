@@ -0,0 +1,125 @@
+/* Control state over a warm restart, src/warm_state.cpp
+ *
+ * The RTC slot lives on between the Warm_Restore() calls like it does over a reset, so each call is one boot.
+ */
+
+#include <Arduino.h>
+#include <esp_system.h>
+#include "warm_state.h"
+#include "test.h"
+
+static Warm_State Saved_State(uint8_t mark) {
+  Warm_State state;
+
+  memset(&state, 0, sizeof(state));
+  state.relay_count[0] = 30 + mark;
+  state.relay_on[0] = 1;
+  state.relay_out[0] = 1;
+  state.vehicle_count[1] = mark;
+  state.operation_mode = 2;
+  state.detect_synced = 1;
+  state.detect_next = 1000 + mark;
+  return state;
+}
+
+static bool Boot(esp_reset_reason_t reason, Warm_State& state) {
+  Host_Reset_Reason = reason;
+  memset(&state, 0xA5, sizeof(state));
+  return Warm_Restore(state);
+}
+
+static bool Same(const Warm_State& a, const Warm_State& b) {
+  return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static void Test_Reset_Reasons() {
+  Warm_State state;
+  Warm_State saved = Saved_State(1);
+
+  // RTC memory is garbage after a power-on
+  CHECK(!Boot(ESP_RST_POWERON, state));
+  CHECK_STR(Warm_Reset_Reason(), "power-on");
+
+  Warm_Save(saved);
+  CHECK(Boot(ESP_RST_PANIC, state));
+  CHECK(Same(state, saved));
+  CHECK_STR(Warm_Reset_Reason(), "panic");
+
+  // The reset button starts cold even though the slot is intact, and drops what was in it
+  Warm_Save(saved);
+  CHECK(!Boot(ESP_RST_EXT, state));
+  CHECK(Boot(ESP_RST_SW, state));
+  CHECK_EQ(state.relay_on[0], 0);
+  CHECK_EQ(state.detect_next, 0);
+
+  const esp_reset_reason_t warm[] = {ESP_RST_SW, ESP_RST_INT_WDT, ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_BROWNOUT};
+  for (esp_reset_reason_t reason : warm) {
+    CHECK(!Boot(ESP_RST_POWERON, state));
+    Warm_Save(saved);
+    CHECK(Boot(reason, state));
+    CHECK(Same(state, saved));
+  }
+  CHECK(!Boot(ESP_RST_DEEPSLEEP, state));
+}
+
+static void Test_Restart_Limit() {
+  Warm_State state;
+  Warm_State saved = Saved_State(2);
+  Warm_State empty;
+
+  memset(&empty, 0, sizeof(empty));
+  CHECK(!Boot(ESP_RST_POWERON, state));
+  Warm_Save(saved);
+
+  // A crash that comes back right after the restore: WARM_MAX_RESTARTS restores, then a cold start
+  for (int i = 0; i < WARM_MAX_RESTARTS; i++) {
+    CHECK(Boot(ESP_RST_PANIC, state));
+    CHECK(Same(state, saved));
+  }
+  CHECK(!Boot(ESP_RST_PANIC, state));
+
+  // The dropped state stays dropped, the count starts over
+  for (int i = 0; i < WARM_MAX_RESTARTS; i++) {
+    CHECK(Boot(ESP_RST_TASK_WDT, state));
+    CHECK(Same(state, empty));
+  }
+  CHECK(!Boot(ESP_RST_TASK_WDT, state));
+}
+
+// Runs last, a boot only becomes stable once per process
+static void Test_Stable_Run() {
+  Warm_State state;
+  Warm_State saved = Saved_State(3);
+
+  CHECK(!Boot(ESP_RST_POWERON, state));
+  Warm_Save(saved);
+  CHECK(Boot(ESP_RST_PANIC, state));
+  CHECK(Boot(ESP_RST_PANIC, state));
+
+  // Not long enough yet
+  Host_Millis = WARM_STABLE_MS - 1;
+  Warm_Poll();
+  CHECK(Boot(ESP_RST_PANIC, state));
+  CHECK(!Boot(ESP_RST_PANIC, state));
+
+  CHECK(!Boot(ESP_RST_POWERON, state));
+  Warm_Save(saved);
+  CHECK(Boot(ESP_RST_PANIC, state));
+  CHECK(Boot(ESP_RST_PANIC, state));
+
+  // A stable run clears the count: WARM_MAX_RESTARTS more
+  Host_Millis = WARM_STABLE_MS;
+  Warm_Poll();
+  for (int i = 0; i < WARM_MAX_RESTARTS; i++) {
+    CHECK(Boot(ESP_RST_PANIC, state));
+    CHECK(Same(state, saved));
+  }
+  CHECK(!Boot(ESP_RST_PANIC, state));
+}
+
+int main() {
+  Test_Reset_Reasons();
+  Test_Restart_Limit();
+  Test_Stable_Run();
+  return Test_Done("warm_state");
+}
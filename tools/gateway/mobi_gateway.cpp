@@ -0,0 +1,552 @@
+/* mobi-ramp host gateway daemon
+ *
+ * Talks to the controller over its USB serial port and picks the machine-readable event lines (@EV,...) out of the
+ * console output, see include/mobi_event.h. Human-readable log lines are counted and dropped.
+ *
+ *   - Every event is appended to a compact time-series file (24-byte records, see Ts_Record). Records are batched
+ *     in memory and written with one write() per batch, or every flush interval, whichever comes first.
+ *   - Live counters are served on a local (unix domain) socket: connect, read "key=value" lines, the daemon closes.
+ *   - If the serial port goes away (board reset, cable pulled) it is reopened once a second.
+ *
+ * Usage:
+ *   mobi-gateway -d /dev/ttyUSB0 [-b 115200] [-o mobi-events.mrts] [-s /tmp/mobi-gateway.sock]
+ *                [-n batch_records] [-f flush_ms]
+ *   mobi-gateway -x mobi-events.mrts        dump a time-series file as text
+ *
+ * The device can be any tty, so the whole path can be exercised end to end without a board by putting a pty in
+ * front of it, e.g.:
+ *   socat -d -d pty,raw,echo=0,link=/tmp/board pty,raw,echo=0,link=/tmp/gw &
+ *   mobi-gateway -d /tmp/gw &
+ *   printf '@EV,0,1200,D,1\n' > /tmp/board
+ *   socat - UNIX-CONNECT:/tmp/mobi-gateway.sock
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "mobi_event.h"
+
+#define TS_MAGIC            "MRTS"
+#define TS_VERSION          2       // 2: 16-bit values and the full sequence number
+#define LINE_BUF_SIZE       1024
+#define READ_BUF_SIZE       8192
+#define REOPEN_INTERVAL_MS  1000
+#define LANES               2
+
+/** Time-series file header, written once at the start of the file. */
+struct Ts_Header {
+  char      magic[4];
+  uint16_t  version;
+  uint16_t  record_size;
+  uint64_t  created_us;     // host wall clock, microseconds since epoch
+};
+
+/** One event record. Host time is the time the line was received, dev_ms the controller's millis(). */
+struct Ts_Record {
+  uint64_t  host_us;
+  uint32_t  dev_ms;
+  uint32_t  seq;            // controller event sequence number
+  int16_t   value;          // E values on lane 1 go up to 199
+  char      kind;
+  uint8_t   reserved[5];
+};
+
+static_assert(sizeof(Ts_Header) == 16, "Ts_Header layout");
+static_assert(sizeof(Ts_Record) == 24, "Ts_Record layout");
+
+struct Counters {
+  uint64_t  bytes_in;
+  uint64_t  lines;
+  uint64_t  log_lines;
+  uint64_t  events;
+  uint64_t  bad_events;
+  uint64_t  long_lines;
+  uint64_t  seq_gaps;       // events missing according to the sequence number
+  uint64_t  detect_on;
+  uint64_t  detect_off;
+  uint64_t  relay_on;
+  uint64_t  relay_off;
+  uint64_t  errors;
+  uint64_t  link_up;
+  uint64_t  link_down;
+  uint64_t  failovers;
+  uint64_t  records_written;
+  uint64_t  batches_written;
+  uint64_t  reopens;
+  uint64_t  last_event_us;
+  int32_t   relay_state;      // bit per relay output
+  int32_t   link_state;
+  int32_t   error_state[LANES];   // sensor error code per lane, 0: none
+  int32_t   active_link;
+};
+
+static const char*            Device_Path   = nullptr;
+static int                    Baud_Rate     = 115200;
+static const char*            Ts_Path       = "mobi-events.mrts";
+static const char*            Sock_Path     = "/tmp/mobi-gateway.sock";
+static size_t                 Batch_Records = 256;
+static int                    Flush_Ms      = 1000;
+
+static volatile sig_atomic_t  Stop          = 0;
+
+static Counters               Stats;
+static std::vector<Ts_Record> Batch;
+static uint64_t               Last_Flush_Us = 0;
+static bool                   Have_Seq      = false;
+static uint32_t               Next_Seq      = 0;
+
+static char                   Line_Buf[LINE_BUF_SIZE];
+static size_t                 Line_Len      = 0;
+static bool                   Line_Overflow = false;
+
+static uint64_t now_us(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void on_signal(int)
+{
+  Stop = 1;
+}
+
+static speed_t baud_to_speed(int baud)
+{
+  switch (baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    default:      return 0;
+  }
+}
+
+static int open_serial(const char* path, int baud)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+static int open_listen_socket(const char* path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    perror("socket");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Time-series file
+/////////////////////////////////////////////////////////////////////////
+
+static int open_ts_file(const char* path)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size == 0) {
+    Ts_Header hdr;
+    memcpy(hdr.magic, TS_MAGIC, 4);
+    hdr.version     = TS_VERSION;
+    hdr.record_size = sizeof(Ts_Record);
+    hdr.created_us  = now_us(CLOCK_REALTIME);
+    if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+      close(fd);
+      return -1;
+    }
+  } else {
+    Ts_Header hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || memcmp(hdr.magic, TS_MAGIC, 4) != 0) {
+      fprintf(stderr, "%s is not a mobi-ramp time-series file\n", path);
+      close(fd);
+      return -1;
+    }
+    if (hdr.version != TS_VERSION || hdr.record_size != sizeof(Ts_Record)) {
+      fprintf(stderr, "%s is a version %u time-series file, this gateway writes version %u\n", path,
+              (unsigned)hdr.version, (unsigned)TS_VERSION);
+      close(fd);
+      return -1;
+    }
+    // Drop a torn record left by an earlier crash so the file stays aligned.
+    off_t tail = (st.st_size - (off_t)sizeof(Ts_Header)) % (off_t)sizeof(Ts_Record);
+    if (tail != 0 && ftruncate(fd, st.st_size - tail) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+static void flush_batch(int ts_fd)
+{
+  Last_Flush_Us = now_us(CLOCK_MONOTONIC);
+  if (Batch.empty())
+    return;
+
+  const char* p = (const char*)Batch.data();
+  size_t left = Batch.size() * sizeof(Ts_Record);
+  while (left > 0) {
+    ssize_t n = write(ts_fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("time-series write");
+      break;
+    }
+    p += n;
+    left -= (size_t)n;
+  }
+  Stats.records_written += Batch.size();
+  Stats.batches_written++;
+  Batch.clear();
+}
+
+static int dump_ts_file(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    perror(path);
+    return 1;
+  }
+
+  Ts_Header hdr;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TS_MAGIC, 4) != 0) {
+    fprintf(stderr, "%s is not a mobi-ramp time-series file\n", path);
+    fclose(f);
+    return 1;
+  }
+  if (hdr.version != TS_VERSION || hdr.record_size != sizeof(Ts_Record)) {
+    fprintf(stderr, "%s is a version %u time-series file, this gateway reads version %u\n", path,
+            (unsigned)hdr.version, (unsigned)TS_VERSION);
+    fclose(f);
+    return 1;
+  }
+
+  Ts_Record rec;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    printf("%llu.%06llu %u %u %c %d\n", (unsigned long long)(rec.host_us / 1000000ULL),
+           (unsigned long long)(rec.host_us % 1000000ULL), rec.dev_ms, rec.seq, rec.kind, rec.value);
+  }
+  fclose(f);
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Event ingest
+/////////////////////////////////////////////////////////////////////////
+
+static void count_event(const mobi_event_t& ev)
+{
+  switch (ev.kind) {
+    case MOBI_EV_DETECT:
+      if (MOBI_EV_ON(ev.value))
+        Stats.detect_on++;
+      else
+        Stats.detect_off++;
+      break;
+    case MOBI_EV_RELAY:
+      if (MOBI_EV_ON(ev.value)) {
+        Stats.relay_on++;
+        Stats.relay_state |= 1 << MOBI_EV_CHANNEL(ev.value);
+      } else {
+        Stats.relay_off++;
+        Stats.relay_state &= ~(1 << MOBI_EV_CHANNEL(ev.value));
+      }
+      break;
+    case MOBI_EV_ERROR: {
+      int lane = MOBI_EV_ERROR_OF(ev.value);
+      if (lane < 0 || lane >= LANES)
+        break;
+      if (MOBI_EV_ERROR_CODE(ev.value))
+        Stats.errors++;
+      Stats.error_state[lane] = MOBI_EV_ERROR_CODE(ev.value);
+      break;
+    }
+    case MOBI_EV_LINK:
+      if (ev.value)
+        Stats.link_up++;
+      else
+        Stats.link_down++;
+      Stats.link_state = ev.value;
+      break;
+    case MOBI_EV_FAILOVER:
+      if (ev.value != 0)
+        Stats.failovers++;
+      Stats.active_link = ev.value;
+      break;
+  }
+}
+
+static void handle_line(const char* line, size_t length, int ts_fd)
+{
+  mobi_event_t ev;
+
+  Stats.lines++;
+  if (length < MOBI_EVENT_PREFIX_LEN || memcmp(line, MOBI_EVENT_PREFIX, MOBI_EVENT_PREFIX_LEN) != 0) {
+    Stats.log_lines++;
+    return;
+  }
+  if (!mobi_event_parse(line, length, &ev)) {
+    Stats.bad_events++;
+    return;
+  }
+
+  // A sequence number of 0 means the controller rebooted, not that 2^32 events were lost.
+  if (Have_Seq && ev.seq != Next_Seq && ev.seq != 0)
+    Stats.seq_gaps += (uint32_t)(ev.seq - Next_Seq);
+  Have_Seq = true;
+  Next_Seq = ev.seq + 1;
+
+  uint64_t t = now_us(CLOCK_REALTIME);
+  Stats.events++;
+  Stats.last_event_us = t;
+  count_event(ev);
+
+  Ts_Record rec;
+  rec.host_us = t;
+  rec.dev_ms  = ev.ms;
+  rec.seq     = ev.seq;
+  rec.value   = (int16_t)ev.value;
+  rec.kind    = ev.kind;
+  memset(rec.reserved, 0, sizeof(rec.reserved));
+  Batch.push_back(rec);
+
+  if (Batch.size() >= Batch_Records)
+    flush_batch(ts_fd);
+}
+
+static void ingest(const char* data, size_t length, int ts_fd)
+{
+  Stats.bytes_in += length;
+
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    if (c == '\n') {
+      if (Line_Overflow)
+        Stats.long_lines++;
+      else
+        handle_line(Line_Buf, Line_Len, ts_fd);
+      Line_Len = 0;
+      Line_Overflow = false;
+    } else if (Line_Len < LINE_BUF_SIZE) {
+      Line_Buf[Line_Len++] = c;
+    } else {
+      Line_Overflow = true;
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Live counters
+/////////////////////////////////////////////////////////////////////////
+
+static void serve_counters(int listen_fd)
+{
+  for (;;) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    char buf[1024];
+    int len = snprintf(buf, sizeof(buf),
+      "bytes_in=%llu\nlines=%llu\nlog_lines=%llu\nevents=%llu\nbad_events=%llu\nlong_lines=%llu\n"
+      "seq_gaps=%llu\ndetect_on=%llu\ndetect_off=%llu\nrelay_on=%llu\nrelay_off=%llu\nerrors=%llu\n"
+      "link_up=%llu\nlink_down=%llu\nfailovers=%llu\nrecords_written=%llu\nbatches_written=%llu\nrecords_pending=%zu\n"
+      "reopens=%llu\nlast_event_us=%llu\nrelay=%d\nlink=%d\nerror=%d\nerror1=%d\nactive_link=%d\n",
+      (unsigned long long)Stats.bytes_in, (unsigned long long)Stats.lines,
+      (unsigned long long)Stats.log_lines, (unsigned long long)Stats.events,
+      (unsigned long long)Stats.bad_events, (unsigned long long)Stats.long_lines,
+      (unsigned long long)Stats.seq_gaps, (unsigned long long)Stats.detect_on,
+      (unsigned long long)Stats.detect_off, (unsigned long long)Stats.relay_on,
+      (unsigned long long)Stats.relay_off, (unsigned long long)Stats.errors,
+      (unsigned long long)Stats.link_up, (unsigned long long)Stats.link_down,
+      (unsigned long long)Stats.failovers,
+      (unsigned long long)Stats.records_written, (unsigned long long)Stats.batches_written,
+      Batch.size(), (unsigned long long)Stats.reopens, (unsigned long long)Stats.last_event_us,
+      Stats.relay_state, Stats.link_state, Stats.error_state[0], Stats.error_state[1],
+      Stats.active_link);
+
+    // The reply is far below the socket buffer size, a short write only happens if the peer is already gone.
+    if (write(fd, buf, (size_t)len) < 0) {}
+    close(fd);
+  }
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr,
+    "usage: %s -d device [-b baud] [-o file] [-s socket] [-n batch_records] [-f flush_ms]\n"
+    "       %s -x file\n", prog, prog);
+}
+
+int main(int argc, char** argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:b:o:s:n:f:x:h")) != -1) {
+    switch (opt) {
+      case 'd': Device_Path   = optarg; break;
+      case 'b': Baud_Rate     = atoi(optarg); break;
+      case 'o': Ts_Path       = optarg; break;
+      case 's': Sock_Path     = optarg; break;
+      case 'n': Batch_Records = (size_t)atol(optarg); break;
+      case 'f': Flush_Ms      = atoi(optarg); break;
+      case 'x': return dump_ts_file(optarg);
+      default:  usage(argv[0]); return 2;
+    }
+  }
+
+  if (Device_Path == nullptr || baud_to_speed(Baud_Rate) == 0 || Batch_Records == 0 || Flush_Ms <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  int ts_fd = open_ts_file(Ts_Path);
+  if (ts_fd < 0) {
+    perror(Ts_Path);
+    return 1;
+  }
+
+  int listen_fd = open_listen_socket(Sock_Path);
+  if (listen_fd < 0)
+    return 1;
+
+  Batch.reserve(Batch_Records);
+  Last_Flush_Us = now_us(CLOCK_MONOTONIC);
+
+  int       serial_fd   = -1;
+  uint64_t  next_open   = 0;
+  char      buf[READ_BUF_SIZE];
+
+  while (!Stop) {
+    uint64_t now = now_us(CLOCK_MONOTONIC);
+
+    if (serial_fd < 0 && now >= next_open) {
+      serial_fd = open_serial(Device_Path, Baud_Rate);
+      if (serial_fd < 0) {
+        next_open = now + REOPEN_INTERVAL_MS * 1000ULL;
+      } else {
+        fprintf(stderr, "opened %s\n", Device_Path);
+        Line_Len = 0;
+        Line_Overflow = false;
+      }
+    }
+
+    struct pollfd fds[2];
+    int nfds = 0;
+    fds[nfds].fd = listen_fd;
+    fds[nfds].events = POLLIN;
+    nfds++;
+    if (serial_fd >= 0) {
+      fds[nfds].fd = serial_fd;
+      fds[nfds].events = POLLIN;
+      nfds++;
+    }
+
+    int timeout = Flush_Ms;
+    if (serial_fd < 0 && timeout > REOPEN_INTERVAL_MS)
+      timeout = REOPEN_INTERVAL_MS;
+
+    if (poll(fds, (nfds_t)nfds, timeout) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    if (fds[0].revents & POLLIN)
+      serve_counters(listen_fd);
+
+    if (nfds > 1 && fds[1].revents) {
+      // Drain everything the driver has buffered; one read per poll wakeup would cap us at the poll rate.
+      for (;;) {
+        ssize_t n = read(serial_fd, buf, sizeof(buf));
+        if (n > 0) {
+          ingest(buf, (size_t)n, ts_fd);
+          continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+          break;
+        // EOF or EIO: the board (or the pty in front of it) went away.
+        fprintf(stderr, "lost %s, reopening\n", Device_Path);
+        close(serial_fd);
+        serial_fd = -1;
+        next_open = now_us(CLOCK_MONOTONIC) + REOPEN_INTERVAL_MS * 1000ULL;
+        Stats.reopens++;
+        break;
+      }
+    }
+
+    if (now_us(CLOCK_MONOTONIC) - Last_Flush_Us >= (uint64_t)Flush_Ms * 1000ULL)
+      flush_batch(ts_fd);
+  }
+
+  flush_batch(ts_fd);
+  if (serial_fd >= 0)
+    close(serial_fd);
+  close(ts_fd);
+  close(listen_fd);
+  unlink(Sock_Path);
+  return 0;
+}
@@ -0,0 +1,1061 @@
+/* mobi-ramp sensor emulator
+ *
+ * Plays the sensor side of the controller's UART protocol so detection throughput and latency can be
+ * stress-tested without a physical sensor or a parking lot:
+ *
+ *   sensor -> controller   start                     after boot, repeated until the controller answers
+ *   controller -> sensor   _mobi-ramp
+ *   sensor -> controller   sensor
+ *   controller -> sensor   06:NN 01:NN 02:NN 04:NN 08:NN   parameter push
+ *                          21:NN 22:NN               second channel parameters, two-channel mode only
+ *   sensor -> controller   00:01 / 00:00             vehicle detected / left
+ *                          20:01 / 20:00             same on the second channel (-2)
+ *                          99:NN                     sensor error, 99:00 clears it
+ *   controller -> sensor   09:NN                     baud rate request, NN index into Baud_Table
+ *   sensor -> controller   09:NN                     ack at the old rate, then switch; back to 115200 if no
+ *                                                    valid line arrives within BAUD_REVERT_MS
+ *
+ * With -A detections are sequenced, like current sensor firmware:
+ *
+ *   sensor -> controller   00:0V,<seq>,<ms>          seq counts from 1, ms is the sensor's clock
+ *   controller -> sensor   10:<seq>                  cumulative ack
+ *
+ * The batch window (23:NN) is only pushed to BLE sensors that advertise batching, never over UART; the emulator
+ * reports it as an unknown line. Coalescing here is set with -c/-m.
+ *
+ * Up to SEQ_WINDOW detections are in flight; if the oldest is not acked within SEQ_RTO_MS all of them are sent
+ * again, oldest first. -L drops a percentage of the frames written to the link to exercise this.
+ *
+ * Firmware update (include/fw_update.h): the emulator takes the controller's 12: offer, 13: blocks and answers
+ * with 14: acks and the 12: verdict, resuming a transfer of the same image where it stopped. -L also drops that
+ * percentage of the received blocks. -F writes the received image to a file.
+ *
+ * By default a pty is created and its slave path printed (and optionally symlinked with -l). With -d an existing
+ * tty is used instead, e.g. a USB-UART adapter wired to the controller's RX1/TX1.
+ *
+ * Traffic is generated as Poisson vehicle arrivals (-r per second) with an exponential dwell time (-w), optionally
+ * in bursts (-B count,gap_ms); -2 puts a percentage of them on the second channel. Frames can be split across writes (-p percent) or coalesced several to one write
+ * (-c count, -m window_ms) to exercise the controller's framing.
+ *
+ * If the controller's USB console is given with -C, the emulator also reads its @EV event lines
+ * (include/mobi_event.h) and matches every detection the controller reports to the frame that caused it, giving
+ * end-to-end detection latency.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mobi_event.h"
+
+#define LINE_BUF_SIZE         512     // firmware blocks are ~360 characters
+#define START_RETRY_MS        2000
+#define REPORT_INTERVAL_MS    1000
+#define LATENCY_FIFO_SIZE     4096
+#define LATENCY_BUCKETS       32
+#define BAUD_REVERT_MS        1000
+#define SEQ_WINDOW            8
+#define SEQ_RTO_MS            200
+#define FW_ACK_EVERY          8
+#define FW_ACK_IDLE_MS        20
+#define FW_MAX_IMAGE          (4 * 1024 * 1024)
+
+struct Timed_Frame {
+  uint64_t    due_us;
+  uint64_t    order;
+  std::string frame;
+  bool operator<(const Timed_Frame& o) const
+  {
+    return due_us != o.due_us ? due_us > o.due_us : order > o.order;
+  }
+};
+
+struct Sent_Detect {
+  uint64_t    sent_us;
+  int         value;
+};
+
+struct Seq_Frame {
+  uint16_t    seq;
+  std::string frame;
+};
+
+struct Emu_Stats {
+  uint64_t    frames;
+  uint64_t    writes;
+  uint64_t    bytes;
+  uint64_t    split_writes;
+  uint64_t    coalesced_writes;
+  uint64_t    detect_on;
+  uint64_t    detect_off;
+  uint64_t    errors;
+  uint64_t    handshakes;
+  uint64_t    baud_switches;
+  uint64_t    baud_reverts;
+  uint64_t    params;
+  uint64_t    dropped;
+  uint64_t    retransmits;
+  uint64_t    acks;
+  uint64_t    rx_lines;
+  uint64_t    matched;
+  uint64_t    unmatched;
+  uint64_t    extra;        // detections the controller reported that were never sent (applied twice)
+  uint64_t    fw_blocks;
+  uint64_t    fw_bad;       // blocks out of order, with a bad CRC or dropped by -L
+  uint64_t    fw_acks;
+  uint64_t    latency_sum_us;
+  uint64_t    latency_max_us;
+  uint64_t    latency_hist[LATENCY_BUCKETS];  // bucket i: latency < 2^i us
+};
+
+// Options
+static const char*          Device_Path     = nullptr;
+static const char*          Link_Path       = nullptr;
+static const char*          Console_Path    = nullptr;
+static const char*          Fw_Path         = nullptr;
+static int                  Baud_Rate       = 115200;
+static double               Arrival_Rate    = 1.0;
+static double               Dwell_Ms        = 800.0;
+static int                  Burst_Count     = 0;
+static int                  Burst_Gap_Ms    = 0;
+static double               Error_Per_Min   = 0.0;
+static int                  Error_Code      = 1;
+static int                  Error_Ms        = 3000;
+static int                  Split_Pct       = 0;
+static int                  Split_Gap_Ms    = 1;
+static int                  Coalesce_Count  = 1;
+static int                  Coalesce_Ms     = 0;
+static int                  Duration_S      = 0;
+static bool                 No_Handshake    = false;
+static bool                 Sequenced       = false;
+static int                  Loss_Pct        = 0;
+static int                  Lane1_Pct       = 0;
+static bool                 Quiet           = false;
+static unsigned             Seed            = 1;
+
+static volatile sig_atomic_t Stop           = 0;
+
+static Emu_Stats            Stats;
+static std::mt19937         Rng;
+
+// Link state
+static bool                 Connected       = false;
+static bool                 Traffic_On      = false;
+static uint8_t              Params_Seen     = 0;
+static int                  Param_Value[32];
+static int                  Current_Baud    = 115200;
+static bool                 Baud_Pending    = false;
+static uint64_t             Baud_Switch_Us  = 0;
+
+static const int            Baud_Table[4]   = {115200, 230400, 460800, 921600};
+
+// Scheduler and TX path
+static std::priority_queue<Timed_Frame> Schedule;
+static uint64_t             Schedule_Order  = 0;
+static std::deque<std::string> Tx_Queue;
+static std::string          Tx_Partial;
+static uint64_t             Tx_Hold_Until   = 0;
+static uint64_t             Tx_Window_Start = 0;
+
+// Sequenced detections
+static uint16_t             Seq_Next        = 1;
+static std::deque<std::string> Seq_Backlog;         // waiting for room in the window
+static std::deque<Seq_Frame> Seq_Unacked;
+static uint64_t             Seq_Sent_Us     = 0;    // last (re)transmission of the oldest unacked frame
+
+// Firmware update, kept over reconnects so an interrupted transfer resumes
+static std::vector<uint8_t> Fw_Image;
+static uint32_t             Fw_Crc          = 0;
+static uint32_t             Fw_Block_Size   = 0;
+static uint32_t             Fw_Blocks       = 0;
+static uint32_t             Fw_Next         = 0;
+static uint32_t             Fw_Unacked      = 0;
+static bool                 Fw_Active       = false;
+static uint64_t             Fw_Last_Block_Us = 0;
+static uint64_t             Fw_Start_Us     = 0;
+static uint32_t             Fw_Start_Block  = 0;
+
+// Generators
+static uint64_t             Next_Arrival_Us = 0;
+static int                  Burst_Left      = 0;
+static uint64_t             Next_Error_Us   = 0;
+
+// Latency matching against the controller console
+static Sent_Detect          Sent_Fifo[LATENCY_FIFO_SIZE];
+static size_t               Sent_Head       = 0;
+static size_t               Sent_Count      = 0;
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void on_signal(int)
+{
+  Stop = 1;
+}
+
+static speed_t baud_to_speed(int baud)
+{
+  switch (baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    default:      return 0;
+  }
+}
+
+static void set_raw(int fd, int baud)
+{
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0)
+    return;
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  cfsetispeed(&tio, baud_to_speed(baud));
+  cfsetospeed(&tio, baud_to_speed(baud));
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+static void set_baud(int fd, int baud)
+{
+  struct termios tio;
+  tcdrain(fd);
+  if (tcgetattr(fd, &tio) == 0) {
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  Current_Baud = baud;
+  if (!Quiet)
+    printf("baud rate %d\n", baud);
+}
+
+static int open_link()
+{
+  int fd;
+
+  if (Device_Path != nullptr) {
+    fd = open(Device_Path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      perror(Device_Path);
+      return -1;
+    }
+    set_raw(fd, Baud_Rate);
+    return fd;
+  }
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    perror("posix_openpt");
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  const char* slave = ptsname(fd);
+  // Configure the slave side raw as well, so the controller side sees bytes exactly as written.
+  int sfd = open(slave, O_RDWR | O_NOCTTY);
+  if (sfd >= 0) {
+    set_raw(sfd, Baud_Rate);
+    close(sfd);
+  }
+
+  if (Link_Path != nullptr) {
+    unlink(Link_Path);
+    if (symlink(slave, Link_Path) < 0)
+      perror(Link_Path);
+  }
+  printf("sensor pty: %s\n", slave);
+  fflush(stdout);
+  return fd;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Traffic generation
+/////////////////////////////////////////////////////////////////////////
+
+static double exp_ms(double mean_ms)
+{
+  if (mean_ms <= 0.0)
+    return 0.0;
+  std::exponential_distribution<double> d(1.0 / mean_ms);
+  return d(Rng);
+}
+
+static void schedule_frame(uint64_t due_us, const char* frame)
+{
+  Schedule.push(Timed_Frame{due_us, Schedule_Order++, frame});
+}
+
+static void schedule_arrival(uint64_t now)
+{
+  double gap_ms = exp_ms(1000.0 / Arrival_Rate);
+
+  if (Burst_Count > 0) {
+    if (--Burst_Left <= 0) {
+      Burst_Left = Burst_Count;
+      gap_ms += Burst_Gap_Ms;
+    }
+  }
+  Next_Arrival_Us = now + (uint64_t)(gap_ms * 1000.0);
+}
+
+static void generate(uint64_t now)
+{
+  if (!Traffic_On)
+    return;
+
+  while (Arrival_Rate > 0.0 && now >= Next_Arrival_Us) {
+    uint64_t t = Next_Arrival_Us;
+    bool lane1 = Lane1_Pct > 0 && (int)(Rng() % 100) < Lane1_Pct;
+    schedule_frame(t, lane1 ? "20:01\n" : "00:01\n");
+    schedule_frame(t + (uint64_t)(exp_ms(Dwell_Ms) * 1000.0), lane1 ? "20:00\n" : "00:00\n");
+    schedule_arrival(t);
+  }
+
+  while (Error_Per_Min > 0.0 && now >= Next_Error_Us) {
+    uint64_t t = Next_Error_Us;
+    char frame[16];
+    snprintf(frame, sizeof(frame), "99:%02d\n", Error_Code);
+    schedule_frame(t, frame);
+    schedule_frame(t + (uint64_t)Error_Ms * 1000ULL, "99:00\n");
+    Next_Error_Us = t + (uint64_t)(exp_ms(60000.0 / Error_Per_Min) * 1000.0);
+  }
+}
+
+static void start_traffic(uint64_t now)
+{
+  if (Traffic_On)
+    return;
+  Traffic_On = true;
+  Burst_Left = Burst_Count;
+  schedule_arrival(now);
+  Next_Error_Us = now + (uint64_t)(exp_ms(Error_Per_Min > 0.0 ? 60000.0 / Error_Per_Min : 0.0) * 1000.0);
+}
+
+static void stop_traffic()
+{
+  Traffic_On = false;
+  while (!Schedule.empty())
+    Schedule.pop();
+  Tx_Queue.clear();
+  Seq_Backlog.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////
+//TX path: coalescing and split frames
+/////////////////////////////////////////////////////////////////////////
+
+static bool is_detect(const std::string& frame)
+{
+  return frame.compare(0, 3, "00:") == 0 || frame.compare(0, 3, "20:") == 0;
+}
+
+static void note_sent(const std::string& frame, uint64_t t)
+{
+  Stats.frames++;
+  if (is_detect(frame)) {
+    int value = atoi(frame.c_str() + 3);
+    if (value)
+      Stats.detect_on++;
+    else
+      Stats.detect_off++;
+
+    if (Console_Path != nullptr) {
+      if (Sent_Count == LATENCY_FIFO_SIZE) {
+        Sent_Head = (Sent_Head + 1) % LATENCY_FIFO_SIZE;
+        Sent_Count--;
+        Stats.unmatched++;
+      }
+      // Matches the controller's D event value: the second channel adds 2
+      Sent_Fifo[(Sent_Head + Sent_Count) % LATENCY_FIFO_SIZE] = Sent_Detect{t, frame[0] == '2' ? value | 2 : value};
+      Sent_Count++;
+    }
+  } else if (frame.compare(0, 3, "99:") == 0 && atoi(frame.c_str() + 3) != 0) {
+    Stats.errors++;
+  }
+}
+
+static void write_all(int fd, const char* p, size_t n)
+{
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN) {
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        poll(&pfd, 1, 100);
+        continue;
+      }
+      return;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+}
+
+static void send_raw(int fd, const std::string& data)
+{
+  write_all(fd, data.data(), data.size());
+  Stats.writes++;
+  Stats.bytes += data.size();
+}
+
+static bool lost()
+{
+  if (Loss_Pct > 0 && (int)(Rng() % 100) < Loss_Pct) {
+    Stats.dropped++;
+    return true;
+  }
+  return false;
+}
+
+static void seq_pump(int fd, uint64_t now)
+{
+  // Go back N: nothing acked in time, send the whole window again.
+  if (!Seq_Unacked.empty() && now - Seq_Sent_Us >= SEQ_RTO_MS * 1000ULL) {
+    for (const Seq_Frame& f : Seq_Unacked) {
+      Stats.retransmits++;
+      if (!lost())
+        send_raw(fd, f.frame);
+    }
+    Seq_Sent_Us = now;
+  }
+
+  while (!Seq_Backlog.empty() && Seq_Unacked.size() < SEQ_WINDOW) {
+    // "00:0V\n" -> "00:0V,<seq>,<ms>\n"
+    std::string& base = Seq_Backlog.front();
+    char frame[48];
+    snprintf(frame, sizeof(frame), "%.*s,%u,%lu\n", (int)base.size() - 1, base.c_str(), (unsigned)Seq_Next,
+             (unsigned long)(now / 1000ULL));
+    if (Seq_Unacked.empty())
+      Seq_Sent_Us = now;
+    Seq_Unacked.push_back(Seq_Frame{Seq_Next++, frame});
+    Tx_Queue.push_back(frame);
+    Seq_Backlog.pop_front();
+  }
+}
+
+static void seq_ack(uint16_t seq)
+{
+  Stats.acks++;
+  bool moved = false;
+  while (!Seq_Unacked.empty() && (int16_t)(seq - Seq_Unacked.front().seq) >= 0) {
+    Seq_Unacked.pop_front();
+    moved = true;
+  }
+  if (moved)
+    Seq_Sent_Us = now_us();
+}
+
+static void tx_pump(int fd, uint64_t now)
+{
+  while (!Schedule.empty() && Schedule.top().due_us <= now) {
+    if (Sequenced && is_detect(Schedule.top().frame))
+      Seq_Backlog.push_back(Schedule.top().frame);
+    else
+      Tx_Queue.push_back(Schedule.top().frame);
+    Schedule.pop();
+  }
+  seq_pump(fd, now);
+
+  if (now < Tx_Hold_Until)
+    return;
+
+  if (!Tx_Partial.empty()) {
+    send_raw(fd, Tx_Partial);
+    Tx_Partial.clear();
+  }
+
+  while (!Tx_Queue.empty()) {
+    // Hold frames back until enough are queued to coalesce, or the window ran out.
+    if (Coalesce_Count > 1 && (int)Tx_Queue.size() < Coalesce_Count) {
+      if (Tx_Window_Start == 0)
+        Tx_Window_Start = now;
+      if (now - Tx_Window_Start < (uint64_t)Coalesce_Ms * 1000ULL)
+        return;
+    }
+    Tx_Window_Start = 0;
+
+    std::string out;
+    int n = 0;
+    while (!Tx_Queue.empty() && n < Coalesce_Count) {
+      note_sent(Tx_Queue.front(), now);
+      if (!lost())
+        out += Tx_Queue.front();
+      Tx_Queue.pop_front();
+      n++;
+    }
+    if (n > 1)
+      Stats.coalesced_writes++;
+    if (out.empty())
+      continue;
+
+    if (Split_Pct > 0 && out.size() > 1 && (int)(Rng() % 100) < Split_Pct) {
+      size_t cut = 1 + Rng() % (out.size() - 1);
+      send_raw(fd, out.substr(0, cut));
+      Tx_Partial = out.substr(cut);
+      Tx_Hold_Until = now + (uint64_t)Split_Gap_Ms * 1000ULL;
+      Stats.split_writes++;
+      return;
+    }
+    send_raw(fd, out);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Firmware update: 12: offer, 13: blocks, 14: acks
+/////////////////////////////////////////////////////////////////////////
+
+// Same as the ESP32 ROM's crc32_le(), i.e. zlib's crc32()
+static uint32_t crc32_le(uint32_t crc, const uint8_t* p, size_t n)
+{
+  crc = ~crc;
+  while (n--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+}
+
+static int base64_value(char c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+static bool base64_decode(const char* in, std::vector<uint8_t>& out)
+{
+  out.clear();
+  size_t n = strlen(in);
+  if (n % 4 != 0)
+    return false;
+  for (size_t i = 0; i < n; i += 4) {
+    int v[4];
+    for (int k = 0; k < 4; k++)
+      v[k] = in[i + k] == '=' ? 0 : base64_value(in[i + k]);
+    if (v[0] < 0 || v[1] < 0 || v[2] < 0 || v[3] < 0)
+      return false;
+    uint32_t w = (uint32_t)v[0] << 18 | (uint32_t)v[1] << 12 | (uint32_t)v[2] << 6 | (uint32_t)v[3];
+    out.push_back((uint8_t)(w >> 16));
+    if (in[i + 2] != '=')
+      out.push_back((uint8_t)(w >> 8));
+    if (in[i + 3] != '=')
+      out.push_back((uint8_t)w);
+  }
+  return true;
+}
+
+static void fw_send(int fd, const char* frame)
+{
+  if (!lost())
+    send_raw(fd, frame);
+}
+
+static void fw_ack(int fd)
+{
+  char ack[16];
+  snprintf(ack, sizeof(ack), "14:%u\n", Fw_Next);
+  fw_send(fd, ack);
+  Fw_Unacked = 0;
+  Stats.fw_acks++;
+}
+
+static void fw_verdict(int fd, uint64_t now)
+{
+  bool ok = crc32_le(0, Fw_Image.data(), Fw_Image.size()) == Fw_Crc;
+  fw_send(fd, ok ? "12:00\n" : "12:01\n");
+  Fw_Active = false;
+
+  double s = (now - Fw_Start_Us) / 1e6;
+  uint64_t bytes = (uint64_t)(Fw_Blocks - Fw_Start_Block) * Fw_Block_Size;
+  printf("firmware %s: %zu bytes, %u blocks from %u in %.2fs, %.0f B/s, %llu bad blocks\n",
+         ok ? "verified" : "CRC mismatch", Fw_Image.size(), Fw_Blocks - Fw_Start_Block, Fw_Start_Block, s,
+         s > 0 ? bytes / s : 0.0, (unsigned long long)Stats.fw_bad);
+  if (ok && Fw_Path != nullptr) {
+    FILE* f = fopen(Fw_Path, "wb");
+    if (f == nullptr || fwrite(Fw_Image.data(), 1, Fw_Image.size(), f) != Fw_Image.size())
+      perror(Fw_Path);
+    if (f != nullptr)
+      fclose(f);
+  }
+}
+
+static void fw_offer(int fd, const char* args, uint64_t now)
+{
+  unsigned long size, block;
+  unsigned long crc;
+  if (sscanf(args, "%lu,%lx,%lu", &size, &crc, &block) != 3 || block == 0) {
+    fw_send(fd, "12:03\n");
+    return;
+  }
+  if (size == 0 || size > FW_MAX_IMAGE) {
+    fw_send(fd, "12:02\n");
+    return;
+  }
+
+  // The same image again: carry on where the last transfer stopped.
+  if (size != Fw_Image.size() || crc != Fw_Crc || block != Fw_Block_Size) {
+    Fw_Image.assign(size, 0);
+    Fw_Crc = (uint32_t)crc;
+    Fw_Block_Size = (uint32_t)block;
+    Fw_Blocks = (uint32_t)((size + block - 1) / block);
+    Fw_Next = 0;
+  }
+  if (!Quiet)
+    printf("firmware offer: %lu bytes, crc %08lx, %u blocks, starting at %u\n", size, crc, Fw_Blocks, Fw_Next);
+  Fw_Active = true;
+  Fw_Start_Us = now;
+  Fw_Start_Block = Fw_Next;
+  fw_ack(fd);
+  if (Fw_Next == Fw_Blocks)
+    fw_verdict(fd, now);
+}
+
+static void fw_block(int fd, const char* args, uint64_t now)
+{
+  if (!Fw_Active)
+    return;
+  if (Loss_Pct > 0 && (int)(Rng() % 100) < Loss_Pct) {
+    Stats.dropped++;
+    Stats.fw_bad++;
+    return;
+  }
+
+  unsigned long block, crc;
+  int at = 0;
+  std::vector<uint8_t> data;
+  uint32_t want = 0;
+  bool ok = sscanf(args, "%lu,%lx,%n", &block, &crc, &at) == 2 && at > 0 && block == Fw_Next
+            && base64_decode(args + at, data);
+  if (ok) {
+    want = std::min<uint32_t>(Fw_Block_Size, (uint32_t)Fw_Image.size() - Fw_Next * Fw_Block_Size);
+    ok = data.size() == want && crc32_le(0, data.data(), data.size()) == crc;
+  }
+  if (!ok) {
+    // Out of order or damaged: tell the controller right away which block is missing.
+    Stats.fw_bad++;
+    fw_ack(fd);
+    return;
+  }
+
+  memcpy(&Fw_Image[Fw_Next * Fw_Block_Size], data.data(), want);
+  Fw_Next++;
+  Fw_Unacked++;
+  Fw_Last_Block_Us = now;
+  Stats.fw_blocks++;
+  if (Fw_Unacked >= FW_ACK_EVERY || Fw_Next == Fw_Blocks)
+    fw_ack(fd);
+  if (Fw_Next == Fw_Blocks)
+    fw_verdict(fd, now);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//RX path: handshake and parameter push from the controller
+/////////////////////////////////////////////////////////////////////////
+
+static const char* param_name(int cmd)
+{
+  switch (cmd) {
+    case 1:   return "DIRECTION";
+    case 2:   return "RELAYTIMER";
+    case 4:   return "SENSITIVITY";
+    case 6:   return "OPERATIONMODE";
+    case 8:   return "DIRECTION_CAT";
+    case 21:  return "DIRECTION1";
+    case 22:  return "RELAYTIMER1";
+    default:  return nullptr;
+  }
+}
+
+static void handle_link_line(int fd, const char* line, uint64_t now)
+{
+  Stats.rx_lines++;
+
+  if (strncmp(line, "10:", 3) == 0) {
+    if (Sequenced)
+      seq_ack((uint16_t)strtoul(line + 3, nullptr, 10));
+    return;
+  }
+
+  if (strncmp(line, "12:", 3) == 0) {
+    fw_offer(fd, line + 3, now);
+    return;
+  }
+  if (strncmp(line, "13:", 3) == 0) {
+    fw_block(fd, line + 3, now);
+    return;
+  }
+
+  if (strncmp(line, "09:", 3) == 0) {
+    int idx = atoi(line + 3);
+    if (idx < 0 || idx > 3)
+      return;
+    char ack[16];
+    snprintf(ack, sizeof(ack), "09:%02d\n", idx);
+    send_raw(fd, ack);
+    if (Baud_Table[idx] != Current_Baud) {
+      set_baud(fd, Baud_Table[idx]);
+      Stats.baud_switches++;
+      Baud_Pending = idx != 0;
+      Baud_Switch_Us = now;
+    }
+    return;
+  }
+
+  if (strcmp(line, "_mobi-ramp") == 0) {
+    Baud_Pending = false;
+    send_raw(fd, "sensor\n");
+    if (!Connected) {
+      Connected = true;
+      Params_Seen = 0;
+      Stats.handshakes++;
+      if (!Quiet)
+        printf("handshake done\n");
+    }
+    return;
+  }
+
+  // Parameter push: NN:VV, the controller pads values with a space ("06: 1")
+  if (strlen(line) >= 4 && line[2] == ':') {
+    int cmd = atoi(std::string(line, 2).c_str());
+    const char* name = param_name(cmd);
+    if (name != nullptr) {
+      Param_Value[cmd] = atoi(line + 3);
+      if (cmd < 10)
+        Params_Seen |= (uint8_t)(1u << (cmd / 2));
+      Baud_Pending = false;
+      Stats.params++;
+      if (!Quiet)
+        printf("param %s = %d\n", name, Param_Value[cmd]);
+      // 01 02 04 06 08 all received
+      if (Params_Seen == 0x1F)
+        start_traffic(now);
+      return;
+    }
+  }
+
+  if (!Quiet)
+    printf("unknown line from controller: %s\n", line);
+}
+
+static void rx_lines(int fd, char* buf, size_t& len, void (*handle)(int, const char*, uint64_t), int reply_fd)
+{
+  char tmp[1024];
+  for (;;) {
+    ssize_t n = read(fd, tmp, sizeof(tmp));
+    if (n <= 0)
+      break;
+    for (ssize_t i = 0; i < n; i++) {
+      char c = tmp[i];
+      if (c == '\n' || c == '\r') {
+        if (len > 0) {
+          buf[len] = '\0';
+          handle(reply_fd, buf, now_us());
+        }
+        len = 0;
+      } else if (len < LINE_BUF_SIZE - 1) {
+        buf[len++] = c;
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Latency: match @EV detection lines from the controller console
+/////////////////////////////////////////////////////////////////////////
+
+static void handle_console_line(int, const char* line, uint64_t now)
+{
+  mobi_event_t ev;
+  if (!mobi_event_parse(line, strlen(line), &ev) || ev.kind != MOBI_EV_DETECT)
+    return;
+
+  if (Sent_Count == 0) {
+    Stats.extra++;
+    return;
+  }
+
+  // Detections the controller never reported are skipped over and counted.
+  while (Sent_Count > 0) {
+    Sent_Detect s = Sent_Fifo[Sent_Head];
+    Sent_Head = (Sent_Head + 1) % LATENCY_FIFO_SIZE;
+    Sent_Count--;
+    if (s.value != ev.value) {
+      Stats.unmatched++;
+      continue;
+    }
+    uint64_t lat = now - s.sent_us;
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && lat >= (1ULL << b))
+      b++;
+    Stats.latency_hist[b]++;
+    Stats.latency_sum_us += lat;
+    if (lat > Stats.latency_max_us)
+      Stats.latency_max_us = lat;
+    Stats.matched++;
+    return;
+  }
+}
+
+static uint64_t latency_percentile(double pct)
+{
+  uint64_t want = (uint64_t)ceil(Stats.matched * pct / 100.0);
+  uint64_t seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += Stats.latency_hist[b];
+    if (seen >= want && want > 0)
+      return 1ULL << b;
+  }
+  return 0;
+}
+
+static void report(double elapsed_s)
+{
+  printf("t=%.1fs frames=%llu writes=%llu bytes=%llu split=%llu coalesced=%llu on=%llu off=%llu err=%llu "
+         "handshakes=%llu baud=%d switches=%llu reverts=%llu",
+         elapsed_s, (unsigned long long)Stats.frames, (unsigned long long)Stats.writes,
+         (unsigned long long)Stats.bytes, (unsigned long long)Stats.split_writes,
+         (unsigned long long)Stats.coalesced_writes, (unsigned long long)Stats.detect_on,
+         (unsigned long long)Stats.detect_off, (unsigned long long)Stats.errors,
+         (unsigned long long)Stats.handshakes, Current_Baud, (unsigned long long)Stats.baud_switches,
+         (unsigned long long)Stats.baud_reverts);
+  if (Sequenced || Loss_Pct > 0) {
+    printf(" dropped=%llu retx=%llu acks=%llu inflight=%zu", (unsigned long long)Stats.dropped,
+           (unsigned long long)Stats.retransmits, (unsigned long long)Stats.acks, Seq_Unacked.size());
+  }
+  if (Fw_Blocks > 0) {
+    printf(" fw=%u/%u fw_bad=%llu fw_acks=%llu", Fw_Next, Fw_Blocks, (unsigned long long)Stats.fw_bad,
+           (unsigned long long)Stats.fw_acks);
+  }
+  if (Console_Path != nullptr && Stats.matched > 0) {
+    printf(" matched=%llu unmatched=%llu extra=%llu lat_avg=%lluus lat_p99<%lluus lat_max=%lluus",
+           (unsigned long long)Stats.matched, (unsigned long long)Stats.unmatched, (unsigned long long)Stats.extra,
+           (unsigned long long)(Stats.latency_sum_us / Stats.matched),
+           (unsigned long long)latency_percentile(99.0), (unsigned long long)Stats.latency_max_us);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -d PATH        use an existing tty instead of creating a pty\n"
+    "  -l PATH        symlink the pty slave to PATH\n"
+    "  -b BAUD        line speed for -d (default 115200)\n"
+    "  -r RATE        vehicle arrivals per second (default 1)\n"
+    "  -w MS          mean dwell between 00:01 and 00:00 (default 800)\n"
+    "  -B N,GAP_MS    bursts of N arrivals separated by GAP_MS of silence\n"
+    "  -e PER_MIN     sensor errors per minute (default 0)\n"
+    "  -E CODE        error code for 99:xx (default 1)\n"
+    "  -H MS          how long an error lasts before 99:00 (default 3000)\n"
+    "  -p PCT         percent of writes split in two (default 0)\n"
+    "  -g MS          gap between the halves of a split write (default 1)\n"
+    "  -c N           coalesce up to N frames per write (default 1)\n"
+    "  -m MS          coalescing window (default 0)\n"
+    "  -C PATH        controller USB console, for detection latency\n"
+    "  -t SECONDS     stop after SECONDS (default: run until interrupted)\n"
+    "  -n             skip the handshake, start sending immediately\n"
+    "  -A             sequenced, acknowledged detections\n"
+    "  -L PCT         percent of frames lost on the link (default 0)\n"
+    "  -2 PCT         percent of arrivals on the second channel (default 0)\n"
+    "  -F PATH        write a received firmware image to PATH\n"
+    "  -S SEED        random seed (default 1)\n"
+    "  -q             only print periodic statistics\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:l:b:r:w:B:e:E:H:p:g:c:m:C:t:nAL:2:F:S:qh")) != -1) {
+    switch (opt) {
+      case 'd': Device_Path    = optarg; break;
+      case 'l': Link_Path      = optarg; break;
+      case 'b': Baud_Rate      = atoi(optarg); break;
+      case 'r': Arrival_Rate   = atof(optarg); break;
+      case 'w': Dwell_Ms       = atof(optarg); break;
+      case 'B':
+        if (sscanf(optarg, "%d,%d", &Burst_Count, &Burst_Gap_Ms) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'e': Error_Per_Min  = atof(optarg); break;
+      case 'E': Error_Code     = atoi(optarg); break;
+      case 'H': Error_Ms       = atoi(optarg); break;
+      case 'p': Split_Pct      = atoi(optarg); break;
+      case 'g': Split_Gap_Ms   = atoi(optarg); break;
+      case 'c': Coalesce_Count = atoi(optarg); break;
+      case 'm': Coalesce_Ms    = atoi(optarg); break;
+      case 'C': Console_Path   = optarg; break;
+      case 't': Duration_S     = atoi(optarg); break;
+      case 'n': No_Handshake   = true; break;
+      case 'A': Sequenced      = true; break;
+      case 'L': Loss_Pct       = atoi(optarg); break;
+      case '2': Lane1_Pct      = atoi(optarg); break;
+      case 'F': Fw_Path        = optarg; break;
+      case 'S': Seed           = (unsigned)strtoul(optarg, nullptr, 10); break;
+      case 'q': Quiet          = true; break;
+      default:  usage(argv[0]); return 2;
+    }
+  }
+
+  if (baud_to_speed(Baud_Rate) == 0 || Arrival_Rate < 0.0 || Coalesce_Count < 1 || Split_Pct < 0
+      || Split_Pct > 100 || Loss_Pct < 0 || Loss_Pct > 100 || Lane1_Pct < 0 || Lane1_Pct > 100
+      || Error_Code < 1 || Error_Code > 99) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  Rng.seed(Seed);
+  Current_Baud = Baud_Rate;
+
+  int link_fd = open_link();
+  if (link_fd < 0)
+    return 1;
+
+  int console_fd = -1;
+  if (Console_Path != nullptr) {
+    console_fd = open(Console_Path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (console_fd < 0) {
+      perror(Console_Path);
+      return 1;
+    }
+    set_raw(console_fd, 115200);
+  }
+
+  char      link_buf[LINE_BUF_SIZE];
+  size_t    link_len      = 0;
+  char      console_buf[LINE_BUF_SIZE];
+  size_t    console_len   = 0;
+  uint64_t  t0            = now_us();
+  uint64_t  next_start    = t0;
+  uint64_t  next_report   = t0 + REPORT_INTERVAL_MS * 1000ULL;
+
+  if (No_Handshake) {
+    Connected = true;
+    start_traffic(t0);
+  }
+
+  while (!Stop) {
+    uint64_t now = now_us();
+
+    if (Duration_S > 0 && now - t0 >= (uint64_t)Duration_S * 1000000ULL)
+      break;
+
+    if (!Connected && now >= next_start) {
+      send_raw(link_fd, "start\n");
+      next_start = now + START_RETRY_MS * 1000ULL;
+    }
+
+    // The controller never confirmed the new rate: go back to the default like the real sensor does.
+    if (Baud_Pending && now - Baud_Switch_Us >= BAUD_REVERT_MS * 1000ULL) {
+      Baud_Pending = false;
+      set_baud(link_fd, Baud_Table[0]);
+      Stats.baud_reverts++;
+    }
+
+    generate(now);
+    tx_pump(link_fd, now);
+
+    // Acks for blocks that did not fill FW_ACK_EVERY, once the controller pauses
+    if (Fw_Unacked > 0 && now - Fw_Last_Block_Us >= FW_ACK_IDLE_MS * 1000ULL)
+      fw_ack(link_fd);
+
+    if (now >= next_report) {
+      report((now - t0) / 1e6);
+      next_report += REPORT_INTERVAL_MS * 1000ULL;
+    }
+
+    // Sleep until the next thing is due, or until the controller talks to us.
+    uint64_t wake = next_report;
+    if (!Connected && next_start < wake)
+      wake = next_start;
+    if (Traffic_On && Arrival_Rate > 0.0 && Next_Arrival_Us < wake)
+      wake = Next_Arrival_Us;
+    if (Traffic_On && Error_Per_Min > 0.0 && Next_Error_Us < wake)
+      wake = Next_Error_Us;
+    if (Baud_Pending && Baud_Switch_Us + BAUD_REVERT_MS * 1000ULL < wake)
+      wake = Baud_Switch_Us + BAUD_REVERT_MS * 1000ULL;
+    if (!Schedule.empty() && Schedule.top().due_us < wake)
+      wake = Schedule.top().due_us;
+    if (Fw_Unacked > 0 && Fw_Last_Block_Us + FW_ACK_IDLE_MS * 1000ULL < wake)
+      wake = Fw_Last_Block_Us + FW_ACK_IDLE_MS * 1000ULL;
+    if (!Seq_Unacked.empty() && Seq_Sent_Us + SEQ_RTO_MS * 1000ULL < wake)
+      wake = Seq_Sent_Us + SEQ_RTO_MS * 1000ULL;
+    if ((!Tx_Partial.empty() || !Tx_Queue.empty()) && Tx_Hold_Until < wake)
+      wake = Tx_Hold_Until > now ? Tx_Hold_Until : now + 1000;
+
+    now = now_us();
+    int timeout_ms = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+
+    struct pollfd fds[2];
+    int nfds = 0;
+    fds[nfds++] = {link_fd, POLLIN, 0};
+    if (console_fd >= 0)
+      fds[nfds++] = {console_fd, POLLIN, 0};
+
+    if (poll(fds, (nfds_t)nfds, timeout_ms) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    // POLLHUP on the pty master only means nobody has the slave open yet.
+    if (fds[0].revents & POLLIN)
+      rx_lines(link_fd, link_buf, link_len, handle_link_line, link_fd);
+    else if (fds[0].revents & POLLHUP)
+      usleep(10000);
+
+    if (nfds > 1 && (fds[1].revents & POLLIN))
+      rx_lines(console_fd, console_buf, console_len, handle_console_line, -1);
+  }
+
+  stop_traffic();
+  report((now_us() - t0) / 1e6);
+
+  if (Link_Path != nullptr && Device_Path == nullptr)
+    unlink(Link_Path);
+  if (console_fd >= 0)
+    close(console_fd);
+  close(link_fd);
+  return 0;
+}